@@ -3,12 +3,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 #include <time.h>
 #include "cstack.h"
+#include "ChippyJit.h"
+#include "ChippyMovie.h"
 
 // Rom Display
-// RGBA32
-uint32_t g_DisplayBuffer[CHIPPY_DISPLAY_HEIGHT][CHIPPY_DISPLAY_WIDTH];
 SDL_Texture* g_DisplayTexture = NULL;
 const SDL_Color g_DisplayColors[2] =
 {
@@ -16,27 +17,13 @@ const SDL_Color g_DisplayColors[2] =
     { 93, 232, 165, 255 } // on color
 };
 
-// Rom Time
+// App Time
 double g_TimeStep = CHIPPY_FIXED_STEP;
 uint64_t g_DeltaTime = 0;
 uint64_t g_CurrentTime = 0;
 
-bool g_GamePaused = false;
-uint8_t g_DelayTimer = 0;
-uint8_t g_SoundTimer = 0;
-double g_GameTimer = 0;
-double g_CycleTimer = 0;
-
-// Rom Memory
-uint16_t g_ProgramCounter = CHIPPY_STARTING_PROGRAM_COUNTER;
-uint8_t g_VariableRegisters[16];
-uint16_t g_IndexRegister = 0;
-Cstack* g_AddressStack = NULL;
-uint8_t* g_RomMemory = NULL;
-size_t g_RomSize = 0;
-
 // Rom Fonts
-static const uint16_t g_Font[16][5] =
+static const uint8_t g_Font[16][5] =
 {
     { 0xF0, 0x90, 0x90, 0x90, 0xF0 }, // 0
     { 0x20, 0x60, 0x20, 0x20, 0x70 }, // 1
@@ -60,7 +47,7 @@ static const uint32_t g_FontHeight = 5;
 
 // Rom Inputs
 
-static const uint8_t g_InputHexTable[16] =
+const uint8_t g_InputHexTable[16] =
 {
     SDL_SCANCODE_1, // 0x0
     SDL_SCANCODE_2, // 0x1
@@ -86,7 +73,7 @@ static const uint8_t g_InputHexTable[16] =
     7 8 9 E              A S D F
     A 0 B F              Z X C V
 */
-// Set size large enough to cover all scancodes used, SCANCODE_4 == 33 
+// Set size large enough to cover all scancodes used, SCANCODE_4 == 33
 static const uint8_t g_InputScanTable[34] = {
     [SDL_SCANCODE_1] = 0x0,
     [SDL_SCANCODE_2] = 0x1,
@@ -107,511 +94,1258 @@ static const uint8_t g_InputScanTable[34] = {
     // All other values default to 0
 };
 
-static const uint64_t g_InputBitMask = 1ull << SDL_SCANCODE_1 |
-                                        1ull << SDL_SCANCODE_2 |
-                                        1ull << SDL_SCANCODE_3 |
-                                        1ull << SDL_SCANCODE_4 |
-                                        1ull << SDL_SCANCODE_Q |
-                                        1ull << SDL_SCANCODE_W |
-                                        1ull << SDL_SCANCODE_E |
-                                        1ull << SDL_SCANCODE_R |
-                                        1ull << SDL_SCANCODE_A |
-                                        1ull << SDL_SCANCODE_S |
-                                        1ull << SDL_SCANCODE_D |
-                                        1ull << SDL_SCANCODE_F |
-                                        1ull << SDL_SCANCODE_Z |
-                                        1ull << SDL_SCANCODE_X |
-                                        1ull << SDL_SCANCODE_C |
-                                        1ull << SDL_SCANCODE_V;
-uint64_t g_InputBitMap = 0;
-uint8_t g_LastInput = 0;
-
-void CHIPPY_InitVariableRegister()
+const uint64_t g_InputBitMask = 1ull << SDL_SCANCODE_1 |
+                                1ull << SDL_SCANCODE_2 |
+                                1ull << SDL_SCANCODE_3 |
+                                1ull << SDL_SCANCODE_4 |
+                                1ull << SDL_SCANCODE_Q |
+                                1ull << SDL_SCANCODE_W |
+                                1ull << SDL_SCANCODE_E |
+                                1ull << SDL_SCANCODE_R |
+                                1ull << SDL_SCANCODE_A |
+                                1ull << SDL_SCANCODE_S |
+                                1ull << SDL_SCANCODE_D |
+                                1ull << SDL_SCANCODE_F |
+                                1ull << SDL_SCANCODE_Z |
+                                1ull << SDL_SCANCODE_X |
+                                1ull << SDL_SCANCODE_C |
+                                1ull << SDL_SCANCODE_V;
+
+void CHIPPY_InitVariableRegister(ChippyMachine* machine)
 {
     for (int i = 0; i < 16; i++)
     {
-        g_VariableRegisters[i] = 0;
+        machine->variableRegisters[i] = 0;
     }
 }
 
-inline uint32_t CHIPPY_SDLColor_To_Uint32(SDL_Color* color)
+static inline uint32_t CHIPPY_SDLColor_To_Uint32(const SDL_Color* color)
 {
     return (uint32_t)color->r << 24 | (uint32_t)color->g << 16 | (uint32_t)color->b << 8 | (uint32_t)color->a;
 }
 
-void CHIPPY_ClearDisplayBuffer()
+SDL_COMPILE_TIME_ASSERT(dirtyRows, CHIPPY_DISPLAY_HEIGHT <= 32);
+
+void CHIPPY_ClearDisplayBuffer(ChippyMachine* machine)
 {
-    const uint32_t clearColor = CHIPPY_SDLColor_To_Uint32(&g_DisplayColors[0]);
-    for (int i = 0; i < CHIPPY_DISPLAY_HEIGHT; ++i)
+    // Only rows that had something on them actually change
+    for (int y = 0; y < CHIPPY_DISPLAY_HEIGHT; ++y)
     {
-        for (int j = 0; j < CHIPPY_DISPLAY_WIDTH; ++j)
-            g_DisplayBuffer[i][j] = clearColor;
+        machine->dirtyRows |= (uint32_t)(machine->displayPlane[y] != 0) << y;
+        machine->displayPlane[y] = 0;
     }
 }
 
-inline uint8_t CHIPPY_CheckColorPresent(uint32_t* pixel)
+uint32_t CHIPPY_TakeDirtyRows(ChippyMachine* machine)
 {
-    return (uint8_t)(*pixel ^ CHIPPY_SDLColor_To_Uint32(&g_DisplayColors[1]));
+    const uint32_t dirtyRows = machine->dirtyRows;
+    machine->dirtyRows = 0;
+    return dirtyRows;
 }
 
-inline void CHIPPY_SetColorAt(uint32_t* idx, SDL_Color* color)
+void CHIPPY_ExpandDisplay(const ChippyMachine* machine, uint32_t* pixels, int pitch, int firstRow, int rowCount)
 {
-    *idx = CHIPPY_SDLColor_To_Uint32(color);
+    const uint32_t colors[2] =
+    {
+        CHIPPY_SDLColor_To_Uint32(&g_DisplayColors[0]),
+        CHIPPY_SDLColor_To_Uint32(&g_DisplayColors[1])
+    };
+
+    for (int y = 0; y < rowCount; ++y)
+    {
+        const uint64_t row = machine->displayPlane[firstRow + y];
+        uint32_t* dst = (uint32_t*)((uint8_t*)pixels + (size_t)y * pitch);
+        for (int x = 0; x < CHIPPY_DISPLAY_WIDTH; ++x)
+            dst[x] = colors[(row >> (CHIPPY_DISPLAY_WIDTH - 1 - x)) & 1];
+    }
 }
 
-int CHIPPY_LoadRom()
+uint64_t CHIPPY_HashDisplay(const ChippyMachine* machine)
 {
-    float secondsPerCycle = 1.0 / CHIPPY_CYCLES_PER_SEC;
+    // 64 bit FNV-1a over each row's bytes, left to right, so the hash is the same on any host
+    uint64_t hash = 14695981039346656037ull;
+    for (int y = 0; y < CHIPPY_DISPLAY_HEIGHT; ++y)
+    {
+        for (int shift = CHIPPY_DISPLAY_WIDTH - 8; shift >= 0; shift -= 8)
+            hash = (hash ^ (uint8_t)(machine->displayPlane[y] >> shift)) * 1099511628211ull;
+    }
+    return hash;
+}
 
-    g_ProgramCounter = CHIPPY_STARTING_PROGRAM_COUNTER;
+/** Machine Functions **/
+// 8 bytes at once, for skipping over memory quickly. SDL_memcpy of a constant size compiles to a single load.
+static inline uint64_t CHIPPY_Load64(const uint8_t* bytes)
+{
+    uint64_t value;
+    SDL_memcpy(&value, bytes, sizeof(value));
+    return value;
+}
 
-    FILE* rom = fopen(CHIPPY_ROM_PATH, "rb");
-    if (!rom)
+// FNV-1a, only needs to tell roms apart. A zero byte only multiplies by the prime, so the zeroes filling most of
+// memory are taken 8 at a time by multiplying by the prime to the 8th.
+static uint32_t CHIPPY_HashMemory(const uint8_t* memory, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    size_t i = 0;
+    while (i < size)
+    {
+        if (i + 8 <= size && CHIPPY_Load64(memory + i) == 0)
+        {
+            hash *= 0x5D615F21u;
+            i += 8;
+            continue;
+        }
+        hash = (hash ^ memory[i]) * 16777619u;
+        ++i;
+    }
+    return hash;
+}
+
+/** Memory Pages **/
+SDL_COMPILE_TIME_ASSERT(ownedPages, CHIPPY_PAGE_COUNT <= 16);
+
+static void CHIPPY_ReleasePage(ChippyPage* page)
+{
+    if (page && SDL_AtomicDecRef(&page->refCount))
+        SDL_free(page);
+}
+
+static void CHIPPY_ReleaseBaseMemory(ChippyBaseMemory* base)
+{
+    if (base && SDL_AtomicDecRef(&base->refCount))
+        SDL_free(base);
+}
+
+// Gives the machine a page of its own to write to, copying it if it's shared
+static bool CHIPPY_OwnPage(ChippyMachine* machine, int index)
+{
+    ChippyPage* page = machine->pages[index];
+    if (SDL_GetAtomicInt(&page->refCount) != 1)
     {
-        fprintf(stderr, "Couldn't read rom at path %s\n", CHIPPY_ROM_PATH);
-        fclose(rom);
+        ChippyPage* copy = SDL_malloc(sizeof(ChippyPage));
+        if (!copy)
+        {
+            perror("Failed to copy memory page");
+            return false;
+        }
+        SDL_memcpy(copy, page, sizeof(ChippyPage));
+        SDL_SetAtomicInt(&copy->refCount, 1);
+        machine->pages[index] = copy;
+        // Whoever lets go of it last frees it, even if the other holder copied it at the same moment
+        CHIPPY_ReleasePage(page);
+    }
+    machine->ownedPages |= 1u << index;
+    return true;
+}
+
+// Owns every page a write to [address, address + length) touches, which includes the one before it as the
+// instruction starting on the byte before the write is re-decoded too
+static bool CHIPPY_OwnMemory(ChippyMachine* machine, uint16_t address, uint16_t length)
+{
+    const uint16_t first = (address - 1) & CHIPPY_ROM_MEM_MASK;
+    const int count = SDL_min(((first & CHIPPY_PAGE_MASK) + length + CHIPPY_PAGE_SIZE) >> CHIPPY_PAGE_SHIFT, CHIPPY_PAGE_COUNT);
+    for (int i = 0; i < count; ++i)
+    {
+        const int index = ((first >> CHIPPY_PAGE_SHIFT) + i) % CHIPPY_PAGE_COUNT;
+        if (!(machine->ownedPages & (1u << index)) && !CHIPPY_OwnPage(machine, index))
+            return false;
+    }
+    return true;
+}
+
+// Only valid once the page has been owned
+static inline uint8_t* CHIPPY_WritableByte(ChippyMachine* machine, uint16_t address)
+{
+    address &= CHIPPY_ROM_MEM_MASK;
+    return &machine->pages[address >> CHIPPY_PAGE_SHIFT]->memory[address & CHIPPY_PAGE_MASK];
+}
+
+void CHIPPY_ReadMemory(const ChippyMachine* machine, uint16_t address, uint8_t* data, uint16_t length)
+{
+    while (length > 0)
+    {
+        const uint16_t offset = address & CHIPPY_PAGE_MASK;
+        const uint16_t span = SDL_min(length, CHIPPY_PAGE_SIZE - offset);
+        SDL_memcpy(data, machine->pages[address >> CHIPPY_PAGE_SHIFT]->memory + offset, span);
+        address += span;
+        data += span;
+        length -= span;
+    }
+}
+
+bool CHIPPY_SameMemory(const ChippyMachine* a, const ChippyMachine* b)
+{
+    for (int i = 0; i < CHIPPY_PAGE_COUNT; ++i)
+    {
+        if (a->pages[i] != b->pages[i] && SDL_memcmp(a->pages[i]->memory, b->pages[i]->memory, CHIPPY_PAGE_SIZE) != 0)
+            return false;
+    }
+    return true;
+}
+
+// Takes the current memory as the image save states are stored relative to
+static int CHIPPY_SetBaseMemory(ChippyMachine* machine)
+{
+    // Forks sharing the old image keep it, this machine moves on to one of its own
+    if (SDL_GetAtomicInt(&machine->baseMemory->refCount) != 1)
+    {
+        ChippyBaseMemory* base = SDL_malloc(sizeof(ChippyBaseMemory));
+        if (!base)
+        {
+            perror("Failed to allocate base memory");
+            return 1;
+        }
+        SDL_SetAtomicInt(&base->refCount, 1);
+        CHIPPY_ReleaseBaseMemory(machine->baseMemory);
+        machine->baseMemory = base;
+    }
+
+    CHIPPY_ReadMemory(machine, 0, machine->baseMemory->memory, CHIPPY_ROM_MEM_SIZE);
+    return 0;
+}
+
+uint32_t CHIPPY_BaseHash(const ChippyMachine* machine)
+{
+    return CHIPPY_HashMemory(machine->baseMemory->memory, CHIPPY_ROM_MEM_SIZE);
+}
+
+// Everything but memory
+static void CHIPPY_ResetRegisters(ChippyMachine* machine)
+{
+    machine->programCounter = CHIPPY_STARTING_PROGRAM_COUNTER;
+    machine->indexRegister = 0;
+    CHIPPY_InitVariableRegister(machine);
+    Cstack_Init(&machine->addressStack);
+
+    machine->delayExpiry = 0;
+    machine->soundExpiry = 0;
+    machine->timerFrame = 0;
+    machine->cycleTimer = 0;
+    machine->cycles = 0;
+    machine->paused = false;
+
+    CHIPPY_ClearDisplayBuffer(machine);
+    // Whatever the frontend is showing is stale after a reset
+    machine->dirtyRows = CHIPPY_DISPLAY_ALL_ROWS;
+
+    machine->inputBitMap = 0;
+    machine->lastInput = 0;
+    machine->pendingInputBitMap = 0;
+    machine->pendingLastInput = 0;
+
+#if CHIPPY_COVERAGE
+    machine->coverageLast = 0;
+#endif
+}
+
+// Memory as it powers on, blank apart from the font, with the rom (if any) at the program start after it
+static int CHIPPY_ResetMemory(ChippyMachine* machine, const uint8_t* rom, size_t romSize)
+{
+    static const uint8_t blank[CHIPPY_ROM_MEM_SIZE] = { 0 };
+    const uint16_t fontEnd = g_FontStartAddress + sizeof(g_Font);
+    const uint16_t romEnd = (uint16_t)(CHIPPY_STARTING_PROGRAM_COUNTER + romSize);
+
+    machine->romSize = romSize;
+    return CHIPPY_WriteMemory(machine, 0, blank, g_FontStartAddress) ||
+        CHIPPY_WriteMemory(machine, g_FontStartAddress, &g_Font[0][0], sizeof(g_Font)) ||
+        CHIPPY_WriteMemory(machine, fontEnd, blank, CHIPPY_STARTING_PROGRAM_COUNTER - fontEnd) ||
+        CHIPPY_WriteMemory(machine, CHIPPY_STARTING_PROGRAM_COUNTER, rom ? rom : blank, (uint16_t)romSize) ||
+        CHIPPY_WriteMemory(machine, romEnd, blank, CHIPPY_ROM_MEM_SIZE - romEnd) ||
+        CHIPPY_SetBaseMemory(machine);
+}
+
+void CHIPPY_ResetMachine(ChippyMachine* machine)
+{
+    CHIPPY_ResetRegisters(machine);
+    CHIPPY_ResetMemory(machine, NULL, 0);
+}
+
+int CHIPPY_ResetWithRom(ChippyMachine* machine, const uint8_t* data, size_t size)
+{
+    if (size > CHIPPY_ROM_MAX_SIZE)
+    {
+        fprintf(stderr, "Rom is %zu bytes, only %d fit in memory\n", size, CHIPPY_ROM_MAX_SIZE);
         return 1;
     }
 
-    // Get rom size
-    fseek(rom, 0, SEEK_END);
-    g_RomSize = ftell(rom);
-    rewind(rom);
+    CHIPPY_ResetRegisters(machine);
+    return CHIPPY_ResetMemory(machine, data, size);
+}
 
-    // Allocate buffer
-    g_RomMemory = malloc(CHIPPY_ROM_MEM_SIZE);
-    if (!g_RomMemory) {
-        perror("Failed to allocate rom buffer");
-        fclose(rom);
+ChippyMachine* CHIPPY_CreateMachine()
+{
+    ChippyMachine* machine = SDL_calloc(1, sizeof(ChippyMachine));
+    if (!machine)
+    {
+        perror("Failed to allocate machine");
+        return NULL;
+    }
+
+    for (int i = 0; i < CHIPPY_PAGE_COUNT; ++i)
+    {
+        machine->pages[i] = SDL_calloc(1, sizeof(ChippyPage));
+        if (!machine->pages[i])
+        {
+            perror("Failed to allocate memory page");
+            CHIPPY_DestroyMachine(machine);
+            return NULL;
+        }
+        SDL_SetAtomicInt(&machine->pages[i]->refCount, 1);
+    }
+    machine->ownedPages = (1u << CHIPPY_PAGE_COUNT) - 1;
+    machine->baseMemory = SDL_calloc(1, sizeof(ChippyBaseMemory));
+    if (!machine->baseMemory)
+    {
+        perror("Failed to allocate base memory");
+        CHIPPY_DestroyMachine(machine);
+        return NULL;
+    }
+    SDL_SetAtomicInt(&machine->baseMemory->refCount, 1);
+
+    Cstack_Init(&machine->addressStack);
+    // Resets only re-decode memory that changes, so the cache has to match the zeroed memory to begin with
+    CHIPPY_InvalidateDecoded(machine, 0, CHIPPY_ROM_MEM_SIZE);
+    CHIPPY_ResetMachine(machine);
+    CHIPPY_SeedRandom(machine, CHIPPY_DEFAULT_SEED);
+    CHIPPY_SetDispatch(machine, CHIPPY_DISPATCH_DEFAULT);
+    machine->quirks = CHIPPY_QUIRKS_DEFAULT;
+    return machine;
+}
+
+void CHIPPY_DestroyMachine(ChippyMachine* machine)
+{
+    if (!machine) return;
+
+    CHIPPY_DestroyJit(machine->jit);
+    for (int i = 0; i < CHIPPY_PAGE_COUNT; ++i)
+        CHIPPY_ReleasePage(machine->pages[i]);
+    CHIPPY_ReleaseBaseMemory(machine->baseMemory);
+    SDL_free(machine);
+}
+
+ChippyMachine* CHIPPY_ForkMachine(ChippyMachine* parent)
+{
+    ChippyMachine* machine = SDL_malloc(sizeof(ChippyMachine));
+    if (!machine)
+    {
+        perror("Failed to allocate machine");
+        return NULL;
+    }
+
+    *machine = *parent;
+    for (int i = 0; i < CHIPPY_PAGE_COUNT; ++i)
+        SDL_AtomicIncRef(&machine->pages[i]->refCount);
+    SDL_AtomicIncRef(&machine->baseMemory->refCount);
+    // Every page is shared now, so whichever writes first has to copy
+    parent->ownedPages = 0;
+    machine->ownedPages = 0;
+
+    // Compiled blocks are kept per machine
+    machine->jit = NULL;
+    machine->movie = NULL;
+    if (parent->dispatch == CHIPPY_DISPATCH_JIT)
+        CHIPPY_SetDispatch(machine, CHIPPY_DISPATCH_JIT);
+    return machine;
+}
+
+bool CHIPPY_SetDispatch(ChippyMachine* machine, ChippyDispatch dispatch)
+{
+#if CHIPPY_PROFILE
+    if (dispatch == CHIPPY_DISPATCH_JIT)
+    {
+        machine->dispatch = CHIPPY_DISPATCH_THREADED;
+        return false;
+    }
+#endif
+
+    if (dispatch == CHIPPY_DISPATCH_JIT && !machine->jit)
+    {
+        // Blocks are compiled from the decoded cache, so the jit can start at any point in a run
+        machine->jit = CHIPPY_CreateJit();
+        if (!machine->jit)
+        {
+            machine->dispatch = CHIPPY_DISPATCH_THREADED;
+            return false;
+        }
+    }
+
+    machine->dispatch = dispatch;
+    return true;
+}
+
+const uint8_t g_QuirkFlags[CHIPPY_QUIRKS_COUNT] =
+{
+    [CHIPPY_QUIRKS_VIP] = CHIPPY_QUIRKS_VIP_FLAGS,
+    [CHIPPY_QUIRKS_SCHIP] = CHIPPY_QUIRKS_SCHIP_FLAGS,
+    [CHIPPY_QUIRKS_XOCHIP] = CHIPPY_QUIRKS_XOCHIP_FLAGS,
+};
+
+const char* const g_QuirkNames[CHIPPY_QUIRKS_COUNT] =
+{
+    [CHIPPY_QUIRKS_VIP] = "vip",
+    [CHIPPY_QUIRKS_SCHIP] = "schip",
+    [CHIPPY_QUIRKS_XOCHIP] = "xochip",
+};
+
+void CHIPPY_SetQuirks(ChippyMachine* machine, ChippyQuirks quirks)
+{
+    if ((unsigned)quirks >= CHIPPY_QUIRKS_COUNT)
+        quirks = CHIPPY_QUIRKS_DEFAULT;
+    if (machine->quirks == quirks)
+        return;
+
+    // Blocks have the quirks compiled into them
+    machine->quirks = (uint8_t)quirks;
+    if (machine->jit)
+        CHIPPY_JitFlush(machine->jit);
+}
+
+ChippyQuirks CHIPPY_QuirksForRom(const char* path)
+{
+    const char* extension = SDL_strrchr(path, '.');
+    if (extension && SDL_strcasecmp(extension, ".sc8") == 0)
+        return CHIPPY_QUIRKS_SCHIP;
+    if (extension && SDL_strcasecmp(extension, ".xo8") == 0)
+        return CHIPPY_QUIRKS_XOCHIP;
+    return CHIPPY_QUIRKS_VIP;
+}
+
+ChippyQuirks CHIPPY_FindQuirks(const char* name)
+{
+    for (int i = 0; i < CHIPPY_QUIRKS_COUNT; ++i)
+    {
+        if (SDL_strcmp(name, g_QuirkNames[i]) == 0)
+            return (ChippyQuirks)i;
+    }
+    return CHIPPY_QUIRKS_COUNT;
+}
+
+int CHIPPY_LoadRom(ChippyMachine* machine, const char* path)
+{
+    SDL_IOStream* rom = SDL_IOFromFile(path, "rb");
+    if (!rom)
+    {
+        fprintf(stderr, "Couldn't read rom at path %s: %s\n", path, SDL_GetError());
         return 1;
     }
 
-    // CHIP-8 expect program mem to start at addr 200 (512 in base-10)
-    uint8_t* romMemData = g_RomMemory + g_ProgramCounter;
+    // Check it fits before touching the machine, a rom too big would run over the end of memory
+    const Sint64 size = SDL_GetIOSize(rom);
+    if (size < 0 || size > CHIPPY_ROM_MAX_SIZE)
+    {
+        if (size < 0)
+            fprintf(stderr, "Couldn't get the size of rom %s: %s\n", path, SDL_GetError());
+        else
+            fprintf(stderr, "Rom %s is %" SDL_PRIs64 " bytes, only %d fit in memory\n", path, size, CHIPPY_ROM_MAX_SIZE);
+        SDL_CloseIO(rom);
+        return 1;
+    }
 
-    // Read file into buffer
-    size_t read = fread(romMemData, 1, g_RomSize, rom);
-    if (read != g_RomSize) {
-        perror("Failed to read entire rom");
-        fclose(rom);
+    // CHIP-8 expect program mem to start at addr 200 (512 in base-10)
+    uint8_t data[CHIPPY_ROM_MAX_SIZE];
+    const size_t read = SDL_ReadIO(rom, data, (size_t)size);
+    SDL_CloseIO(rom);
+    if (read != (size_t)size)
+    {
+        fprintf(stderr, "Failed to read entire rom %s: %s\n", path, SDL_GetError());
         return 1;
     }
 
-    fclose(rom);
+    if (CHIPPY_LoadRomFromMemory(machine, data, read) != 0)
+        return 1;
 
-    memcpy(&g_RomMemory[g_FontStartAddress], &g_Font, sizeof(g_Font));
+    // Only once the rom is in, a failed load leaves the machine on the profile it had
+    CHIPPY_SetQuirks(machine, CHIPPY_QuirksForRom(path));
     return 0;
 };
 
+int CHIPPY_LoadRomFromMemory(ChippyMachine* machine, const uint8_t* data, size_t size)
+{
+    if (size > CHIPPY_ROM_MAX_SIZE)
+    {
+        fprintf(stderr, "Rom is %zu bytes, only %d fit in memory\n", size, CHIPPY_ROM_MAX_SIZE);
+        return 1;
+    }
+
+    machine->programCounter = CHIPPY_STARTING_PROGRAM_COUNTER;
+    machine->romSize = size;
+    return CHIPPY_WriteMemory(machine, CHIPPY_STARTING_PROGRAM_COUNTER, data, (uint16_t)size) ||
+        CHIPPY_SetBaseMemory(machine);
+};
+
+static int SDLCALL CHIPPY_CompareRomPaths(const void* a, const void* b)
+{
+    return SDL_strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Packs the paths into one allocation, pointers first and the strings after, so a single SDL_free releases it all
+static char** CHIPPY_PackRomPaths(const char* directory, char* const* names, int count)
+{
+    size_t bytes = sizeof(char*) * (count + 1);
+    for (int i = 0; i < count; ++i)
+        bytes += (directory ? SDL_strlen(directory) + 1 : 0) + SDL_strlen(names[i]) + 1;
+
+    char** paths = SDL_malloc(bytes);
+    if (!paths)
+        return NULL;
+
+    char* text = (char*)(paths + count + 1);
+    const char* end = (const char*)paths + bytes;
+    for (int i = 0; i < count; ++i)
+    {
+        paths[i] = text;
+        text += SDL_snprintf(text, end - text, "%s%s%s", directory ? directory : "", directory ? "/" : "", names[i]) + 1;
+    }
+    paths[count] = NULL;
+
+    SDL_qsort(paths, count, sizeof(char*), CHIPPY_CompareRomPaths);
+    return paths;
+}
+
+char** CHIPPY_FindRoms(const char* path, int* count)
+{
+    *count = 0;
+
+    SDL_PathInfo info;
+    const bool isDirectory = SDL_GetPathInfo(path, &info) && info.type == SDL_PATHTYPE_DIRECTORY;
+    const char* wildcard = SDL_strpbrk(path, "*?");
+    if (!isDirectory && !wildcard)
+    {
+        char* single = (char*)path;
+        *count = 1;
+        return CHIPPY_PackRomPaths(NULL, &single, 1);
+    }
+
+    // Globs are split at the last separator before the first wildcard, the rest is matched inside that directory
+    char directory[1024];
+    const char* pattern = CHIPPY_ROM_GLOB;
+    SDL_GlobFlags flags = SDL_GLOB_CASEINSENSITIVE;
+    if (isDirectory)
+    {
+        SDL_strlcpy(directory, path, sizeof(directory));
+    }
+    else
+    {
+        const char* separator = NULL;
+        for (const char* c = path; c < wildcard; ++c)
+        {
+            if (*c == '/' || *c == '\\')
+                separator = c;
+        }
+
+        if (separator)
+            SDL_strlcpy(directory, path, SDL_min(sizeof(directory), (size_t)(separator - path) + 1));
+        else
+            SDL_strlcpy(directory, ".", sizeof(directory));
+        if (separator == path)
+            SDL_strlcpy(directory, "/", sizeof(directory));
+        pattern = separator ? separator + 1 : path;
+        flags = 0;
+    }
+
+    int found = 0;
+    char** names = SDL_GlobDirectory(directory, pattern, flags, &found);
+    if (!names)
+    {
+        fprintf(stderr, "Couldn't search %s for roms: %s\n", path, SDL_GetError());
+        return NULL;
+    }
+
+    char** paths = CHIPPY_PackRomPaths(directory, names, found);
+    SDL_free(names);
+    if (paths)
+        *count = found;
+    return paths;
+};
+
 /** Emulator Functions **/
-uint16_t CHIPPY_Fetch()
+uint16_t CHIPPY_Fetch(ChippyMachine* machine)
 {
     // Read instruction PC is pointing at from mem - two bytes combined into a 16 bit instruction
     // Increment the PC as we access the bytes, shuffle the PC to the next instruction for next fetch
-    uint16_t instruction = ((uint16_t)(g_RomMemory[g_ProgramCounter]) << 8) ^ (uint16_t)(g_RomMemory[g_ProgramCounter + 1]);
-    g_ProgramCounter += 2;
+    const uint16_t pc = machine->programCounter & CHIPPY_ROM_MEM_MASK;
+    uint16_t instruction = ((uint16_t)CHIPPY_ReadByte(machine, pc) << 8) ^ (uint16_t)CHIPPY_ReadByte(machine, pc + 1);
+    machine->programCounter += 2;
     return instruction;
 };
 
-inline void CHIPPY_Op_ClearScreen()
+static inline void CHIPPY_Op_ClearScreen(ChippyMachine* machine, const ChippyOp* op)
 {
-    CHIPPY_ClearDisplayBuffer();
+    CHIPPY_ClearDisplayBuffer(machine);
 };
 
-void CHIPPY_Op_PushSubroutine(uint16_t instruction)
+void CHIPPY_Op_PushSubroutine(ChippyMachine* machine, const ChippyOp* op)
 {
-    Cstack_Push(g_AddressStack, g_ProgramCounter);
-    g_ProgramCounter = NNN(instruction);
+    // On overflow the call is dropped and execution carries on past it, the error stays flagged on the stack
+    if (Cstack_Push(&machine->addressStack, machine->programCounter))
+        machine->programCounter = op->nnn;
 }
 
-inline void CHIPPY_Op_PopSubroutine()
+static inline void CHIPPY_Op_PopSubroutine(ChippyMachine* machine, const ChippyOp* op)
 {
-    g_ProgramCounter = Cstack_Pop(g_AddressStack);
+    // On underflow there's nowhere to return to, so carry on from the next instruction
+    Cstack_Pop(&machine->addressStack, &machine->programCounter);
 };
 
-void CHIPPY_LookUp_Op0(uint16_t instruction)
+static inline void CHIPPY_OpSet_VXVY(ChippyMachine* machine, const ChippyOp* op)
 {
-    // 0--- Op Codes don't require masking
-    switch (instruction)
-    {
-    case 0x00E0:
-        CHIPPY_Op_ClearScreen();
-        break;
-    case 0x00EE:
-        CHIPPY_Op_PopSubroutine();
-        break;
-    default: // 0NNN (machine language routine - SKIP)
-        break;
-    }
+    machine->variableRegisters[op->x] = machine->variableRegisters[op->y];
 };
 
-inline void CHIPPY_OpSet_VXVY(uint16_t instruction)
+static inline void CHIPPY_OpBitwiseOr_VXVY(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
 {
-    g_VariableRegisters[X(instruction)] = g_VariableRegisters[Y(instruction)];
+    machine->variableRegisters[op->x] |= machine->variableRegisters[op->y];
+    if (quirks & CHIPPY_QUIRK_VF_RESET)
+        machine->variableRegisters[0xF] = 0;
 };
 
-inline void CHIPPY_OpBitwiseOr_VXVY(uint16_t instruction)
+static inline void CHIPPY_OpBitwiseAnd_VXVY(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
 {
-    g_VariableRegisters[X(instruction)] |= g_VariableRegisters[Y(instruction)];
+    machine->variableRegisters[op->x] &= machine->variableRegisters[op->y];
+    if (quirks & CHIPPY_QUIRK_VF_RESET)
+        machine->variableRegisters[0xF] = 0;
 };
 
-inline void CHIPPY_OpBitwiseAnd_VXVY(uint16_t instruction)
+static inline void CHIPPY_OpBitwiseXOR_VXVY(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
 {
-    g_VariableRegisters[X(instruction)] &= g_VariableRegisters[Y(instruction)];
+    machine->variableRegisters[op->x] ^= machine->variableRegisters[op->y];
+    if (quirks & CHIPPY_QUIRK_VF_RESET)
+        machine->variableRegisters[0xF] = 0;
 };
 
-inline void CHIPPY_OpBitwiseXOR_VXVY(uint16_t instruction)
-{
-    g_VariableRegisters[X(instruction)] &= g_VariableRegisters[Y(instruction)];
-};
+// For the flag setting ops below, VF is written last so the flag wins when X is F
 
-void CHIPPY_OpCarryAdd_VXVY(uint16_t instruction)
+void CHIPPY_OpCarryAdd_VXVY(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint8_t xIdx = X(instruction);
-    const uint16_t result = g_VariableRegisters[xIdx] + g_VariableRegisters[Y(instruction)];
+    const uint8_t xIdx = op->x;
+    const uint16_t result = machine->variableRegisters[xIdx] + machine->variableRegisters[op->y];
     // If the result overflows, set the carry flag in VF to 1, else set 0
-    g_VariableRegisters[0xF] = (uint8_t)(result > 0xFF);
-    g_VariableRegisters[xIdx] = (uint8_t)result;
+    machine->variableRegisters[xIdx] = (uint8_t)result;
+    machine->variableRegisters[0xF] = (uint8_t)(result > 0xFF);
 };
 
-void CHIPPY_OpSubtract_VXVY(uint16_t instruction)
+void CHIPPY_OpSubtract_VXVY(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint8_t xIdx = X(instruction);
-    const uint8_t x = g_VariableRegisters[xIdx];
-    const uint8_t y = g_VariableRegisters[Y(instruction)];
+    const uint8_t xIdx = op->x;
+    const uint8_t x = machine->variableRegisters[xIdx];
+    const uint8_t y = machine->variableRegisters[op->y];
     const uint16_t result = x - y;
-    // If a > b, set the carry flag in VF to 1, else set 0
-    g_VariableRegisters[0xF] = (uint8_t)(x > y);
-    g_VariableRegisters[xIdx] = (uint8_t)result;
+    // If a >= b, set the carry flag in VF to 1, else set 0
+    machine->variableRegisters[xIdx] = (uint8_t)result;
+    machine->variableRegisters[0xF] = (uint8_t)(x >= y);
 };
 
-void CHIPPY_OpSubtract_VYVX(uint16_t instruction)
+void CHIPPY_OpSubtract_VYVX(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint8_t xIdx = X(instruction);
-    const uint8_t x = g_VariableRegisters[xIdx];
-    const uint8_t y = g_VariableRegisters[Y(instruction)];
+    const uint8_t xIdx = op->x;
+    const uint8_t x = machine->variableRegisters[xIdx];
+    const uint8_t y = machine->variableRegisters[op->y];
     const uint16_t result = y - x;
-    // If a > b, set the carry flag in VF to 1, else set 0
-    g_VariableRegisters[0xF] = (uint8_t)(y > x);
-    g_VariableRegisters[xIdx] = (uint8_t)result;
+    // If a >= b, set the carry flag in VF to 1, else set 0
+    machine->variableRegisters[xIdx] = (uint8_t)result;
+    machine->variableRegisters[0xF] = (uint8_t)(y >= x);
+};
+
+static inline void CHIPPY_OpShiftRight_VYVX(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
+{
+    const uint8_t vy = machine->variableRegisters[quirks & CHIPPY_QUIRK_SHIFT_VX ? op->x : op->y];
+    machine->variableRegisters[op->x] = vy >> 1;
+    // Set carry flag in VF to match the bit shifted out
+    machine->variableRegisters[0xF] = vy & 1;
+};
+
+static inline void CHIPPY_OpShiftLeft_VYVX(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
+{
+    const uint8_t vy = machine->variableRegisters[quirks & CHIPPY_QUIRK_SHIFT_VX ? op->x : op->y];
+    machine->variableRegisters[op->x] = vy << 1;
+    // Set carry flag in VF to match the bit shifted out
+    machine->variableRegisters[0xF] = vy >> 7;
+};
+
+static inline void CHIPPY_OpSkip_KeyVXDown(ChippyMachine* machine, const ChippyOp* op)
+{
+    machine->programCounter += 2 * GET_INPUT_FROM_HEX(machine->inputBitMap, machine->variableRegisters[op->x]);
+};
+
+static inline void CHIPPY_OpSkip_KeyVXUp(ChippyMachine* machine, const ChippyOp* op)
+{
+    machine->programCounter += 2 * !GET_INPUT_FROM_HEX(machine->inputBitMap, machine->variableRegisters[op->x]);
 };
 
-void CHIPPY_OpShiftRight_VYVX(uint16_t instruction)
+static inline void CHIPPY_OpTimer_CacheDelayVX(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint8_t xIdx = X(instruction);
-    g_VariableRegisters[xIdx] = g_VariableRegisters[Y(instruction)];
+    machine->variableRegisters[op->x] = CHIPPY_TimerLeft(machine->delayExpiry, machine->timerFrame);
+};
 
-    const uint8_t vx = g_VariableRegisters[xIdx];
-    // Set carry flag in VF to match LSB
-    g_VariableRegisters[0xF] = vx & 1;
-    g_VariableRegisters[xIdx] >>= 1;
+static inline void CHIPPY_OpTimer_SetDelayVX(ChippyMachine* machine, const ChippyOp* op)
+{
+    machine->delayExpiry = machine->timerFrame + machine->variableRegisters[op->x];
 };
 
-void CHIPPY_OpShiftLeft_VYVX(uint16_t instruction)
+static inline void CHIPPY_OpTimer_SetSoundVX(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint8_t xIdx = X(instruction);
-    g_VariableRegisters[xIdx] = g_VariableRegisters[Y(instruction)];
+    machine->soundExpiry = machine->timerFrame + machine->variableRegisters[op->x];
+};
 
-    const uint8_t vx = g_VariableRegisters[xIdx];
-    // Set carry flag in VF to match LSB
-    g_VariableRegisters[0xF] = vx & 1;
-    g_VariableRegisters[xIdx] <<= 1;
+static inline void CHIPPY_OpAdd_IdxReg(ChippyMachine* machine, const ChippyOp* op)
+{
+    machine->indexRegister += machine->variableRegisters[op->x];
 };
 
-void CHIPPY_LookUp_Op8(uint16_t instruction)
+void CHIPPY_OpInput_GetKey(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint16_t opCode = instruction & 0xF00F;
+    // This opcode blocks until a key is pressed, but as we already incremented the program counter in the Fetch step-
+    // we decrement it here first to cause a loop
+    machine->programCounter -= 2;
 
-    switch (opCode)
+    if (GET_ANY_INPUT_DOWN(machine->inputBitMap))
     {
-    case 0x8000:
-        CHIPPY_OpSet_VXVY(instruction);
-        break;
-    case 0x8001:
-        CHIPPY_OpBitwiseOr_VXVY(instruction);
-        break;
-    case 0x8002:
-        CHIPPY_OpBitwiseAnd_VXVY(instruction);
-        break;
-    case 0x8003:
-        CHIPPY_OpBitwiseXOR_VXVY(instruction);
-        break;
-    case 0x8004:
-        CHIPPY_OpCarryAdd_VXVY(instruction);
-        break;
-    case 0x8005:
-        CHIPPY_OpSubtract_VXVY(instruction);
-        break;
-    case 0x8007:
-        CHIPPY_OpSubtract_VYVX(instruction);
-        break;
-    case 0x8006:
-        CHIPPY_OpShiftRight_VYVX(instruction);
-        break;
-    case 0x800E:
-        CHIPPY_OpShiftLeft_VYVX(instruction);
-        break;
-    default:
-        break;
+        machine->programCounter += 2;
+        machine->variableRegisters[op->x] = g_InputScanTable[machine->lastInput];
     }
 };
 
-inline void CHIPPY_OpSkip_KeyVXDown(uint16_t instruction)
+void CHIPPY_OpFont_SetCharacter(ChippyMachine* machine, const ChippyOp* op)
 {
-    g_ProgramCounter += 2 * GET_INPUT_FROM_HEX(g_VariableRegisters[X(instruction)]);
+    // Point I at the sprite for the hex digit in VX
+    const uint8_t fontIndex = (machine->variableRegisters[op->x] & 0xF) * g_FontHeight;
+    machine->indexRegister = g_FontStartAddress + fontIndex;
 };
 
-inline void CHIPPY_OpSkip_KeyVXUp(uint16_t instruction)
+void CHIPPY_OpFont_VXToDecimal(ChippyMachine* machine, const ChippyOp* op)
 {
-    g_ProgramCounter += 2 * !GET_INPUT_FROM_HEX(g_VariableRegisters[X(instruction)]);
+    // Takes the number in vx and converts it to three decimal digits and stores them in the index register memory
+    const uint8_t input = machine->variableRegisters[op->x];
+    const uint16_t address = machine->indexRegister;
+
+    if (!CHIPPY_OwnMemory(machine, address, 3))
+        return;
+    *CHIPPY_WritableByte(machine, address) = input / 100;
+    *CHIPPY_WritableByte(machine, address + 1) = (input / 10) % 10;
+    *CHIPPY_WritableByte(machine, address + 2) = input % 10;
+    CHIPPY_InvalidateDecoded(machine, address, 3);
 };
 
-void CHIPPY_LookUp_OpE(uint16_t instruction)
+static inline void CHIPPY_OpMemory_Store(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
 {
-    const uint16_t opCode = instruction & 0xF0FF;
+    if (!CHIPPY_OwnMemory(machine, machine->indexRegister, op->x + 1))
+        return;
+    for (int i = 0; i <= op->x; ++i)
+    {
+        *CHIPPY_WritableByte(machine, machine->indexRegister + i) = machine->variableRegisters[i];
+    }
+    CHIPPY_InvalidateDecoded(machine, machine->indexRegister, op->x + 1);
+    if (quirks & CHIPPY_QUIRK_MEMORY_INDEX)
+        machine->indexRegister += op->x + 1;
+};
 
-    switch (opCode)
+static inline void CHIPPY_OpMemory_Load(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
+{
+    for (int i = 0; i <= op->x; ++i)
     {
-    case 0xE09E:
-        CHIPPY_OpSkip_KeyVXDown(instruction);
-        break;
-    case 0xE0A1:
-        CHIPPY_OpSkip_KeyVXUp(instruction);
-        break;
-    default:
-        break;
+        machine->variableRegisters[i] = CHIPPY_ReadByte(machine, machine->indexRegister + i);
     }
+    if (quirks & CHIPPY_QUIRK_MEMORY_INDEX)
+        machine->indexRegister += op->x + 1;
 };
 
-inline void CHIPPY_OpTimer_CacheDelayVX(uint16_t instruction)
+static inline void CHIPPY_OpJump_PC(ChippyMachine* machine, const ChippyOp* op)
 {
-    g_VariableRegisters[X(instruction)] = g_DelayTimer;
+    machine->programCounter = op->nnn;
 };
 
-inline void CHIPPY_OpTimer_SetDelayVX(uint16_t instruction)
+static inline void CHIPPY_OpJump_V0PC(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
 {
-    g_DelayTimer = g_VariableRegisters[X(instruction)];
+    machine->programCounter = op->nnn + machine->variableRegisters[quirks & CHIPPY_QUIRK_JUMP_VX ? op->x : 0];
 };
 
-inline void CHIPPY_OpTimer_SetSoundVX(uint16_t instruction)
+static inline void CHIPPY_OpIf_VXNN(ChippyMachine* machine, const ChippyOp* op)
 {
-    g_SoundTimer = g_VariableRegisters[X(instruction)];
+    // if VX == NN, PC += 2
+    machine->programCounter += (uint8_t)(machine->variableRegisters[op->x] == op->nn) * 2;
 };
 
-inline void CHIPPY_OpAdd_IdxReg(uint16_t instruction)
+static inline void CHIPPY_OpIfNot_VXNN(ChippyMachine* machine, const ChippyOp* op)
 {
-    g_IndexRegister += g_VariableRegisters[X(instruction)];
+    // if VX == NN, PC += 2
+    machine->programCounter += (uint8_t)(machine->variableRegisters[op->x] != op->nn) * 2;
 };
 
-void CHIPPY_OpInput_GetKey(uint16_t instruction)
+static inline void CHIPPY_OpIf_VXVY(ChippyMachine* machine, const ChippyOp* op)
 {
-    // This opcode blocks until a key is pressed, but as we already incremented the program counter in the Fetch step-
-    // we decrement it here first to cause a loop
-    g_ProgramCounter -= 2;
+    // if VX == VY, PC += 2
+    machine->programCounter += (uint8_t)(machine->variableRegisters[op->x] == machine->variableRegisters[op->y]) * 2;
+};
 
-    if (GET_ANY_INPUT_DOWN)
-    {
-        g_ProgramCounter += 2;
-        g_VariableRegisters[X(instruction)] = g_InputScanTable[g_LastInput];
-    }
+static inline void CHIPPY_OpIfNot_VXVY(ChippyMachine* machine, const ChippyOp* op)
+{
+    // if VX != VY, PC += 2
+    machine->programCounter += (uint8_t)(machine->variableRegisters[op->x] != machine->variableRegisters[op->y]) * 2;
 };
 
-void CHIPPY_OpFont_SetCharacter(uint16_t instruction)
+static inline void CHIPPY_OpSet_VX(ChippyMachine* machine, const ChippyOp* op)
 {
-    const uint8_t fontIndex = g_VariableRegisters[X(instruction)] * g_FontHeight;
-    g_IndexRegister = g_RomMemory[g_FontStartAddress + fontIndex];
+    machine->variableRegisters[op->x] = op->nn;
 };
 
-void CHIPPY_OpFont_VXToDecimal(uint16_t instruction)
+static inline void CHIPPY_OpAdd_VX(ChippyMachine* machine, const ChippyOp* op)
 {
-    // Takes the number in vx and converts it to three decimal digits and stores them in the index register memory
-    uint8_t input = g_VariableRegisters[X(instruction)];
-    uint8_t memoryIdx = g_IndexRegister;
+    machine->variableRegisters[op->x] += op->nn;
+};
 
-    while (input > 0)
-    {
-        g_RomMemory[memoryIdx] = input % 10;
+static inline void CHIPPY_OpSet_IdxReg(ChippyMachine* machine, const ChippyOp* op)
+{
+    machine->indexRegister = op->nnn;
+};
 
-        ++memoryIdx;
-        input *= 0.1;
-    }
+void CHIPPY_SeedRandom(ChippyMachine* machine, uint64_t seed)
+{
+    // splitmix64, so neighbouring seeds start far apart and the state is never the zero xorshift can't leave
+    uint64_t z = seed + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    machine->randomState = z ? z : 1;
+}
+
+static inline uint8_t CHIPPY_NextRandom(ChippyMachine* machine)
+{
+    uint64_t x = machine->randomState;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    machine->randomState = x;
+    // The top bits of the scrambled output are the best distributed
+    return (uint8_t)((x * 0x2545F4914F6CDD1Dull) >> 56);
+}
+
+static inline void CHIPPY_OpRand_VX(ChippyMachine* machine, const ChippyOp* op)
+{
+    machine->variableRegisters[op->x] = CHIPPY_NextRandom(machine) & op->nn;
 };
 
-void CHIPPY_OpMemory_Store(uint16_t instruction)
+static inline void CHIPPY_Op_DrawSprite(ChippyMachine* machine, const ChippyOp* op, uint8_t quirks)
 {
-    for (int i = 0; i <= X(instruction); ++i)
+    // The starting position always wraps, the sprite itself is clipped at the screen edges unless the quirk wraps it
+    const bool wrap = (quirks & CHIPPY_QUIRK_WRAP) != 0;
+    const uint8_t x = machine->variableRegisters[op->x] % CHIPPY_DISPLAY_WIDTH;
+    const uint8_t y = machine->variableRegisters[op->y] % CHIPPY_DISPLAY_HEIGHT;
+    const uint8_t numRows = wrap ? op->n : SDL_min(op->n, CHIPPY_DISPLAY_HEIGHT - y);
+
+    uint64_t collision = 0;
+    for (uint8_t row = 0; row < numRows; ++row)
     {
-        g_RomMemory[g_IndexRegister + i] = g_VariableRegisters[i];
+        // Line the sprite byte up with the MSB, then shift it across to x. Pixels past the right edge fall off the end,
+        // or come back round on the left when wrapping.
+        const uint8_t spriteByte = CHIPPY_ReadByte(machine, machine->indexRegister + row);
+        const uint64_t spriteBits = (uint64_t)spriteByte << (CHIPPY_DISPLAY_WIDTH - 8);
+        const uint64_t spriteRow = spriteBits >> x | (wrap && x ? spriteBits << (CHIPPY_DISPLAY_WIDTH - x) : 0);
+        const uint8_t rowY = (y + row) % CHIPPY_DISPLAY_HEIGHT;
+
+        // Any pixel on in both gets turned off, which is a collision
+        uint64_t* displayRow = &machine->displayPlane[rowY];
+        collision |= *displayRow & spriteRow;
+        *displayRow ^= spriteRow;
+        machine->dirtyRows |= (uint32_t)(spriteRow != 0) << rowY;
     }
+
+    machine->variableRegisters[0xF] = collision != 0;
+};
+
+/*
+X: The second nibble. Used to look up one of the 16 registers (VX) from V0 through VF. (always used to look up the values in registers)
+Y: The third nibble. Also used to look up one of the 16 registers (VY) from V0 through VF. (always used to look up the values in registers)
+N: The fourth nibble. A 4-bit number.
+NN: The second byte (third and fourth nibbles). An 8-bit immediate number.
+NNN: The second, third and fourth nibbles. A 12-bit immediate memory address.*/
+static inline void CHIPPY_Op_Nop(ChippyMachine* machine, const ChippyOp* op)
+{
 };
 
-void CHIPPY_OpMemory_Load(uint16_t instruction)
+// A handler taking the quirk flags, as specialized for the profile being built (see ChippyInterpreter.inl)
+#define CHIPPY_QUIRKED_PASTE(name, suffix) name##suffix
+#define CHIPPY_QUIRKED_EXPAND(name, suffix) CHIPPY_QUIRKED_PASTE(name, suffix)
+#define CHIPPY_QUIRKED(name) CHIPPY_QUIRKED_EXPAND(name, CHIPPY_QUIRKS_SUFFIX)
+
+// Every handler paired with its decoded id. Both the function pointer table and the threaded loop
+// are generated from this so they can't disagree.
+#define CHIPPY_OPERATIONS(OPERATION) \
+    OPERATION(CHIPPY_OP_NOP, CHIPPY_Op_Nop) \
+    OPERATION(CHIPPY_OP_CLEAR_SCREEN, CHIPPY_Op_ClearScreen) \
+    OPERATION(CHIPPY_OP_POP_SUBROUTINE, CHIPPY_Op_PopSubroutine) \
+    OPERATION(CHIPPY_OP_JUMP_PC, CHIPPY_OpJump_PC) \
+    OPERATION(CHIPPY_OP_PUSH_SUBROUTINE, CHIPPY_Op_PushSubroutine) \
+    OPERATION(CHIPPY_OP_IF_VXNN, CHIPPY_OpIf_VXNN) \
+    OPERATION(CHIPPY_OP_IFNOT_VXNN, CHIPPY_OpIfNot_VXNN) \
+    OPERATION(CHIPPY_OP_IF_VXVY, CHIPPY_OpIf_VXVY) \
+    OPERATION(CHIPPY_OP_SET_VX, CHIPPY_OpSet_VX) \
+    OPERATION(CHIPPY_OP_ADD_VX, CHIPPY_OpAdd_VX) \
+    OPERATION(CHIPPY_OP_SET_VXVY, CHIPPY_OpSet_VXVY) \
+    OPERATION(CHIPPY_OP_OR_VXVY, CHIPPY_QUIRKED(CHIPPY_OpBitwiseOr_VXVY)) \
+    OPERATION(CHIPPY_OP_AND_VXVY, CHIPPY_QUIRKED(CHIPPY_OpBitwiseAnd_VXVY)) \
+    OPERATION(CHIPPY_OP_XOR_VXVY, CHIPPY_QUIRKED(CHIPPY_OpBitwiseXOR_VXVY)) \
+    OPERATION(CHIPPY_OP_ADD_VXVY, CHIPPY_OpCarryAdd_VXVY) \
+    OPERATION(CHIPPY_OP_SUB_VXVY, CHIPPY_OpSubtract_VXVY) \
+    OPERATION(CHIPPY_OP_SHR_VYVX, CHIPPY_QUIRKED(CHIPPY_OpShiftRight_VYVX)) \
+    OPERATION(CHIPPY_OP_SUB_VYVX, CHIPPY_OpSubtract_VYVX) \
+    OPERATION(CHIPPY_OP_SHL_VYVX, CHIPPY_QUIRKED(CHIPPY_OpShiftLeft_VYVX)) \
+    OPERATION(CHIPPY_OP_IFNOT_VXVY, CHIPPY_OpIfNot_VXVY) \
+    OPERATION(CHIPPY_OP_SET_IDXREG, CHIPPY_OpSet_IdxReg) \
+    OPERATION(CHIPPY_OP_JUMP_V0PC, CHIPPY_QUIRKED(CHIPPY_OpJump_V0PC)) \
+    OPERATION(CHIPPY_OP_RAND_VX, CHIPPY_OpRand_VX) \
+    OPERATION(CHIPPY_OP_DRAW_SPRITE, CHIPPY_QUIRKED(CHIPPY_Op_DrawSprite)) \
+    OPERATION(CHIPPY_OP_SKIP_KEYDOWN, CHIPPY_OpSkip_KeyVXDown) \
+    OPERATION(CHIPPY_OP_SKIP_KEYUP, CHIPPY_OpSkip_KeyVXUp) \
+    OPERATION(CHIPPY_OP_GET_DELAY, CHIPPY_OpTimer_CacheDelayVX) \
+    OPERATION(CHIPPY_OP_GET_KEY, CHIPPY_OpInput_GetKey) \
+    OPERATION(CHIPPY_OP_SET_DELAY, CHIPPY_OpTimer_SetDelayVX) \
+    OPERATION(CHIPPY_OP_SET_SOUND, CHIPPY_OpTimer_SetSoundVX) \
+    OPERATION(CHIPPY_OP_ADD_IDXREG, CHIPPY_OpAdd_IdxReg) \
+    OPERATION(CHIPPY_OP_FONT_CHARACTER, CHIPPY_OpFont_SetCharacter) \
+    OPERATION(CHIPPY_OP_TO_DECIMAL, CHIPPY_OpFont_VXToDecimal) \
+    OPERATION(CHIPPY_OP_MEMORY_STORE, CHIPPY_QUIRKED(CHIPPY_OpMemory_Store)) \
+    OPERATION(CHIPPY_OP_MEMORY_LOAD, CHIPPY_QUIRKED(CHIPPY_OpMemory_Load))
+
+// The handlers above that behave differently per quirk profile
+#define CHIPPY_QUIRKED_OPERATIONS(QUIRKED) \
+    QUIRKED(CHIPPY_OpBitwiseOr_VXVY) \
+    QUIRKED(CHIPPY_OpBitwiseAnd_VXVY) \
+    QUIRKED(CHIPPY_OpBitwiseXOR_VXVY) \
+    QUIRKED(CHIPPY_OpShiftRight_VYVX) \
+    QUIRKED(CHIPPY_OpShiftLeft_VYVX) \
+    QUIRKED(CHIPPY_OpJump_V0PC) \
+    QUIRKED(CHIPPY_Op_DrawSprite) \
+    QUIRKED(CHIPPY_OpMemory_Store) \
+    QUIRKED(CHIPPY_OpMemory_Load)
+
+#if CHIPPY_PROFILE
+// Handler names for the profile dump, without the CHIPPY_OP_ prefix
+#define CHIPPY_OPERATION_NAME_ENTRY(handler, function) [handler] = #handler + sizeof("CHIPPY_OP_") - 1,
+static const char* const g_OperationNames[CHIPPY_OP_COUNT] =
 {
-    for (int i = 0; i <= X(instruction); ++i)
-    {
-        g_VariableRegisters[i] = g_RomMemory[g_IndexRegister + i];
-    }
+    CHIPPY_OPERATIONS(CHIPPY_OPERATION_NAME_ENTRY)
 };
+#undef CHIPPY_OPERATION_NAME_ENTRY
+#endif
 
-void CHIPPY_LookUp_OpF(uint16_t instruction)
+ChippyOp CHIPPY_Decode(uint16_t instruction)
 {
-    const uint16_t opCode = instruction & 0xF0FF;
+    ChippyOp op = { CHIPPY_OP_NOP, X(instruction), Y(instruction), N(instruction), NN(instruction), NNN(instruction) };
 
-    switch (opCode)
+    switch (OP(instruction))
     {
-    case 0xF007:
-        CHIPPY_OpTimer_CacheDelayVX(instruction);
-        break;
-    case 0xF015:
-        CHIPPY_OpTimer_SetDelayVX(instruction);
-        break;
-    case 0xF018:
-        CHIPPY_OpTimer_SetDelayVX(instruction);
+    case 0x0:
+        // 0--- Op Codes don't require masking
+        op.handler = instruction == 0x00E0 ? CHIPPY_OP_CLEAR_SCREEN :
+                     instruction == 0x00EE ? CHIPPY_OP_POP_SUBROUTINE : CHIPPY_OP_NOP;
         break;
-    case 0xF01E:
-        CHIPPY_OpAdd_IdxReg(instruction);
-        break;
-    case 0xF00A:
-        CHIPPY_OpInput_GetKey(instruction);
-        break;
-    case 0xF029:
-        CHIPPY_OpFont_SetCharacter(instruction);
-        break;
-    case 0xF033:
-        CHIPPY_OpFont_VXToDecimal(instruction);
-        break;
-    case 0xF055:
-        CHIPPY_OpMemory_Store(instruction);
+    case 0x1: op.handler = CHIPPY_OP_JUMP_PC; break;
+    case 0x2: op.handler = CHIPPY_OP_PUSH_SUBROUTINE; break;
+    case 0x3: op.handler = CHIPPY_OP_IF_VXNN; break;
+    case 0x4: op.handler = CHIPPY_OP_IFNOT_VXNN; break;
+    case 0x5: op.handler = CHIPPY_OP_IF_VXVY; break;
+    case 0x6: op.handler = CHIPPY_OP_SET_VX; break;
+    case 0x7: op.handler = CHIPPY_OP_ADD_VX; break;
+    case 0x8:
+        switch (N(instruction))
+        {
+        case 0x0: op.handler = CHIPPY_OP_SET_VXVY; break;
+        case 0x1: op.handler = CHIPPY_OP_OR_VXVY; break;
+        case 0x2: op.handler = CHIPPY_OP_AND_VXVY; break;
+        case 0x3: op.handler = CHIPPY_OP_XOR_VXVY; break;
+        case 0x4: op.handler = CHIPPY_OP_ADD_VXVY; break;
+        case 0x5: op.handler = CHIPPY_OP_SUB_VXVY; break;
+        case 0x6: op.handler = CHIPPY_OP_SHR_VYVX; break;
+        case 0x7: op.handler = CHIPPY_OP_SUB_VYVX; break;
+        case 0xE: op.handler = CHIPPY_OP_SHL_VYVX; break;
+        default: break;
+        }
         break;
-    case 0xF065:
-        CHIPPY_OpMemory_Load(instruction);
+    case 0x9: op.handler = CHIPPY_OP_IFNOT_VXVY; break;
+    case 0xA: op.handler = CHIPPY_OP_SET_IDXREG; break;
+    case 0xB: op.handler = CHIPPY_OP_JUMP_V0PC; break;
+    case 0xC: op.handler = CHIPPY_OP_RAND_VX; break;
+    case 0xD: op.handler = CHIPPY_OP_DRAW_SPRITE; break;
+    case 0xE:
+        switch (NN(instruction))
+        {
+        case 0x9E: op.handler = CHIPPY_OP_SKIP_KEYDOWN; break;
+        case 0xA1: op.handler = CHIPPY_OP_SKIP_KEYUP; break;
+        default: break;
+        }
         break;
-    default:
+    case 0xF:
+        switch (NN(instruction))
+        {
+        case 0x07: op.handler = CHIPPY_OP_GET_DELAY; break;
+        case 0x0A: op.handler = CHIPPY_OP_GET_KEY; break;
+        case 0x15: op.handler = CHIPPY_OP_SET_DELAY; break;
+        case 0x18: op.handler = CHIPPY_OP_SET_SOUND; break;
+        case 0x1E: op.handler = CHIPPY_OP_ADD_IDXREG; break;
+        case 0x29: op.handler = CHIPPY_OP_FONT_CHARACTER; break;
+        case 0x33: op.handler = CHIPPY_OP_TO_DECIMAL; break;
+        case 0x55: op.handler = CHIPPY_OP_MEMORY_STORE; break;
+        case 0x65: op.handler = CHIPPY_OP_MEMORY_LOAD; break;
+        default: break;
+        }
         break;
     }
-};
 
-inline void CHIPPY_OpJump_PC(uint16_t instruction)
-{
-    g_ProgramCounter = NNN(instruction);
+    return op;
 };
 
-inline void CHIPPY_OpJump_V0PC(uint16_t instruction)
+int CHIPPY_WriteMemory(ChippyMachine* machine, uint16_t address, const uint8_t* data, uint16_t length)
 {
-    g_ProgramCounter = NNN(instruction) + g_VariableRegisters[0];
-};
+    // Only re-decode what actually changed, writing what's mostly there already (the usual case) touches very little,
+    // and pages that aren't changed stay shared
+    while (length > 0)
+    {
+        const uint16_t span = SDL_min(length, CHIPPY_PAGE_SIZE - (address & CHIPPY_PAGE_MASK));
+        const uint8_t* memory = &machine->pages[address >> CHIPPY_PAGE_SHIFT]->memory[address & CHIPPY_PAGE_MASK];
+        uint16_t i = 0;
+        while (i < span)
+        {
+            if (i + 8 <= span && CHIPPY_Load64(data + i) == CHIPPY_Load64(memory + i))
+            {
+                i += 8;
+                continue;
+            }
+            if (data[i] == memory[i])
+            {
+                ++i;
+                continue;
+            }
+
+            const uint16_t start = i;
+            while (i < span && data[i] != memory[i])
+                ++i;
+            if (!CHIPPY_OwnMemory(machine, address + start, i - start))
+                return 1;
+            // Owning may have swapped the page for a copy
+            memory = &machine->pages[address >> CHIPPY_PAGE_SHIFT]->memory[address & CHIPPY_PAGE_MASK];
+            SDL_memcpy((uint8_t*)memory + start, data + start, i - start);
+            CHIPPY_InvalidateDecoded(machine, address + start, i - start);
+        }
 
-inline void CHIPPY_OpIf_VXNN(uint16_t instruction)
-{
-    // if VX == NN, PC += 2
-    g_ProgramCounter += (uint8_t)(g_VariableRegisters[X(instruction)] == NN(instruction)) * 2;
+        address += span;
+        data += span;
+        length -= span;
+    }
+    return 0;
 };
 
-inline void CHIPPY_OpIfNot_VXNN(uint16_t instruction)
+void CHIPPY_InvalidateDecoded(ChippyMachine* machine, uint16_t address, uint16_t length)
 {
-    // if VX == NN, PC += 2
-    g_ProgramCounter += (uint8_t)(g_VariableRegisters[X(instruction)] != NN(instruction)) * 2;
+    if (!CHIPPY_OwnMemory(machine, address, length))
+        return;
+
+    // An instruction starting one byte before the write also reads the first written byte
+    for (uint16_t i = 0; i <= length; ++i)
+    {
+        const uint16_t start = (address - 1 + i) & CHIPPY_ROM_MEM_MASK;
+        const uint16_t instruction = (uint16_t)CHIPPY_ReadByte(machine, start) << 8 | CHIPPY_ReadByte(machine, start + 1);
+        machine->pages[start >> CHIPPY_PAGE_SHIFT]->decoded[start & CHIPPY_PAGE_MASK] = CHIPPY_Decode(instruction);
+    }
+
+    if (machine->jit)
+        CHIPPY_JitInvalidate(machine->jit, address, length);
 };
 
-inline void CHIPPY_OpIf_VXVY(uint16_t instruction)
+/** Profiling **/
+#if CHIPPY_PROFILE
+static inline void CHIPPY_ProfileBegin(ChippyMachine* machine)
 {
-    // if VX == VY, PC += 2
-    g_ProgramCounter += (uint8_t)(g_VariableRegisters[X(instruction)] == g_VariableRegisters[Y(instruction)]) * 2;
+    machine->profile.lastTick = SDL_GetPerformanceCounter();
+    machine->profile.lastHandler = CHIPPY_OP_COUNT;
 };
 
-inline void CHIPPY_OpIfNot_VXVY(uint16_t instruction)
+// Charges the time since the last dispatch to the instruction that was running, then starts timing this one
+static inline void CHIPPY_ProfileOp(ChippyMachine* machine, const ChippyOp* op, uint16_t address)
 {
-    // if VX != VY, PC += 2
-    g_ProgramCounter += (uint8_t)(g_VariableRegisters[X(instruction)] != g_VariableRegisters[Y(instruction)]) * 2;
+    ChippyProfile* profile = &machine->profile;
+    const uint64_t now = SDL_GetPerformanceCounter();
+    if (profile->lastHandler < CHIPPY_OP_COUNT)
+        profile->handlerTicks[profile->lastHandler] += now - profile->lastTick;
+
+    profile->lastTick = now;
+    profile->lastHandler = op->handler;
+    ++profile->handlerCount[op->handler];
+    ++profile->addressCount[address & CHIPPY_ROM_MEM_MASK];
 };
 
-inline void CHIPPY_OpSet_VX(uint16_t instruction)
+static inline void CHIPPY_ProfileEnd(ChippyMachine* machine)
 {
-    g_VariableRegisters[X(instruction)] = NN(instruction);
+    ChippyProfile* profile = &machine->profile;
+    if (profile->lastHandler < CHIPPY_OP_COUNT)
+        profile->handlerTicks[profile->lastHandler] += SDL_GetPerformanceCounter() - profile->lastTick;
+    profile->lastHandler = CHIPPY_OP_COUNT;
 };
 
-inline void CHIPPY_OpAdd_VX(uint16_t instruction)
+#define CHIPPY_PROFILE_BEGIN(machine) CHIPPY_ProfileBegin(machine)
+#define CHIPPY_PROFILE_OP(machine, op, address) CHIPPY_ProfileOp(machine, op, address)
+#define CHIPPY_PROFILE_END(machine) CHIPPY_ProfileEnd(machine)
+#else
+#define CHIPPY_PROFILE_BEGIN(machine)
+#define CHIPPY_PROFILE_OP(machine, op, address)
+#define CHIPPY_PROFILE_END(machine)
+#endif
+
+/** Coverage **/
+#if CHIPPY_COVERAGE
+static inline void CHIPPY_CoverOp(ChippyMachine* machine, uint16_t address)
 {
-    g_VariableRegisters[X(instruction)] += NN(instruction);
+    if (!machine->coverage) return;
+
+    address &= CHIPPY_ROM_MEM_MASK;
+    uint8_t* count = &machine->coverage[((machine->coverageLast << 1) ^ address) & (CHIPPY_COVERAGE_MAP_SIZE - 1)];
+    *count += *count != UINT8_MAX;
+    machine->coverageLast = address;
 };
 
-inline void CHIPPY_OpSet_IdxReg(uint16_t instruction)
+#define CHIPPY_COVER_OP(machine, address) CHIPPY_CoverOp(machine, address)
+#else
+#define CHIPPY_COVER_OP(machine, address)
+#endif
+
+void CHIPPY_DumpProfile(const ChippyMachine* machine)
 {
-    g_IndexRegister = NNN(instruction);
+#if CHIPPY_PROFILE
+    const ChippyProfile* profile = &machine->profile;
+    uint64_t total = 0;
+    for (int i = 0; i < CHIPPY_OP_COUNT; ++i)
+        total += profile->handlerCount[i];
+    if (total == 0) return;
+
+    // Handlers, most executed first
+    uint8_t order[CHIPPY_OP_COUNT];
+    for (int i = 0; i < CHIPPY_OP_COUNT; ++i)
+    {
+        int j = i;
+        for (; j > 0 && profile->handlerCount[order[j - 1]] < profile->handlerCount[i]; --j)
+            order[j] = order[j - 1];
+        order[j] = (uint8_t)i;
+    }
+
+    const double nsPerTick = (double)SDL_NS_PER_SECOND / SDL_GetPerformanceFrequency();
+    SDL_Log("Profile of %" SDL_PRIu64 " instructions", total);
+    SDL_Log("  %-16s %14s %8s %10s", "handler", "count", "share", "ns/op");
+    for (int i = 0; i < CHIPPY_OP_COUNT && profile->handlerCount[order[i]] > 0; ++i)
+    {
+        const uint64_t count = profile->handlerCount[order[i]];
+        SDL_Log("  %-16s %14" SDL_PRIu64 " %7.2f%% %10.1f", g_OperationNames[order[i]], count,
+            100.0 * count / total, profile->handlerTicks[order[i]] * nsPerTick / count);
+    }
+
+    // Hottest addresses, kept sorted as they're found
+    uint16_t top[CHIPPY_PROFILE_TOP_ADDRESSES];
+    int topCount = 0;
+    for (int address = 0; address < CHIPPY_ROM_MEM_SIZE; ++address)
+    {
+        const uint64_t count = profile->addressCount[address];
+        if (count == 0 || (topCount == CHIPPY_PROFILE_TOP_ADDRESSES && count <= profile->addressCount[top[topCount - 1]]))
+            continue;
+
+        int j = SDL_min(topCount, CHIPPY_PROFILE_TOP_ADDRESSES - 1);
+        for (; j > 0 && profile->addressCount[top[j - 1]] < count; --j)
+            top[j] = top[j - 1];
+        top[j] = (uint16_t)address;
+        topCount = SDL_min(topCount + 1, CHIPPY_PROFILE_TOP_ADDRESSES);
+    }
+
+    SDL_Log("  %-5s %-4s %-16s %14s %8s", "addr", "op", "handler", "count", "share");
+    for (int i = 0; i < topCount; ++i)
+    {
+        const uint16_t address = top[i];
+        const uint16_t instruction = (uint16_t)CHIPPY_ReadByte(machine, address) << 8 | CHIPPY_ReadByte(machine, address + 1);
+        SDL_Log("  0x%03X %04X %-16s %14" SDL_PRIu64 " %7.2f%%", address, instruction, g_OperationNames[CHIPPY_DecodedOp(machine, address)->handler],
+            profile->addressCount[address], 100.0 * profile->addressCount[address] / total);
+    }
+#else
+    (void)machine;
+#endif
 };
 
-inline void CHIPPY_OpRand_VX(uint16_t instruction)
+// The page the program counter was last in, so the dispatch loops only go back through the page table when it moves
+// to another. Owning a page to write to it can swap it for a copy, so the memory ops reset it.
+typedef struct ChippyPageCursor
 {
-    g_VariableRegisters[X(instruction)] = rand() & NN(instruction);
-};
+    const ChippyOp* decoded;
+    uint16_t page; // CHIPPY_PAGE_COUNT when there isn't one
+} ChippyPageCursor;
 
-void CHIPPY_Op_DrawSprite(uint16_t instruction)
+static inline const ChippyOp* CHIPPY_CursorOp(ChippyPageCursor* cursor, const ChippyMachine* machine)
 {
-    const uint8_t x = g_VariableRegisters[X(instruction)] % CHIPPY_DISPLAY_WIDTH;
-    const uint8_t y = g_VariableRegisters[Y(instruction)] % CHIPPY_DISPLAY_HEIGHT;
-    uint8_t numPixelsH = N(instruction);
+    const uint16_t address = machine->programCounter & CHIPPY_ROM_MEM_MASK;
+    if ((address >> CHIPPY_PAGE_SHIFT) != cursor->page)
+    {
+        cursor->page = address >> CHIPPY_PAGE_SHIFT;
+        cursor->decoded = machine->pages[cursor->page]->decoded;
+    }
+    return &cursor->decoded[address & CHIPPY_PAGE_MASK];
+}
 
-    // Prevent drawing out of buffer range
-    numPixelsH = y + numPixelsH > CHIPPY_DISPLAY_HEIGHT - 1 ?
-        CHIPPY_DISPLAY_HEIGHT - y - 1 : numPixelsH;
-    uint8_t numPixelsW = x + 8 > CHIPPY_DISPLAY_WIDTH - 1 ?
-        CHIPPY_DISPLAY_WIDTH - x - 1 : 8;
+static inline bool CHIPPY_WritesMemory(uint8_t handler)
+{
+    return handler == CHIPPY_OP_TO_DECIMAL || handler == CHIPPY_OP_MEMORY_STORE;
+}
 
-    for (uint8_t row = 0; row < numPixelsH; ++row)
-    {
-        for (uint8_t col = 0; col < numPixelsW; ++col)
-        {
-            // get pixel from msb -> lsb 
-            const uint8_t spritePixelOn = !!(g_RomMemory[g_IndexRegister + row] & (0x80 >> col));
-            // get pixel to draw to from color buffer
-            uint32_t* bufferPixelPtr = &g_DisplayBuffer[y + row][x + col];
-            const uint8_t bufferPixelOn = CHIPPY_CheckColorPresent(bufferPixelPtr);
+// The dispatch loops for one quirk profile
+typedef struct ChippyInterpreter
+{
+    const CHIPPY_FPtr* operations; // Indexed by the handler picked out at decode time
+    void (*runCall)(ChippyMachine* machine, uint64_t cycles);
+    void (*runThreaded)(ChippyMachine* machine, uint64_t cycles);
+    void (*runJit)(ChippyMachine* machine, uint64_t cycles);
+} ChippyInterpreter;
 
-            // if sprite and pixel are on, negated 
-            const uint8_t bPixelNegation = (uint8_t)(spritePixelOn & bufferPixelOn);
+#define CHIPPY_QUIRKS_FLAGS CHIPPY_QUIRKS_VIP_FLAGS
+#define CHIPPY_QUIRKS_SUFFIX _Vip
+#include "ChippyInterpreter.inl"
 
-            g_VariableRegisters[0xF] = bPixelNegation;
+#define CHIPPY_QUIRKS_FLAGS CHIPPY_QUIRKS_SCHIP_FLAGS
+#define CHIPPY_QUIRKS_SUFFIX _Schip
+#include "ChippyInterpreter.inl"
 
-            CHIPPY_SetColorAt(bufferPixelPtr, &g_DisplayColors[bufferPixelOn ^ spritePixelOn]);
-        }
-    }
-};
+#define CHIPPY_QUIRKS_FLAGS CHIPPY_QUIRKS_XOCHIP_FLAGS
+#define CHIPPY_QUIRKS_SUFFIX _XoChip
+#include "ChippyInterpreter.inl"
 
-/*
-X: The second nibble. Used to look up one of the 16 registers (VX) from V0 through VF. (always used to look up the values in registers)
-Y: The third nibble. Also used to look up one of the 16 registers (VY) from V0 through VF. (always used to look up the values in registers)
-N: The fourth nibble. A 4-bit number.
-NN: The second byte (third and fourth nibbles). An 8-bit immediate number.
-NNN: The second, third and fourth nibbles. A 12-bit immediate memory address.*/
-CHIPPY_FPtr g_OperationMap[16] =
+static const ChippyInterpreter* const g_Interpreters[CHIPPY_QUIRKS_COUNT] =
 {
-    CHIPPY_LookUp_Op0,          // 0--- Multiple Instructions
-    CHIPPY_OpJump_PC,           // 1--- Jump PC to NNN
-    CHIPPY_Op_PushSubroutine,   // 2--- Subroutine
-    CHIPPY_OpIf_VXNN,           // 3--- if (vx == nn) skip
-    CHIPPY_OpIfNot_VXNN,        // 4--- if (vx != nn) skip
-    CHIPPY_OpIf_VXVY,           // 5--- if (vx == vy) skip
-    CHIPPY_OpSet_VX,            // 6--- Set VX to NN
-    CHIPPY_OpAdd_VX,            // 7--- Add NN to VX
-    CHIPPY_LookUp_Op8,          // 8--- Multiple Instructions
-    CHIPPY_OpIfNot_VXVY,        // 9--- if (vx != vy) skip
-    CHIPPY_OpSet_IdxReg,        // A--- Set Index Reg I to NNN
-    CHIPPY_OpJump_V0PC,         // B--- Jump PC to NNN + V0
-    CHIPPY_OpRand_VX,           // C--- Generate Random int into VX
-    CHIPPY_Op_DrawSprite,       // D--- Draw sprite at (VX, VY) by N*8
-    CHIPPY_LookUp_OpE,          // E--- Multiple Instructions
-    CHIPPY_LookUp_OpF           // F--- Multiple Instructions
+    [CHIPPY_QUIRKS_VIP] = &g_Interpreter_Vip,
+    [CHIPPY_QUIRKS_SCHIP] = &g_Interpreter_Schip,
+    [CHIPPY_QUIRKS_XOCHIP] = &g_Interpreter_XoChip,
 };
 
-
-inline void CHIPPY_Execute(uint16_t instruction)
+void CHIPPY_Execute(ChippyMachine* machine, uint16_t instruction)
 {
-    (*g_OperationMap[OP(instruction)])(instruction);
+    const ChippyOp op = CHIPPY_Decode(instruction);
+    // Fetch has already moved the program counter past it
+    CHIPPY_PROFILE_BEGIN(machine);
+    CHIPPY_PROFILE_OP(machine, &op, machine->programCounter - 2);
+    CHIPPY_COVER_OP(machine, machine->programCounter - 2);
+    (*g_Interpreters[machine->quirks]->operations[op.handler])(machine, &op);
+    CHIPPY_PROFILE_END(machine);
 };
 
-uint32_t* CHIPPY_GetDisplayBuffer()
+static inline void CHIPPY_RunBatch(ChippyMachine* machine, uint64_t cycles)
 {
-    return &g_DisplayBuffer[0][0];
+    const ChippyInterpreter* interpreter = g_Interpreters[machine->quirks];
+    CHIPPY_PROFILE_BEGIN(machine);
+    switch (machine->dispatch)
+    {
+    case CHIPPY_DISPATCH_JIT:
+        interpreter->runJit(machine, cycles);
+        break;
+    case CHIPPY_DISPATCH_THREADED:
+        interpreter->runThreaded(machine, cycles);
+        break;
+    case CHIPPY_DISPATCH_CALL:
+    default:
+        interpreter->runCall(machine, cycles);
+        break;
+    }
+    CHIPPY_PROFILE_END(machine);
 };
 
 SDL_Texture* CHIPPY_GetDisplayTexture()
@@ -619,34 +1353,232 @@ SDL_Texture* CHIPPY_GetDisplayTexture()
     return g_DisplayTexture;
 };
 
-void CHIPPY_Update()
+void CHIPPY_Update(ChippyMachine* machine)
 {
-    if (g_GamePaused) return;
+    if (machine->paused) return;
 
     // Using Fixed Timestep
-    g_CycleTimer += SECONDS(g_DeltaTime);
-    g_GameTimer += SECONDS(g_DeltaTime);
+    machine->cycleTimer += SECONDS(g_DeltaTime);
 
-    // Timers need to be decremented by 1 every second
-    const uint8_t timerDecrement = (uint8_t)(floor(g_GameTimer));
+    // Ensure no missed instructions. Timers and input follow the instruction count rather than the host's clock,
+    // so a recorded session plays back exactly the same headless.
+    const uint64_t cyclesToRun = (uint64_t)(machine->cycleTimer / CHIPPY_SEC_PER_CYCLE);
+    CHIPPY_RunCycles(machine, cyclesToRun, NULL);
 
-    g_DelayTimer = g_DelayTimer > 0 ? g_DelayTimer - timerDecrement : g_DelayTimer;
-    g_SoundTimer = g_SoundTimer > 0 ? g_SoundTimer - timerDecrement : g_SoundTimer;
-    g_GameTimer -= timerDecrement;
+    // Only subtract time used, to ensure no lost time between updates.
+    machine->cycleTimer -= cyclesToRun * CHIPPY_SEC_PER_CYCLE;
+};
 
-    // Ensure no missed instructions
-    const int cyclesToRun = (int)(g_CycleTimer / CHIPPY_SEC_PER_CYCLE);
-    for (int i = 0; i < cyclesToRun; ++i)
+// Hands the rom the host's input as the emulated frame starts, or the movie's when one is playing
+void CHIPPY_LatchInput(ChippyMachine* machine, uint64_t frame)
+{
+    if (!machine->movie)
     {
-        const uint16_t instruction = CHIPPY_Fetch();
-        CHIPPY_Execute(instruction);
+        machine->inputBitMap = machine->pendingInputBitMap;
+        machine->lastInput = machine->pendingLastInput;
+        return;
     }
 
-    // Only subtract time used, to ensure no lost time between updates.
-    g_CycleTimer -= cyclesToRun * CHIPPY_SEC_PER_CYCLE;
+    const ChippyFrameInput input = CHIPPY_MovieFrame(machine->movie, frame, CHIPPY_PackInput(machine->pendingInputBitMap, machine->pendingLastInput));
+    CHIPPY_UnpackInput(input, &machine->inputBitMap, &machine->lastInput);
+}
+
+uint64_t CHIPPY_FrameStartCycle(uint64_t frame)
+{
+    const uint64_t cyclesPerSec = (uint64_t)CHIPPY_CYCLES_PER_SEC;
+    return (frame * cyclesPerSec + CHIPPY_TIMER_HZ - 1) / CHIPPY_TIMER_HZ;
+}
+
+uint64_t CHIPPY_CycleFrame(uint64_t cycle)
+{
+    return cycle * CHIPPY_TIMER_HZ / (uint64_t)CHIPPY_CYCLES_PER_SEC;
+}
+
+uint8_t CHIPPY_GetDelayTimer(const ChippyMachine* machine)
+{
+    return CHIPPY_TimerLeft(machine->delayExpiry, CHIPPY_CycleFrame(machine->cycles));
+}
+
+uint8_t CHIPPY_GetSoundTimer(const ChippyMachine* machine)
+{
+    return CHIPPY_TimerLeft(machine->soundExpiry, CHIPPY_CycleFrame(machine->cycles));
+}
+
+void CHIPPY_SetTimers(ChippyMachine* machine, uint8_t delay, uint8_t sound)
+{
+    const uint64_t frame = CHIPPY_CycleFrame(machine->cycles);
+    machine->delayExpiry = frame + delay;
+    machine->soundExpiry = frame + sound;
+}
+
+#if CHIPPY_IDLE_SKIP
+
+// FX07, then 3XNN or 4XNN testing what it read, then a jump back to the FX07. Looked for with the program counter at
+// any of the three, returns the FX07's address or CHIPPY_ROM_MEM_SIZE if it isn't one.
+static uint16_t CHIPPY_FindDelayPoll(const ChippyMachine* machine)
+{
+    for (uint16_t back = 0; back < 6; back += 2)
+    {
+        const uint16_t start = (machine->programCounter - back) & CHIPPY_ROM_MEM_MASK;
+        const ChippyOp* read = CHIPPY_DecodedOp(machine, start);
+        const ChippyOp* test = CHIPPY_DecodedOp(machine, start + 2);
+        const ChippyOp* jump = CHIPPY_DecodedOp(machine, start + 4);
+        if (read->handler == CHIPPY_OP_GET_DELAY && (test->handler == CHIPPY_OP_IF_VXNN || test->handler == CHIPPY_OP_IFNOT_VXNN) &&
+            test->x == read->x && jump->handler == CHIPPY_OP_JUMP_PC && jump->nnn == start)
+            return start;
+    }
+    return CHIPPY_ROM_MEM_SIZE;
+}
+
+// Whether a polling loop's test lets it go round again with this value read from the delay timer
+static inline bool CHIPPY_PollContinues(const ChippyOp* test, uint8_t value)
+{
+    return test->handler == CHIPPY_OP_IF_VXNN ? value != test->nn : value == test->nn;
+}
+
+// The first frame from tick on that a polling loop can see a delay timer value that ends it, UINT64_MAX if it never
+// will. The timer only counts down, a frame at a time, until it reaches 0.
+static uint64_t CHIPPY_PollLeaveFrame(const ChippyOp* test, uint8_t delay, uint64_t tick)
+{
+    if (!CHIPPY_PollContinues(test, delay))
+        return tick;
+    if (test->handler == CHIPPY_OP_IF_VXNN)
+        return delay > test->nn ? tick + (delay - test->nn) : UINT64_MAX;
+    return test->nn == 0 ? UINT64_MAX : tick + 1;
+}
+
+// Skips over an idle loop the machine is sitting in, up to the frame it can next leave the loop in, without running
+// it. Each of them goes round the same way until the delay timer or input changes, which only happens as frames
+// start, so where it leaves the machine after any number of instructions can be worked out directly. Returns how
+// many instructions were skipped, 0 unless the loop carries on past the end of the current frame.
+static uint64_t CHIPPY_SkipIdle(ChippyMachine* machine, uint64_t tick, uint64_t remaining)
+{
+    const uint16_t pc = machine->programCounter & CHIPPY_ROM_MEM_MASK;
+    const ChippyOp* op = CHIPPY_DecodedOp(machine, pc);
+    uint64_t leaveFrame = UINT64_MAX;
+    uint16_t pollStart = CHIPPY_ROM_MEM_SIZE;
+    const bool waitsOnKey = op->handler == CHIPPY_OP_GET_KEY;
+
+    if (waitsOnKey)
+    {
+        // Without a movie, the rest of the run sees whatever the host is holding now
+        if (GET_ANY_INPUT_DOWN(machine->inputBitMap))
+            return 0;
+        if (!machine->movie && GET_ANY_INPUT_DOWN(machine->pendingInputBitMap))
+            leaveFrame = tick + 1;
+    }
+    else if (op->handler != CHIPPY_OP_JUMP_PC || op->nnn != machine->programCounter)
+    {
+        pollStart = CHIPPY_FindDelayPoll(machine);
+        if (pollStart == CHIPPY_ROM_MEM_SIZE)
+            return 0;
+
+        // Sitting on the test, it checks the value read last time round first
+        const ChippyOp* test = CHIPPY_DecodedOp(machine, pollStart + 2);
+        if (((pc - pollStart) & CHIPPY_ROM_MEM_MASK) == 2 && !CHIPPY_PollContinues(test, machine->variableRegisters[test->x]))
+            return 0;
+        leaveFrame = CHIPPY_PollLeaveFrame(test, CHIPPY_TimerLeft(machine->delayExpiry, tick), tick);
+    }
+
+    uint64_t end = machine->cycles + remaining;
+    if (leaveFrame != UINT64_MAX)
+        end = SDL_min(end, CHIPPY_FrameStartCycle(leaveFrame));
+    if (end <= CHIPPY_FrameStartCycle(tick + 1))
+        return 0;
+
+    // A movie has to see every frame go by, and can press a key partway through
+    if (machine->movie)
+    {
+        const uint64_t lastFrame = CHIPPY_CycleFrame(end - 1);
+        for (uint64_t frame = tick + 1; frame <= lastFrame; ++frame)
+        {
+            CHIPPY_LatchInput(machine, frame);
+            if (waitsOnKey && GET_ANY_INPUT_DOWN(machine->inputBitMap))
+            {
+                end = CHIPPY_FrameStartCycle(frame);
+                break;
+            }
+        }
+    }
+
+    const uint64_t skipped = end - machine->cycles;
+    uint16_t last = pc; // The last instruction skipped
+    if (pollStart != CHIPPY_ROM_MEM_SIZE)
+    {
+        // The jump back leaves the program counter at the FX07, and it counts up from there
+        const uint64_t position = ((pc - pollStart) & CHIPPY_ROM_MEM_MASK) / 2;
+        machine->programCounter = pollStart + 2 * (uint16_t)((position + skipped) % 3);
+        last = (pollStart + 2 * (uint16_t)((position + skipped - 1) % 3)) & CHIPPY_ROM_MEM_MASK;
+
+        // The register holds the timer from the last time round that read it, if any did
+        const uint64_t firstRead = (3 - position) % 3;
+        if (skipped > firstRead)
+        {
+            const uint64_t lastRead = machine->cycles + firstRead + (skipped - 1 - firstRead) / 3 * 3;
+            const ChippyOp* read = CHIPPY_DecodedOp(machine, pollStart);
+            machine->variableRegisters[read->x] = CHIPPY_TimerLeft(machine->delayExpiry, CHIPPY_CycleFrame(lastRead));
+        }
+    }
+
+#if CHIPPY_COVERAGE
+    // Every edge in the loop was counted the first time round
+    if (machine->coverage)
+        machine->coverageLast = last;
+#else
+    (void)last;
+#endif
+    return skipped;
+}
+#endif
+
+uint64_t CHIPPY_RunCycles(ChippyMachine* machine, uint64_t cycles, ChippyRunStats* stats)
+{
+    const uint64_t cyclesPerSec = (uint64_t)CHIPPY_CYCLES_PER_SEC;
+    // Only timed when asked, short runs (a frame at a time, or the fuzzer's) would spend a good part of it here
+    const uint64_t startTime = stats ? SDL_GetTicksNS() : 0;
+    uint64_t idleCycles = 0;
+
+    uint64_t remaining = cycles;
+    while (remaining > 0)
+    {
+        // Run up to the next 60Hz frame boundary in emulated time, so the timers and input stay
+        // in step with the instruction count regardless of how fast the host is
+        const uint64_t tick = machine->cycles * CHIPPY_TIMER_HZ / cyclesPerSec;
+        const uint64_t nextTickCycle = CHIPPY_FrameStartCycle(tick + 1);
+        uint64_t batch = 0;
+        machine->timerFrame = tick;
+
+#if CHIPPY_IDLE_SKIP
+        // Anything waiting on the timer or a key can skip whole frames at a time
+        batch = CHIPPY_SkipIdle(machine, tick, remaining);
+        idleCycles += batch;
+#endif
+        if (batch == 0)
+        {
+            batch = SDL_min(remaining, nextTickCycle - machine->cycles);
+            CHIPPY_RunBatch(machine, batch);
+        }
+
+        machine->cycles += batch;
+        remaining -= batch;
+        // The timers count themselves down, see CHIPPY_TimerLeft
+        const uint64_t ticks = machine->cycles * CHIPPY_TIMER_HZ / cyclesPerSec - tick;
+        if (ticks)
+            CHIPPY_LatchInput(machine, tick + ticks);
+    }
+
+    if (stats)
+    {
+        stats->cycles = cycles;
+        stats->idleCycles = idleCycles;
+        stats->elapsedNS = SDL_GetTicksNS() - startTime;
+        stats->cyclesPerSec = stats->elapsedNS ? (double)cycles * SDL_NS_PER_SECOND / stats->elapsedNS : 0.0;
+    }
+
+    return cycles;
 };
 
-SDL_AppResult CHIPPY_InputEvent(SDL_Scancode key_code, int IsDown)
+SDL_AppResult CHIPPY_InputEvent(ChippyMachine* machine, SDL_Scancode key_code, int IsDown)
 {
     // Program Input
     switch (key_code)
@@ -660,8 +1592,8 @@ SDL_AppResult CHIPPY_InputEvent(SDL_Scancode key_code, int IsDown)
     // Game Input
     if (IS_VALID_INPUT(key_code))
     {
-        g_LastInput = IsDown ? key_code : 0;
-        SET_INPUT(key_code, IsDown);
+        machine->pendingLastInput = IsDown ? key_code : 0;
+        SET_INPUT(machine->pendingInputBitMap, key_code, IsDown);
     }
 
     return SDL_APP_CONTINUE;
@@ -689,28 +1621,35 @@ void CHIPPY_WelcomeMsg(SDL_Renderer* renderer)
     SDL_RenderPresent(renderer);
 };
 
-void CHIPPY_Shutdown()
+void CHIPPY_Shutdown(ChippyMachine* machine)
 {
-    Cstack_Clean(g_AddressStack);
-    free(g_AddressStack);
-    free(g_RomMemory);
+    if (machine)
+        CHIPPY_DumpProfile(machine);
+    CHIPPY_DestroyMachine(machine);
     SDL_DestroyTexture(g_DisplayTexture);
+    g_DisplayTexture = NULL;
 };
 
-SDL_AppResult CHIPPY_Init(SDL_Renderer* renderer) {
-    g_CurrentTime = SDL_GetTicks();
-    srand(time(NULL));
+SDL_AppResult CHIPPY_InitHeadless(ChippyMachine** machine, const char* romPath) {
+    g_CurrentTime = SDL_GetTicksNS();
 
-    CHIPPY_InitVariableRegister();
-    CHIPPY_ClearDisplayBuffer();
+    *machine = CHIPPY_CreateMachine();
+    if (!*machine)
+        return SDL_APP_FAILURE;
+    CHIPPY_SeedRandom(*machine, (uint64_t)time(NULL));
 
-    g_AddressStack = Cstack_Init();
+    if (CHIPPY_LoadRom(*machine, romPath ? romPath : CHIPPY_ROM_PATH) != 0)
+        return SDL_APP_FAILURE;
 
-    g_DisplayTexture = SDL_CreateTexture(renderer, CHIPPY_DISPLAY_FORMAT, CHIPPY_DISPLAY_TEXTURE_FLAGS, CHIPPY_DISPLAY_WIDTH, CHIPPY_DISPLAY_HEIGHT);
-    SDL_SetTextureScaleMode(g_DisplayTexture, CHIPPY_DISPLAY_SCALE_MODE);
+    return SDL_APP_CONTINUE;
+}
 
-    if (CHIPPY_LoadRom() != 0)
+SDL_AppResult CHIPPY_Init(ChippyMachine** machine, SDL_Renderer* renderer, const char* romPath) {
+    if (CHIPPY_InitHeadless(machine, romPath) != SDL_APP_CONTINUE)
         return SDL_APP_FAILURE;
 
+    g_DisplayTexture = SDL_CreateTexture(renderer, CHIPPY_DISPLAY_FORMAT, CHIPPY_DISPLAY_TEXTURE_FLAGS, CHIPPY_DISPLAY_WIDTH, CHIPPY_DISPLAY_HEIGHT);
+    SDL_SetTextureScaleMode(g_DisplayTexture, CHIPPY_DISPLAY_SCALE_MODE);
+
     return SDL_APP_CONTINUE;
-}
\ No newline at end of file
+}
@@ -11,16 +11,18 @@
 
 // Tests primarily taken from
 // https://github.com/Timendus/chip8-test-suite?tab=readme-ov-file
-#define CHIPPY_ROM_PATH "roms\\5-quirks.ch8"
+#define CHIPPY_ROM_PATH "roms/5-quirks.ch8" // Used when no rom is given on the command line
+#define CHIPPY_ROM_GLOB "*.ch8"              // What a directory of roms is searched for
 
 // Display 
 #define CHIPPY_DISPLAY_WIDTH 64
 #define CHIPPY_DISPLAY_HEIGHT 32
 
-// Wanted to use 1bit formats for this but SDL3 doesn't support it with textures
-// Could do it with surfaces but it converts to 32 bit format when you make textures from surfaces anyway,
-// so there's not much point.
+// The machine keeps the display as a 1bit plane, one uint64_t per row with x = 0 in the MSB.
+// SDL3 doesn't support 1bit formats for textures, so it's only expanded to 32 bit when presenting.
 #define CHIPPY_DISPLAY_FORMAT SDL_PIXELFORMAT_ABGR32
+#define CHIPPY_DISPLAY_ROW_BIT(x) (0x8000000000000000ull >> (x))
+#define CHIPPY_DISPLAY_ALL_ROWS 0xFFFFFFFFu // One dirty bit per row, bit y set means row y changed
 
 #define CHIPPY_DISPLAY_TEXTURE_FLAGS SDL_TEXTUREACCESS_STREAMING
 #define CHIPPY_DISPLAY_SCALE_MODE SDL_SCALEMODE_NEAREST
@@ -33,8 +35,14 @@ extern const SDL_Color g_DisplayColors[2];
 #define CHIPPY_FIXED_STEP (1.0 / 60.0)
 #define CHIPPY_START_SCREEN_DELAY 2.0
 
-#define SECONDS(t) ((double)(t) * 0.001)
-#define MILLISECONDS(t) (uint64_t)(t * 1000.0)
+// Frame pacing sleeps through most of the wait and only spins for this last stretch, as sleeps can overshoot
+#define CHIPPY_FRAME_SPIN_NS (SDL_NS_PER_MS / 2)
+// Pace frames off the display's vsync instead of sleeping
+#define CHIPPY_VSYNC_ARG "--vsync"
+
+// App times are in nanoseconds
+#define SECONDS(t) ((double)(t) / SDL_NS_PER_SECOND)
+#define NANOSECONDS(t) (uint64_t)((t) * SDL_NS_PER_SECOND)
 
 extern double g_TimeStep;
 extern uint64_t g_DeltaTime;
@@ -42,12 +50,24 @@ extern uint64_t g_CurrentTime;
 
 // Rom Memory
 #define CHIPPY_ROM_MEM_SIZE 4096
+#define CHIPPY_ROM_MEM_MASK (CHIPPY_ROM_MEM_SIZE - 1) // Addresses wrap within the 4K
 #define CHIPPY_STARTING_PROGRAM_COUNTER 0x200
+#define CHIPPY_ROM_MAX_SIZE (CHIPPY_ROM_MEM_SIZE - CHIPPY_STARTING_PROGRAM_COUNTER)
 
 // Rom Instructions
 #define CHIPPY_CYCLES_PER_SEC 700.0 // Instruction Limit
 #define CHIPPY_SEC_PER_CYCLE (1.0 / CHIPPY_CYCLES_PER_SEC)
 
+// Rom Timers
+#define CHIPPY_TIMER_HZ 60 // Delay and sound timers count down at 60Hz, and input is latched at the same rate
+
+// Seed for machines that are never given one, CHIPPY_Init and CHIPPY_InitHeadless seed from the clock
+#define CHIPPY_DEFAULT_SEED 1
+
+// Headless
+#define CHIPPY_HEADLESS_ARG "--headless"
+#define CHIPPY_HEADLESS_DEFAULT_CYCLES 10000000ull
+
 #define NNN(x) (x & 0x0FFF)
 #define NN(x) (x & 0x00FF)
 #define N(x) (x & 0x000F)
@@ -56,7 +76,256 @@ extern uint64_t g_CurrentTime;
 
 #define OP(x) ((x & 0xF000) >> 12)
 
-typedef void (*CHIPPY_FPtr)(uint16_t);
+// Rom Decoded Instructions
+// Every instruction maps to exactly one handler, the 0/8/E/F families are resolved when decoding
+typedef enum ChippyOpHandler
+{
+    CHIPPY_OP_NOP,              // 0NNN machine language routine, and anything unrecognised
+    CHIPPY_OP_CLEAR_SCREEN,     // 00E0
+    CHIPPY_OP_POP_SUBROUTINE,   // 00EE
+    CHIPPY_OP_JUMP_PC,          // 1NNN
+    CHIPPY_OP_PUSH_SUBROUTINE,  // 2NNN
+    CHIPPY_OP_IF_VXNN,          // 3XNN
+    CHIPPY_OP_IFNOT_VXNN,       // 4XNN
+    CHIPPY_OP_IF_VXVY,          // 5XY0
+    CHIPPY_OP_SET_VX,           // 6XNN
+    CHIPPY_OP_ADD_VX,           // 7XNN
+    CHIPPY_OP_SET_VXVY,         // 8XY0
+    CHIPPY_OP_OR_VXVY,          // 8XY1
+    CHIPPY_OP_AND_VXVY,         // 8XY2
+    CHIPPY_OP_XOR_VXVY,         // 8XY3
+    CHIPPY_OP_ADD_VXVY,         // 8XY4
+    CHIPPY_OP_SUB_VXVY,         // 8XY5
+    CHIPPY_OP_SHR_VYVX,         // 8XY6
+    CHIPPY_OP_SUB_VYVX,         // 8XY7
+    CHIPPY_OP_SHL_VYVX,         // 8XYE
+    CHIPPY_OP_IFNOT_VXVY,       // 9XY0
+    CHIPPY_OP_SET_IDXREG,       // ANNN
+    CHIPPY_OP_JUMP_V0PC,        // BNNN
+    CHIPPY_OP_RAND_VX,          // CXNN
+    CHIPPY_OP_DRAW_SPRITE,      // DXYN
+    CHIPPY_OP_SKIP_KEYDOWN,     // EX9E
+    CHIPPY_OP_SKIP_KEYUP,       // EXA1
+    CHIPPY_OP_GET_DELAY,        // FX07
+    CHIPPY_OP_GET_KEY,          // FX0A
+    CHIPPY_OP_SET_DELAY,        // FX15
+    CHIPPY_OP_SET_SOUND,        // FX18
+    CHIPPY_OP_ADD_IDXREG,       // FX1E
+    CHIPPY_OP_FONT_CHARACTER,   // FX29
+    CHIPPY_OP_TO_DECIMAL,       // FX33
+    CHIPPY_OP_MEMORY_STORE,     // FX55
+    CHIPPY_OP_MEMORY_LOAD,      // FX65
+    CHIPPY_OP_COUNT
+} ChippyOpHandler;
+
+// Rom Dispatch
+// How the decoded instructions get executed. All of them are always built so they can be compared,
+// the build picks which one new machines start with.
+typedef enum ChippyDispatch
+{
+    CHIPPY_DISPATCH_CALL,     // Indirect call through a table of handler functions per instruction
+    CHIPPY_DISPATCH_THREADED, // Handlers expanded inline in one loop, jumping directly from one to the next
+    CHIPPY_DISPATCH_JIT,      // Basic blocks recompiled to native code, see ChippyJit.h
+    CHIPPY_DISPATCH_COUNT
+} ChippyDispatch;
+
+#ifndef CHIPPY_DISPATCH_DEFAULT
+#define CHIPPY_DISPATCH_DEFAULT CHIPPY_DISPATCH_THREADED
+#endif
+
+// Rom Quirks
+// Behaviour that differs between the platforms CHIP-8 roms were written for. Each profile is a fixed set of quirk
+// flags, and the interpreter is built once per profile with its flags compiled in, so nothing is checked per
+// instruction. Picked per machine, a rom's extension picks one when it's loaded (see CHIPPY_QuirksForRom).
+#define CHIPPY_QUIRK_VF_RESET     0x01 // 8XY1, 8XY2 and 8XY3 clear VF
+#define CHIPPY_QUIRK_MEMORY_INDEX 0x02 // FX55 and FX65 leave I just past the last register, rather than where it was
+#define CHIPPY_QUIRK_SHIFT_VX     0x04 // 8XY6 and 8XYE shift VX in place, rather than VY into VX
+#define CHIPPY_QUIRK_JUMP_VX      0x08 // BXNN jumps to XNN + VX, rather than NNN + V0
+#define CHIPPY_QUIRK_WRAP         0x10 // Sprites wrap around the screen edges, rather than being clipped
+
+#define CHIPPY_QUIRKS_VIP_FLAGS (CHIPPY_QUIRK_VF_RESET | CHIPPY_QUIRK_MEMORY_INDEX)
+#define CHIPPY_QUIRKS_SCHIP_FLAGS (CHIPPY_QUIRK_SHIFT_VX | CHIPPY_QUIRK_JUMP_VX)
+#define CHIPPY_QUIRKS_XOCHIP_FLAGS (CHIPPY_QUIRK_MEMORY_INDEX | CHIPPY_QUIRK_WRAP)
+
+typedef enum ChippyQuirks
+{
+    CHIPPY_QUIRKS_VIP,    // The original COSMAC VIP interpreter
+    CHIPPY_QUIRKS_SCHIP,  // SUPER-CHIP 1.1 on the HP48
+    CHIPPY_QUIRKS_XOCHIP, // XO-CHIP, as Octo runs it
+    CHIPPY_QUIRKS_COUNT
+} ChippyQuirks;
+
+#ifndef CHIPPY_QUIRKS_DEFAULT
+#define CHIPPY_QUIRKS_DEFAULT CHIPPY_QUIRKS_VIP
+#endif
+#define CHIPPY_QUIRKS_ARG "--quirks" // Followed by one of g_QuirkNames, for every rom given
+
+extern const uint8_t g_QuirkFlags[CHIPPY_QUIRKS_COUNT];
+extern const char* const g_QuirkNames[CHIPPY_QUIRKS_COUNT]; // "vip", "schip" and "xochip"
+
+// Labels as values (computed goto) for the threaded dispatcher, define CHIPPY_NO_COMPUTED_GOTO to force the portable switch
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(CHIPPY_NO_COMPUTED_GOTO)
+#define CHIPPY_HAS_COMPUTED_GOTO 1
+#else
+#define CHIPPY_HAS_COMPUTED_GOTO 0
+#endif
+
+// Profiling
+// Build with -DCHIPPY_PROFILE=1 to count every instruction the interpreter runs, per handler and per address,
+// and dump the counts on shutdown. Compiled out entirely otherwise. The recompiler isn't available while it's on,
+// as blocks never pass back through the interpreter to be counted.
+#ifndef CHIPPY_PROFILE
+#define CHIPPY_PROFILE 0
+#endif
+#define CHIPPY_PROFILE_TOP_ADDRESSES 16 // Hottest addresses listed in the dump
+
+#if CHIPPY_PROFILE
+typedef struct ChippyProfile
+{
+    uint64_t handlerCount[CHIPPY_OP_COUNT];
+    uint64_t handlerTicks[CHIPPY_OP_COUNT]; // Performance counter ticks from each dispatch to the next
+    uint64_t addressCount[CHIPPY_ROM_MEM_SIZE];
+
+    uint64_t lastTick;   // When the instruction currently running was dispatched
+    uint8_t lastHandler; // CHIPPY_OP_COUNT outside of a batch
+} ChippyProfile;
+#endif
+
+// Coverage
+// Build with -DCHIPPY_COVERAGE=1 to have the interpreter count every edge it takes, from one instruction's address
+// to the next, in the map the machine is pointed at. The fuzzer (fuzz/ChippyFuzz.c) uses it as feedback. Recompiled
+// blocks don't count anything, and with the define left off none of it is compiled in.
+#ifndef CHIPPY_COVERAGE
+#define CHIPPY_COVERAGE 0
+#endif
+#define CHIPPY_COVERAGE_MAP_SIZE 8192 // Saturating hit counts, indexed by previous address * 2 ^ address
+
+// Idle loops (a jump to itself, FX0A with no key down, or FX07 polled until the delay timer reaches a value) are
+// skipped by CHIPPY_RunCycles to the frame they can next leave in, landing in the same state running them would
+// have. Define CHIPPY_NO_IDLE_SKIP to run them instruction by instruction. Always off when profiling.
+#if !defined(CHIPPY_NO_IDLE_SKIP) && !CHIPPY_PROFILE
+#define CHIPPY_IDLE_SKIP 1
+#else
+#define CHIPPY_IDLE_SKIP 0
+#endif
+
+// An instruction with its fields already pulled out, so the hot loop doesn't re-extract them every cycle
+typedef struct ChippyOp
+{
+    uint8_t handler; // ChippyOpHandler
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+    uint16_t nnn;
+} ChippyOp;
+
+// Rom Memory Pages
+// Memory is split into pages, each holding its bytes and the instructions decoded from them. A forked machine shares
+// its parent's pages and only copies one the first time either of them writes to it, so many instances of one rom
+// cost little more than their registers and display.
+#define CHIPPY_PAGE_SHIFT 8
+#define CHIPPY_PAGE_SIZE (1 << CHIPPY_PAGE_SHIFT)
+#define CHIPPY_PAGE_MASK (CHIPPY_PAGE_SIZE - 1)
+#define CHIPPY_PAGE_COUNT (CHIPPY_ROM_MEM_SIZE / CHIPPY_PAGE_SIZE)
+
+typedef struct ChippyPage
+{
+    SDL_AtomicInt refCount; // Machines holding the page, it's only written to while this is 1
+    uint8_t memory[CHIPPY_PAGE_SIZE];
+    // The instruction starting at every address, kept in step with memory on every write. The last one reads its
+    // second byte from the next page.
+    ChippyOp decoded[CHIPPY_PAGE_SIZE];
+} ChippyPage;
+
+// Memory as it was straight after the rom loaded, never written to so forks share it for good
+typedef struct ChippyBaseMemory
+{
+    SDL_AtomicInt refCount;
+    uint8_t memory[CHIPPY_ROM_MEM_SIZE];
+} ChippyBaseMemory;
+
+// Rom Machine
+// Everything a single CHIP-8 instance needs lives here, so many machines can run side by side in one process.
+typedef struct ChippyMachine
+{
+    // Registers
+    uint16_t programCounter;
+    uint16_t indexRegister;
+    uint8_t variableRegisters[16];
+    Cstack addressStack;
+
+    // Timers, held as the emulated frame each one reaches 0 in so nothing has to count them down as frames go by.
+    // Read through CHIPPY_GetDelayTimer and CHIPPY_GetSoundTimer.
+    uint64_t delayExpiry;
+    uint64_t soundExpiry;
+    uint64_t timerFrame; // The frame the instructions being run fall in, set by CHIPPY_RunCycles as each batch starts
+    double cycleTimer; // Host time owed to the machine by CHIPPY_Update, in seconds
+    uint64_t cycles; // Total instructions executed since reset
+    bool paused;
+    uint8_t dispatch; // ChippyDispatch, not touched by a reset
+    uint8_t quirks;   // ChippyQuirks, not touched by a reset
+    struct ChippyJit* jit; // Only created once the machine is switched to CHIPPY_DISPATCH_JIT
+
+    // Memory, read through CHIPPY_ReadByte and CHIPPY_DecodedOp and only written by the core
+    ChippyPage* pages[CHIPPY_PAGE_COUNT];
+    uint16_t ownedPages; // Bit per page known to be held by this machine alone, so writes can skip the count
+    size_t romSize;
+    // Save states only store what's changed since this
+    ChippyBaseMemory* baseMemory;
+
+    // Display, 1bit packed rows
+    uint64_t displayPlane[CHIPPY_DISPLAY_HEIGHT];
+    uint32_t dirtyRows; // Rows changed since the frontend last took them
+
+    // Inputs, as the rom sees them. Latched from the pending input as each emulated frame starts so a run only
+    // depends on the input of every frame, not on when the host's key events happened to arrive.
+    uint64_t inputBitMap;
+    uint8_t lastInput;
+    uint64_t pendingInputBitMap; // As the host's keyboard is now
+    uint8_t pendingLastInput;
+    struct ChippyMovie* movie; // Recording or playing back the input, not owned or touched by a reset
+
+    uint64_t randomState; // CXNN's xorshift64*, per machine and seeded so runs are reproducible
+
+#if CHIPPY_PROFILE
+    ChippyProfile profile; // Not touched by a reset, counts build up over the machine's lifetime
+#endif
+#if CHIPPY_COVERAGE
+    uint8_t* coverage;     // CHIPPY_COVERAGE_MAP_SIZE counts or NULL, not owned or touched by a reset
+    uint16_t coverageLast; // Address of the last instruction counted
+#endif
+} ChippyMachine;
+
+// What a timer reaching 0 in frame expiry reads as in frame
+static inline uint8_t CHIPPY_TimerLeft(uint64_t expiry, uint64_t frame)
+{
+    return expiry > frame ? (uint8_t)(expiry - frame) : 0;
+}
+
+// Reads a byte of rom memory, the address wraps within the 4K
+static inline uint8_t CHIPPY_ReadByte(const ChippyMachine* machine, uint16_t address)
+{
+    address &= CHIPPY_ROM_MEM_MASK;
+    return machine->pages[address >> CHIPPY_PAGE_SHIFT]->memory[address & CHIPPY_PAGE_MASK];
+}
+
+// The instruction starting at an address, the address wraps within the 4K
+static inline const ChippyOp* CHIPPY_DecodedOp(const ChippyMachine* machine, uint16_t address)
+{
+    address &= CHIPPY_ROM_MEM_MASK;
+    return &machine->pages[address >> CHIPPY_PAGE_SHIFT]->decoded[address & CHIPPY_PAGE_MASK];
+}
+
+typedef void (*CHIPPY_FPtr)(ChippyMachine*, const ChippyOp*);
+
+typedef struct ChippyRunStats
+{
+    uint64_t cycles;     // Instructions executed
+    uint64_t idleCycles; // Of those, how many were skipped over in idle loops rather than run
+    uint64_t elapsedNS;  // Host time spent executing them
+    double cyclesPerSec;
+} ChippyRunStats;
 
 // Rom Inputs
 
@@ -69,23 +338,94 @@ typedef void (*CHIPPY_FPtr)(uint16_t);
 */
 extern const uint8_t g_InputHexTable[16];
 extern const uint64_t g_InputBitMask;
-extern uint64_t g_InputBitMap;
 
-#define GET_ANY_INPUT_DOWN (g_InputBitMap & g_InputBitMask)
-#define GET_INPUT(code) ((g_InputBitMap >> code) & 1ull)
-#define GET_INPUT_FROM_HEX(input) (GET_INPUT(g_InputHexTable[input - 1]))
+#define GET_ANY_INPUT_DOWN(bitMap) (bitMap & g_InputBitMask)
+#define GET_INPUT(bitMap, code) ((bitMap >> code) & 1ull)
+#define GET_INPUT_FROM_HEX(bitMap, input) (GET_INPUT(bitMap, g_InputHexTable[input & 0xF]))
 // (!!isDown) is a trick to ensure this value is 0 or 1 and nothing else
-#define SET_INPUT(code, isDown) g_InputBitMap = (g_InputBitMap & ~(1ull << code)) | ((uint64_t)(!!isDown) << code);
+#define SET_INPUT(bitMap, code, isDown) bitMap = (bitMap & ~(1ull << code)) | ((uint64_t)(!!(isDown)) << code);
 #define IS_VALID_INPUT(code) (g_InputBitMask & (1ull << code))
 
-SDL_AppResult CHIPPY_Init(SDL_Renderer* g_Renderer);
-void CHIPPY_Shutdown();
+// Machine
+ChippyMachine* CHIPPY_CreateMachine();
+void CHIPPY_DestroyMachine(ChippyMachine* machine);
+// A copy of the machine as it is now, sharing its memory pages until either writes to them, so branching off a
+// running machine is nearly free. Neither machine can be running while it's forked. The copy gets its own
+// recompiler if the parent uses one, and isn't attached to the parent's movie.
+ChippyMachine* CHIPPY_ForkMachine(ChippyMachine* parent);
+void CHIPPY_ResetMachine(ChippyMachine* machine);
+// The same as a reset followed by CHIPPY_LoadRomFromMemory, but memory already holding the rom (running it again,
+// or a near copy of it) isn't re-decoded. Returns non-zero, leaving the machine untouched, if the rom doesn't fit.
+int CHIPPY_ResetWithRom(ChippyMachine* machine, const uint8_t* data, size_t size);
+// Reads the rom straight into memory at the program start and picks its quirk profile from the file name, returns
+// non-zero if it can't be read or doesn't fit
+int CHIPPY_LoadRom(ChippyMachine* machine, const char* path);
+// Copies a rom image already in memory to the program start, returns non-zero if it doesn't fit
+int CHIPPY_LoadRomFromMemory(ChippyMachine* machine, const uint8_t* data, size_t size);
+// Identifies the rom save states and movies belong to. Hashed from the memory it loaded with each time it's asked
+// for, rather than on every load, which would cost more than a short run.
+uint32_t CHIPPY_BaseHash(const ChippyMachine* machine);
+// Expands a rom argument into rom paths. A directory gives every CHIPPY_ROM_GLOB file in it, a path with * or ?
+// is matched as a glob, anything else is taken as a single rom. Sorted, NULL terminated and freed with one SDL_free.
+char** CHIPPY_FindRoms(const char* path, int* count);
+
+uint16_t CHIPPY_Fetch(ChippyMachine* machine);
+void CHIPPY_Execute(ChippyMachine* machine, uint16_t instruction);
+ChippyOp CHIPPY_Decode(uint16_t instruction);
+// The same seed always gives the same CXNN results
+void CHIPPY_SeedRandom(ChippyMachine* machine, uint64_t seed);
+// Falls back to the threaded interpreter and returns false if the dispatch isn't available here
+bool CHIPPY_SetDispatch(ChippyMachine* machine, ChippyDispatch dispatch);
+// Switches the machine to another quirk profile, dropping anything the recompiler built for the last one
+void CHIPPY_SetQuirks(ChippyMachine* machine, ChippyQuirks quirks);
+// The profile a rom's file name asks for, .sc8 for SUPER-CHIP and .xo8 for XO-CHIP, anything else runs as on the VIP
+ChippyQuirks CHIPPY_QuirksForRom(const char* path);
+// Looks up a profile by its name in g_QuirkNames, returns CHIPPY_QUIRKS_COUNT if there's no such profile
+ChippyQuirks CHIPPY_FindQuirks(const char* name);
+// Copies data over [address, address + length) of rom memory, which has to fit without wrapping, and re-decodes
+// only the spans that differ from what's there now. Returns non-zero if a shared page couldn't be copied to write to.
+int CHIPPY_WriteMemory(ChippyMachine* machine, uint16_t address, const uint8_t* data, uint16_t length);
+// Copies [address, address + length) of rom memory, which has to fit without wrapping, out into data
+void CHIPPY_ReadMemory(const ChippyMachine* machine, uint16_t address, uint8_t* data, uint16_t length);
+// Whether two machines' rom memory holds the same bytes, pages they share aren't compared
+bool CHIPPY_SameMemory(const ChippyMachine* a, const ChippyMachine* b);
+// Re-decodes every instruction overlapping [address, address + length)
+void CHIPPY_InvalidateDecoded(ChippyMachine* machine, uint16_t address, uint16_t length);
+// Logs the instruction counts gathered so far, does nothing unless built with CHIPPY_PROFILE
+void CHIPPY_DumpProfile(const ChippyMachine* machine);
+
+// App
+// romPath can be NULL for the default CHIPPY_ROM_PATH
+SDL_AppResult CHIPPY_Init(ChippyMachine** machine, SDL_Renderer* renderer, const char* romPath);
+SDL_AppResult CHIPPY_InitHeadless(ChippyMachine** machine, const char* romPath);
+void CHIPPY_Shutdown(ChippyMachine* machine);
 
-void CHIPPY_Update();
-void CHIPPY_WelcomeMsg(SDL_Renderer* g_Renderer);
-SDL_AppResult CHIPPY_InputEvent(SDL_Scancode key_code, int IsDown);
+// Runs as many instructions as the host time since the last update allows, through CHIPPY_RunCycles
+void CHIPPY_Update(ChippyMachine* machine);
+// Runs instructions back to back with no renderer and no wall clock throttling.
+// Timers and input latching are driven by emulated time (cycles) instead of host time.
+uint64_t CHIPPY_RunCycles(ChippyMachine* machine, uint64_t cycles, ChippyRunStats* stats);
+// The instruction count an emulated 60Hz frame starts at, where the timers count down and CHIPPY_RunCycles latches input
+uint64_t CHIPPY_FrameStartCycle(uint64_t frame);
+// The emulated frame an instruction count falls in
+uint64_t CHIPPY_CycleFrame(uint64_t cycle);
+// The timers as the rom would read them now, worked out from the instruction count
+uint8_t CHIPPY_GetDelayTimer(const ChippyMachine* machine);
+uint8_t CHIPPY_GetSoundTimer(const ChippyMachine* machine);
+// Sets both timers as of now, after machine->cycles is where it should be
+void CHIPPY_SetTimers(ChippyMachine* machine, uint8_t delay, uint8_t sound);
+// Hands the machine the input for an emulated frame as it starts, from its movie if it has one
+void CHIPPY_LatchInput(ChippyMachine* machine, uint64_t frame);
+void CHIPPY_WelcomeMsg(SDL_Renderer* renderer);
+SDL_AppResult CHIPPY_InputEvent(ChippyMachine* machine, SDL_Scancode key_code, int IsDown);
 
-uint32_t* CHIPPY_GetDisplayBuffer();
+// Expands rows of the display plane to RGBA32 pixels in the on/off display colors.
+// pixels points at the first row to write, rows are pitch bytes apart.
+void CHIPPY_ExpandDisplay(const ChippyMachine* machine, uint32_t* pixels, int pitch, int firstRow, int rowCount);
+// Identifies what's on screen, for checking a run against a known good one
+uint64_t CHIPPY_HashDisplay(const ChippyMachine* machine);
+// Returns the rows drawn to or cleared since the last call and resets them
+uint32_t CHIPPY_TakeDirtyRows(ChippyMachine* machine);
 SDL_Texture* CHIPPY_GetDisplayTexture();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,138 @@
+// Interpreter Instance
+// Included by Chippy.c once per quirk profile, with CHIPPY_QUIRKS_FLAGS set to the profile's flags and
+// CHIPPY_QUIRKS_SUFFIX to the suffix its functions are named with. The quirked handlers are wrapped with the flags as a
+// constant, so their checks fold away and every profile gets its own table and dispatch loops with no quirk left to
+// test per instruction.
+#if !defined(CHIPPY_QUIRKS_FLAGS) || !defined(CHIPPY_QUIRKS_SUFFIX)
+#error "Define CHIPPY_QUIRKS_FLAGS and CHIPPY_QUIRKS_SUFFIX before including ChippyInterpreter.inl"
+#endif
+
+#define CHIPPY_QUIRKED_HANDLER(function) \
+    static inline void CHIPPY_QUIRKED(function)(ChippyMachine* machine, const ChippyOp* op) \
+    { \
+        function(machine, op, CHIPPY_QUIRKS_FLAGS); \
+    }
+CHIPPY_QUIRKED_OPERATIONS(CHIPPY_QUIRKED_HANDLER)
+#undef CHIPPY_QUIRKED_HANDLER
+
+// Flat table of every instruction, indexed by the handler picked out at decode time
+#define CHIPPY_OPERATION_MAP_ENTRY(handler, function) [handler] = function,
+static const CHIPPY_FPtr CHIPPY_QUIRKED(g_OperationMap)[CHIPPY_OP_COUNT] =
+{
+    CHIPPY_OPERATIONS(CHIPPY_OPERATION_MAP_ENTRY)
+};
+#undef CHIPPY_OPERATION_MAP_ENTRY
+
+// Fetch and execute straight from the decoded cache
+static inline void CHIPPY_QUIRKED(CHIPPY_Step)(ChippyMachine* machine)
+{
+    const ChippyOp* op = CHIPPY_DecodedOp(machine, machine->programCounter);
+    CHIPPY_PROFILE_OP(machine, op, machine->programCounter);
+    CHIPPY_COVER_OP(machine, machine->programCounter);
+    machine->programCounter += 2;
+    (*CHIPPY_QUIRKED(g_OperationMap)[op->handler])(machine, op);
+};
+
+static void CHIPPY_QUIRKED(CHIPPY_RunCall)(ChippyMachine* machine, uint64_t cycles)
+{
+    ChippyPageCursor cursor = { NULL, CHIPPY_PAGE_COUNT };
+    for (uint64_t i = 0; i < cycles; ++i)
+    {
+        const ChippyOp* op = CHIPPY_CursorOp(&cursor, machine);
+        CHIPPY_PROFILE_OP(machine, op, machine->programCounter);
+        CHIPPY_COVER_OP(machine, machine->programCounter);
+        machine->programCounter += 2;
+        (*CHIPPY_QUIRKED(g_OperationMap)[op->handler])(machine, op);
+        if (CHIPPY_WritesMemory(op->handler))
+            cursor.page = CHIPPY_PAGE_COUNT;
+    }
+};
+
+// Threaded interpreter. Every handler body is expanded inline and ends by fetching and jumping straight to the next
+// one, so there's no call per instruction and each handler gets its own indirect branch for the predictor to learn.
+// Uses labels as values where the compiler has them, otherwise a switch in a loop.
+static void CHIPPY_QUIRKED(CHIPPY_RunThreaded)(ChippyMachine* machine, uint64_t cycles)
+{
+    const ChippyOp* op;
+    ChippyPageCursor cursor = { NULL, CHIPPY_PAGE_COUNT };
+    uint64_t remaining = cycles;
+
+#if CHIPPY_HAS_COMPUTED_GOTO
+    #define CHIPPY_THREADED_LABEL_ENTRY(handler, function) [handler] = &&handler##_LABEL,
+    static const void* const labels[CHIPPY_OP_COUNT] =
+    {
+        CHIPPY_OPERATIONS(CHIPPY_THREADED_LABEL_ENTRY)
+    };
+    #undef CHIPPY_THREADED_LABEL_ENTRY
+
+    #define CHIPPY_THREADED_CASE(handler) handler##_LABEL:
+    #define CHIPPY_THREADED_NEXT() \
+        if (remaining == 0) goto done; \
+        --remaining; \
+        op = CHIPPY_CursorOp(&cursor, machine); \
+        CHIPPY_PROFILE_OP(machine, op, machine->programCounter); \
+        CHIPPY_COVER_OP(machine, machine->programCounter); \
+        machine->programCounter += 2; \
+        goto *labels[op->handler]
+
+    CHIPPY_THREADED_NEXT();
+#else
+    #define CHIPPY_THREADED_CASE(handler) case handler:
+    #define CHIPPY_THREADED_NEXT() continue
+
+    while (remaining-- > 0)
+    {
+        op = CHIPPY_CursorOp(&cursor, machine);
+        CHIPPY_PROFILE_OP(machine, op, machine->programCounter);
+        CHIPPY_COVER_OP(machine, machine->programCounter);
+        machine->programCounter += 2;
+        switch (op->handler)
+        {
+#endif
+
+    #define CHIPPY_THREADED_BODY(handler, function) CHIPPY_THREADED_CASE(handler) function(machine, op); \
+        if (CHIPPY_WritesMemory(handler)) cursor.page = CHIPPY_PAGE_COUNT; \
+        CHIPPY_THREADED_NEXT();
+    CHIPPY_OPERATIONS(CHIPPY_THREADED_BODY)
+    #undef CHIPPY_THREADED_BODY
+
+#if CHIPPY_HAS_COMPUTED_GOTO
+done:
+    return;
+#else
+        default:
+            break;
+        }
+    }
+#endif
+
+    #undef CHIPPY_THREADED_CASE
+    #undef CHIPPY_THREADED_NEXT
+};
+
+static void CHIPPY_QUIRKED(CHIPPY_RunJit)(ChippyMachine* machine, uint64_t cycles)
+{
+    uint64_t remaining = cycles;
+    while (remaining > 0)
+    {
+        remaining -= CHIPPY_JitRun(machine->jit, machine, remaining);
+
+        // The blocks stopped at an instruction left to the interpreter
+        if (remaining > 0)
+        {
+            CHIPPY_QUIRKED(CHIPPY_Step)(machine);
+            --remaining;
+        }
+    }
+};
+
+static const ChippyInterpreter CHIPPY_QUIRKED(g_Interpreter) =
+{
+    CHIPPY_QUIRKED(g_OperationMap),
+    CHIPPY_QUIRKED(CHIPPY_RunCall),
+    CHIPPY_QUIRKED(CHIPPY_RunThreaded),
+    CHIPPY_QUIRKED(CHIPPY_RunJit),
+};
+
+#undef CHIPPY_QUIRKS_FLAGS
+#undef CHIPPY_QUIRKS_SUFFIX
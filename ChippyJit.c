@@ -0,0 +1,715 @@
+// mmap's MAP_ANONYMOUS is hidden behind this when building as strict C
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include "ChippyJit.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+
+#if CHIPPY_JIT_SUPPORTED
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/** Executable Memory **/
+// The cache is never writable and executable at once, which hardened kernels and macOS refuse. It's mapped read/write
+// and the pages a block lands in are only made writable again while it's being emitted.
+static uint8_t* CHIPPY_JitAllocCode(size_t size)
+{
+#ifdef _WIN32
+    return VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+#endif
+}
+
+static size_t CHIPPY_JitPageSize()
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+#else
+    const long size = sysconf(_SC_PAGESIZE);
+    return size > 0 ? (size_t)size : 4096;
+#endif
+}
+
+// Switches [code, code + size), page aligned, between writable and executable. Returns false if the OS won't.
+static bool CHIPPY_JitProtectCode(uint8_t* code, size_t size, bool executable)
+{
+#ifdef _WIN32
+    DWORD previous;
+    if (!VirtualProtect(code, size, executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &previous))
+        return false;
+    if (executable)
+        FlushInstructionCache(GetCurrentProcess(), code, size);
+    return true;
+#else
+    return mprotect(code, size, executable ? PROT_READ | PROT_EXEC : PROT_READ | PROT_WRITE) == 0;
+#endif
+}
+
+static void CHIPPY_JitFreeCode(uint8_t* code, size_t size)
+{
+#ifdef _WIN32
+    VirtualFree(code, 0, MEM_RELEASE);
+#else
+    munmap(code, size);
+#endif
+}
+
+/** Emitter **/
+// Generated code keeps the machine pointer in rbx (callee saved on both SysV and Windows) and every
+// operand is addressed as [rbx + offset]. rdx holds the cycles left, eax and ecx are scratch.
+typedef struct ChippyJitEmitter
+{
+    uint8_t* code;
+    size_t size;
+
+    uint16_t start; // Address the block was compiled from
+    uint8_t quirks; // The machine's quirk flags, compiled into the block
+    size_t body;    // Where the first instruction's code starts, self loops jump back here
+    size_t exits[CHIPPY_JIT_MAX_BLOCK_OPS]; // Out of cycles before each instruction, patched once the block is done
+} ChippyJitEmitter;
+
+#define CHIPPY_JIT_EAX 0
+#define CHIPPY_JIT_ECX 1
+
+// Condition codes, as used by jcc and setcc
+#define CHIPPY_JIT_CC_B 0x2  // Carry set
+#define CHIPPY_JIT_CC_AE 0x3 // Carry clear
+#define CHIPPY_JIT_CC_E 0x4
+#define CHIPPY_JIT_CC_NE 0x5
+
+#define CHIPPY_JIT_PC ((uint32_t)offsetof(ChippyMachine, programCounter))
+#define CHIPPY_JIT_I ((uint32_t)offsetof(ChippyMachine, indexRegister))
+#define CHIPPY_JIT_V(x) ((uint32_t)offsetof(ChippyMachine, variableRegisters) + (x))
+#define CHIPPY_JIT_DELAY ((uint32_t)offsetof(ChippyMachine, delayExpiry))
+#define CHIPPY_JIT_SOUND ((uint32_t)offsetof(ChippyMachine, soundExpiry))
+#define CHIPPY_JIT_FRAME ((uint32_t)offsetof(ChippyMachine, timerFrame))
+#define CHIPPY_JIT_STACK_ITEMS ((uint32_t)(offsetof(ChippyMachine, addressStack) + offsetof(Cstack, items)))
+#define CHIPPY_JIT_STACK_COUNT ((uint32_t)(offsetof(ChippyMachine, addressStack) + offsetof(Cstack, count)))
+#define CHIPPY_JIT_STACK_ERRORS ((uint32_t)(offsetof(ChippyMachine, addressStack) + offsetof(Cstack, errors)))
+
+static inline void CHIPPY_JitEmit8(ChippyJitEmitter* e, uint8_t value)
+{
+    e->code[e->size++] = value;
+}
+
+static inline void CHIPPY_JitEmit16(ChippyJitEmitter* e, uint16_t value)
+{
+    CHIPPY_JitEmit8(e, (uint8_t)value);
+    CHIPPY_JitEmit8(e, (uint8_t)(value >> 8));
+}
+
+static inline void CHIPPY_JitEmit32(ChippyJitEmitter* e, uint32_t value)
+{
+    CHIPPY_JitEmit16(e, (uint16_t)value);
+    CHIPPY_JitEmit16(e, (uint16_t)(value >> 16));
+}
+
+// ModRM for [rbx + disp32], reg is either a register or the opcode extension
+static void CHIPPY_JitEmitMem(ChippyJitEmitter* e, uint8_t reg, uint32_t offset)
+{
+    CHIPPY_JitEmit8(e, 0x80 | reg << 3 | 3);
+    CHIPPY_JitEmit32(e, offset);
+}
+
+// op r8, [rbx + offset] or op [rbx + offset], r8 depending on the opcode
+static void CHIPPY_JitEmitOpMem(ChippyJitEmitter* e, uint8_t opcode, uint8_t reg, uint32_t offset)
+{
+    CHIPPY_JitEmit8(e, opcode);
+    CHIPPY_JitEmitMem(e, reg, offset);
+}
+
+// Byte sized op with an immediate, ext picks add (0), or (1) or cmp (7)
+static void CHIPPY_JitEmitImm8(ChippyJitEmitter* e, uint8_t ext, uint32_t offset, uint8_t value)
+{
+    CHIPPY_JitEmitOpMem(e, 0x80, ext, offset);
+    CHIPPY_JitEmit8(e, value);
+}
+
+// The same with REX.W, for the 64 bit timer fields
+static void CHIPPY_JitEmitOpMem64(ChippyJitEmitter* e, uint8_t opcode, uint8_t reg, uint32_t offset)
+{
+    CHIPPY_JitEmit8(e, 0x48);
+    CHIPPY_JitEmitOpMem(e, opcode, reg, offset);
+}
+
+static void CHIPPY_JitEmitMovzx8(ChippyJitEmitter* e, uint8_t reg, uint32_t offset)
+{
+    CHIPPY_JitEmit8(e, 0x0F);
+    CHIPPY_JitEmitOpMem(e, 0xB6, reg, offset);
+}
+
+static void CHIPPY_JitEmitMovzx16(ChippyJitEmitter* e, uint8_t reg, uint32_t offset)
+{
+    CHIPPY_JitEmit8(e, 0x0F);
+    CHIPPY_JitEmitOpMem(e, 0xB7, reg, offset);
+}
+
+static void CHIPPY_JitEmitSetcc(ChippyJitEmitter* e, uint8_t cc, uint8_t reg)
+{
+    CHIPPY_JitEmit8(e, 0x0F);
+    CHIPPY_JitEmit8(e, 0x90 | cc);
+    CHIPPY_JitEmit8(e, 0xC0 | reg);
+}
+
+// mov word [rbx + offset], value
+static void CHIPPY_JitEmitStoreImm16(ChippyJitEmitter* e, uint32_t offset, uint16_t value)
+{
+    CHIPPY_JitEmit8(e, 0x66);
+    CHIPPY_JitEmitOpMem(e, 0xC7, 0, offset);
+    CHIPPY_JitEmit16(e, value);
+}
+
+// add word [rbx + offset], value
+static void CHIPPY_JitEmitAddImm16(ChippyJitEmitter* e, uint32_t offset, uint16_t value)
+{
+    CHIPPY_JitEmit8(e, 0x66);
+    CHIPPY_JitEmitOpMem(e, 0x81, 0, offset);
+    CHIPPY_JitEmit16(e, value);
+}
+
+// Short forward jump, returns where to patch once the target is known
+static size_t CHIPPY_JitEmitJump(ChippyJitEmitter* e, uint8_t opcode)
+{
+    CHIPPY_JitEmit8(e, opcode);
+    CHIPPY_JitEmit8(e, 0);
+    return e->size - 1;
+}
+
+static void CHIPPY_JitPatchJump(ChippyJitEmitter* e, size_t at)
+{
+    e->code[at] = (uint8_t)(e->size - (at + 1));
+}
+
+static void CHIPPY_JitEmitPrologue(ChippyJitEmitter* e)
+{
+    CHIPPY_JitEmit8(e, 0x53); // push rbx
+    CHIPPY_JitEmit8(e, 0x48); // mov rbx, <machine>
+    CHIPPY_JitEmit8(e, 0x89);
+#ifdef _WIN32
+    CHIPPY_JitEmit8(e, 0xCB); // rcx, the cycles are already in rdx
+#else
+    CHIPPY_JitEmit8(e, 0xFB); // rdi
+    CHIPPY_JitEmit8(e, 0x48); // mov rdx, rsi
+    CHIPPY_JitEmit8(e, 0x89);
+    CHIPPY_JitEmit8(e, 0xF2);
+#endif
+    e->body = e->size;
+}
+
+// Returns the cycles left
+static void CHIPPY_JitEmitEpilogue(ChippyJitEmitter* e)
+{
+    CHIPPY_JitEmit8(e, 0x48); // mov rax, rdx
+    CHIPPY_JitEmit8(e, 0x89);
+    CHIPPY_JitEmit8(e, 0xD0);
+    CHIPPY_JitEmit8(e, 0x5B); // pop rbx
+    CHIPPY_JitEmit8(e, 0xC3); // ret
+}
+
+// Every instruction first takes a cycle, leaving before it if there are none left. Blocks can then
+// be any length whatever cycles they're given, and loop on themselves without running over.
+static void CHIPPY_JitEmitTakeCycle(ChippyJitEmitter* e, uint16_t index)
+{
+    CHIPPY_JitEmit8(e, 0x48); // sub rdx, 1
+    CHIPPY_JitEmit8(e, 0x83);
+    CHIPPY_JitEmit8(e, 0xEA);
+    CHIPPY_JitEmit8(e, 0x01);
+    CHIPPY_JitEmit8(e, 0x0F); // jb exit
+    CHIPPY_JitEmit8(e, 0x80 | CHIPPY_JIT_CC_B);
+    CHIPPY_JitEmit32(e, 0);
+    e->exits[index] = e->size - 4;
+}
+
+// Out of line exits for running out of cycles, the program counter is left on the instruction that didn't run
+static void CHIPPY_JitEmitExits(ChippyJitEmitter* e, uint16_t count)
+{
+    for (uint16_t i = 0; i < count; ++i)
+    {
+        const uint32_t rel = (uint32_t)(e->size - (e->exits[i] + 4));
+        SDL_memcpy(&e->code[e->exits[i]], &rel, sizeof(rel));
+
+        if (i > 0)
+            CHIPPY_JitEmitAddImm16(e, CHIPPY_JIT_PC, i * 2);
+        CHIPPY_JitEmit8(e, 0x31); // xor eax, eax
+        CHIPPY_JitEmit8(e, 0xC0);
+        CHIPPY_JitEmit8(e, 0x5B); // pop rbx
+        CHIPPY_JitEmit8(e, 0xC3); // ret
+    }
+}
+
+// Skips: PC moves past the block, plus another instruction if the flags from the compare match cc
+static void CHIPPY_JitEmitSkip(ChippyJitEmitter* e, uint8_t cc, uint16_t blockBytes)
+{
+    CHIPPY_JitEmitSetcc(e, cc, CHIPPY_JIT_EAX);
+    CHIPPY_JitEmit8(e, 0x0F); // movzx eax, al
+    CHIPPY_JitEmit8(e, 0xB6);
+    CHIPPY_JitEmit8(e, 0xC0);
+    CHIPPY_JitEmit8(e, 0x01); // add eax, eax
+    CHIPPY_JitEmit8(e, 0xC0);
+    CHIPPY_JitEmit8(e, 0x05); // add eax, blockBytes
+    CHIPPY_JitEmit32(e, blockBytes);
+    CHIPPY_JitEmit8(e, 0x66); // add word [pc], ax
+    CHIPPY_JitEmitOpMem(e, 0x01, CHIPPY_JIT_EAX, CHIPPY_JIT_PC);
+    CHIPPY_JitEmitEpilogue(e);
+}
+
+// Flag setting ALU ops: al holds the result, cl the flag. VF is written last so the flag wins when X is F.
+static void CHIPPY_JitEmitStoreWithFlag(ChippyJitEmitter* e, uint8_t x)
+{
+    CHIPPY_JitEmitOpMem(e, 0x88, CHIPPY_JIT_EAX, CHIPPY_JIT_V(x));
+    CHIPPY_JitEmitOpMem(e, 0x88, CHIPPY_JIT_ECX, CHIPPY_JIT_V(0xF));
+}
+
+// The bitwise ops clear VF with the VF reset quirk: mov byte [vf], 0
+static void CHIPPY_JitEmitResetFlag(ChippyJitEmitter* e)
+{
+    if (!(e->quirks & CHIPPY_QUIRK_VF_RESET))
+        return;
+    CHIPPY_JitEmitOpMem(e, 0xC6, 0, CHIPPY_JIT_V(0xF));
+    CHIPPY_JitEmit8(e, 0);
+}
+
+static bool CHIPPY_JitCompiles(uint8_t handler)
+{
+    switch (handler)
+    {
+    // Drawing, waiting on keys, rand and the memory ops are left to the interpreter
+    case CHIPPY_OP_CLEAR_SCREEN:
+    case CHIPPY_OP_RAND_VX:
+    case CHIPPY_OP_DRAW_SPRITE:
+    case CHIPPY_OP_SKIP_KEYDOWN:
+    case CHIPPY_OP_SKIP_KEYUP:
+    case CHIPPY_OP_GET_KEY:
+    case CHIPPY_OP_TO_DECIMAL:
+    case CHIPPY_OP_MEMORY_STORE:
+    case CHIPPY_OP_MEMORY_LOAD:
+        return false;
+    default:
+        return true;
+    }
+}
+
+// blockBytes is how far the program counter would have advanced from the block's start once this instruction is
+// fetched. Returns true if the instruction changes the program counter, which ends the block.
+static bool CHIPPY_JitEmitOp(ChippyJitEmitter* e, const ChippyOp* op, uint16_t blockBytes)
+{
+    const uint32_t vx = CHIPPY_JIT_V(op->x);
+    const uint32_t vy = CHIPPY_JIT_V(op->y);
+
+    switch (op->handler)
+    {
+    case CHIPPY_OP_NOP:
+        return false;
+
+    case CHIPPY_OP_SET_VX: // mov byte [vx], nn
+        CHIPPY_JitEmitOpMem(e, 0xC6, 0, vx);
+        CHIPPY_JitEmit8(e, op->nn);
+        return false;
+    case CHIPPY_OP_ADD_VX: // add byte [vx], nn
+        CHIPPY_JitEmitImm8(e, 0, vx, op->nn);
+        return false;
+
+    case CHIPPY_OP_SET_VXVY: // mov al, [vy]; mov [vx], al
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitOpMem(e, 0x88, CHIPPY_JIT_EAX, vx);
+        return false;
+    case CHIPPY_OP_OR_VXVY: // mov al, [vy]; or [vx], al
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitOpMem(e, 0x08, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitResetFlag(e);
+        return false;
+    case CHIPPY_OP_AND_VXVY: // mov al, [vy]; and [vx], al
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitOpMem(e, 0x20, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitResetFlag(e);
+        return false;
+    case CHIPPY_OP_XOR_VXVY: // mov al, [vy]; xor [vx], al
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitOpMem(e, 0x30, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitResetFlag(e);
+        return false;
+
+    case CHIPPY_OP_ADD_VXVY: // mov al, [vx]; add al, [vy]; setc cl
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitOpMem(e, 0x02, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitSetcc(e, CHIPPY_JIT_CC_B, CHIPPY_JIT_ECX);
+        CHIPPY_JitEmitStoreWithFlag(e, op->x);
+        return false;
+    case CHIPPY_OP_SUB_VXVY: // mov al, [vx]; sub al, [vy]; setnc cl
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitOpMem(e, 0x2A, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitSetcc(e, CHIPPY_JIT_CC_AE, CHIPPY_JIT_ECX);
+        CHIPPY_JitEmitStoreWithFlag(e, op->x);
+        return false;
+    case CHIPPY_OP_SUB_VYVX: // mov al, [vy]; sub al, [vx]; setnc cl
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, vy);
+        CHIPPY_JitEmitOpMem(e, 0x2A, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitSetcc(e, CHIPPY_JIT_CC_AE, CHIPPY_JIT_ECX);
+        CHIPPY_JitEmitStoreWithFlag(e, op->x);
+        return false;
+    case CHIPPY_OP_SHR_VYVX: // mov al, [vy]; shr al, 1; setc cl
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, e->quirks & CHIPPY_QUIRK_SHIFT_VX ? vx : vy);
+        CHIPPY_JitEmit8(e, 0xD0);
+        CHIPPY_JitEmit8(e, 0xE8);
+        CHIPPY_JitEmitSetcc(e, CHIPPY_JIT_CC_B, CHIPPY_JIT_ECX);
+        CHIPPY_JitEmitStoreWithFlag(e, op->x);
+        return false;
+    case CHIPPY_OP_SHL_VYVX: // mov al, [vy]; shl al, 1; setc cl
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_EAX, e->quirks & CHIPPY_QUIRK_SHIFT_VX ? vx : vy);
+        CHIPPY_JitEmit8(e, 0xD0);
+        CHIPPY_JitEmit8(e, 0xE0);
+        CHIPPY_JitEmitSetcc(e, CHIPPY_JIT_CC_B, CHIPPY_JIT_ECX);
+        CHIPPY_JitEmitStoreWithFlag(e, op->x);
+        return false;
+
+    case CHIPPY_OP_SET_IDXREG:
+        CHIPPY_JitEmitStoreImm16(e, CHIPPY_JIT_I, op->nnn);
+        return false;
+    case CHIPPY_OP_ADD_IDXREG: // movzx eax, byte [vx]; add word [i], ax
+        CHIPPY_JitEmitMovzx8(e, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmit8(e, 0x66);
+        CHIPPY_JitEmitOpMem(e, 0x01, CHIPPY_JIT_EAX, CHIPPY_JIT_I);
+        return false;
+    case CHIPPY_OP_FONT_CHARACTER: // movzx eax, byte [vx]; and eax, 0xF; lea eax, [rax + rax * 4 + 0x50]; mov word [i], ax
+        // The font is 5 bytes a character, loaded at 0x50 by CHIPPY_ResetMachine
+        CHIPPY_JitEmitMovzx8(e, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmit8(e, 0x83);
+        CHIPPY_JitEmit8(e, 0xE0);
+        CHIPPY_JitEmit8(e, 0x0F);
+        CHIPPY_JitEmit8(e, 0x8D);
+        CHIPPY_JitEmit8(e, 0x44);
+        CHIPPY_JitEmit8(e, 0x80);
+        CHIPPY_JitEmit8(e, 0x50);
+        CHIPPY_JitEmit8(e, 0x66);
+        CHIPPY_JitEmitOpMem(e, 0x89, CHIPPY_JIT_EAX, CHIPPY_JIT_I);
+        return false;
+
+    case CHIPPY_OP_GET_DELAY: // mov rax, [delay]; sub rax, [frame]; jae store; xor eax, eax; store: mov [vx], al
+    {
+        CHIPPY_JitEmitOpMem64(e, 0x8B, CHIPPY_JIT_EAX, CHIPPY_JIT_DELAY);
+        CHIPPY_JitEmitOpMem64(e, 0x2B, CHIPPY_JIT_EAX, CHIPPY_JIT_FRAME);
+        const size_t store = CHIPPY_JitEmitJump(e, 0x70 | CHIPPY_JIT_CC_AE);
+        CHIPPY_JitEmit8(e, 0x31);
+        CHIPPY_JitEmit8(e, 0xC0);
+        CHIPPY_JitPatchJump(e, store);
+        CHIPPY_JitEmitOpMem(e, 0x88, CHIPPY_JIT_EAX, vx);
+        return false;
+    }
+    case CHIPPY_OP_SET_DELAY: // movzx eax, byte [vx]; add rax, [frame]; mov [delay], rax
+    case CHIPPY_OP_SET_SOUND:
+        CHIPPY_JitEmitMovzx8(e, CHIPPY_JIT_EAX, vx);
+        CHIPPY_JitEmitOpMem64(e, 0x03, CHIPPY_JIT_EAX, CHIPPY_JIT_FRAME);
+        CHIPPY_JitEmitOpMem64(e, 0x89, CHIPPY_JIT_EAX, op->handler == CHIPPY_OP_SET_DELAY ? CHIPPY_JIT_DELAY : CHIPPY_JIT_SOUND);
+        return false;
+
+    case CHIPPY_OP_JUMP_PC:
+        CHIPPY_JitEmitStoreImm16(e, CHIPPY_JIT_PC, op->nnn);
+        if (op->nnn == e->start)
+        {
+            // Loops straight back into itself, spin here until the cycles run out
+            CHIPPY_JitEmit8(e, 0xE9); // jmp body
+            CHIPPY_JitEmit32(e, (uint32_t)(e->body - (e->size + 4)));
+        }
+        else
+        {
+            CHIPPY_JitEmitEpilogue(e);
+        }
+        return true;
+    case CHIPPY_OP_JUMP_V0PC: // movzx eax, byte [v0]; add eax, nnn; mov word [pc], ax
+        CHIPPY_JitEmitMovzx8(e, CHIPPY_JIT_EAX, e->quirks & CHIPPY_QUIRK_JUMP_VX ? vx : CHIPPY_JIT_V(0));
+        CHIPPY_JitEmit8(e, 0x05);
+        CHIPPY_JitEmit32(e, op->nnn);
+        CHIPPY_JitEmit8(e, 0x66);
+        CHIPPY_JitEmitOpMem(e, 0x89, CHIPPY_JIT_EAX, CHIPPY_JIT_PC);
+        CHIPPY_JitEmitEpilogue(e);
+        return true;
+
+    case CHIPPY_OP_IF_VXNN: // cmp byte [vx], nn
+    case CHIPPY_OP_IFNOT_VXNN:
+        CHIPPY_JitEmitImm8(e, 7, vx, op->nn);
+        CHIPPY_JitEmitSkip(e, op->handler == CHIPPY_OP_IF_VXNN ? CHIPPY_JIT_CC_E : CHIPPY_JIT_CC_NE, blockBytes);
+        return true;
+    case CHIPPY_OP_IF_VXVY: // mov cl, [vy]; cmp [vx], cl
+    case CHIPPY_OP_IFNOT_VXVY:
+        CHIPPY_JitEmitOpMem(e, 0x8A, CHIPPY_JIT_ECX, vy);
+        CHIPPY_JitEmitOpMem(e, 0x38, CHIPPY_JIT_ECX, vx);
+        CHIPPY_JitEmitSkip(e, op->handler == CHIPPY_OP_IF_VXVY ? CHIPPY_JIT_CC_E : CHIPPY_JIT_CC_NE, blockBytes);
+        return true;
+
+    case CHIPPY_OP_PUSH_SUBROUTINE:
+    {
+        // The return address is wherever this block started plus what it covers, the raw PC isn't always masked
+        CHIPPY_JitEmitMovzx8(e, CHIPPY_JIT_ECX, CHIPPY_JIT_STACK_COUNT);
+        CHIPPY_JitEmitMovzx16(e, CHIPPY_JIT_EAX, CHIPPY_JIT_PC);
+        CHIPPY_JitEmit8(e, 0x05); // add eax, blockBytes
+        CHIPPY_JitEmit32(e, blockBytes);
+        CHIPPY_JitEmit8(e, 0x81); // cmp ecx, CSTACK_CAPACITY
+        CHIPPY_JitEmit8(e, 0xF9);
+        CHIPPY_JitEmit32(e, CSTACK_CAPACITY);
+        const size_t overflow = CHIPPY_JitEmitJump(e, 0x70 | CHIPPY_JIT_CC_AE);
+
+        CHIPPY_JitEmit8(e, 0x66); // mov word [items + rcx * 2], ax
+        CHIPPY_JitEmit8(e, 0x89);
+        CHIPPY_JitEmit8(e, 0x84);
+        CHIPPY_JitEmit8(e, 0x4B);
+        CHIPPY_JitEmit32(e, CHIPPY_JIT_STACK_ITEMS);
+        CHIPPY_JitEmit8(e, 0xFF); // inc ecx
+        CHIPPY_JitEmit8(e, 0xC1);
+        CHIPPY_JitEmitOpMem(e, 0x88, CHIPPY_JIT_ECX, CHIPPY_JIT_STACK_COUNT);
+        CHIPPY_JitEmitStoreImm16(e, CHIPPY_JIT_PC, op->nnn);
+        CHIPPY_JitEmitEpilogue(e);
+
+        // Full, drop the call and carry on past it
+        CHIPPY_JitPatchJump(e, overflow);
+        CHIPPY_JitEmitImm8(e, 1, CHIPPY_JIT_STACK_ERRORS, CSTACK_OVERFLOW);
+        CHIPPY_JitEmit8(e, 0x66);
+        CHIPPY_JitEmitOpMem(e, 0x89, CHIPPY_JIT_EAX, CHIPPY_JIT_PC);
+        CHIPPY_JitEmitEpilogue(e);
+        return true;
+    }
+    case CHIPPY_OP_POP_SUBROUTINE:
+    {
+        CHIPPY_JitEmitMovzx8(e, CHIPPY_JIT_ECX, CHIPPY_JIT_STACK_COUNT);
+        CHIPPY_JitEmit8(e, 0x85); // test ecx, ecx
+        CHIPPY_JitEmit8(e, 0xC9);
+        const size_t underflow = CHIPPY_JitEmitJump(e, 0x70 | CHIPPY_JIT_CC_E);
+
+        CHIPPY_JitEmit8(e, 0xFF); // dec ecx
+        CHIPPY_JitEmit8(e, 0xC9);
+        CHIPPY_JitEmitOpMem(e, 0x88, CHIPPY_JIT_ECX, CHIPPY_JIT_STACK_COUNT);
+        CHIPPY_JitEmit8(e, 0x0F); // movzx eax, word [items + rcx * 2]
+        CHIPPY_JitEmit8(e, 0xB7);
+        CHIPPY_JitEmit8(e, 0x84);
+        CHIPPY_JitEmit8(e, 0x4B);
+        CHIPPY_JitEmit32(e, CHIPPY_JIT_STACK_ITEMS);
+        CHIPPY_JitEmit8(e, 0x66);
+        CHIPPY_JitEmitOpMem(e, 0x89, CHIPPY_JIT_EAX, CHIPPY_JIT_PC);
+        CHIPPY_JitEmitEpilogue(e);
+
+        // Empty, nowhere to return to so carry on from the next instruction
+        CHIPPY_JitPatchJump(e, underflow);
+        CHIPPY_JitEmitImm8(e, 1, CHIPPY_JIT_STACK_ERRORS, CSTACK_UNDERFLOW);
+        CHIPPY_JitEmitAddImm16(e, CHIPPY_JIT_PC, blockBytes);
+        CHIPPY_JitEmitEpilogue(e);
+        return true;
+    }
+
+    default:
+        return false;
+    }
+}
+
+/** Blocks **/
+static void CHIPPY_JitCover(ChippyJit* jit, uint16_t start, uint16_t bytes, int delta)
+{
+    for (uint16_t i = 0; i < bytes; ++i)
+        jit->coverage[(start + i) & CHIPPY_ROM_MEM_MASK] += delta;
+}
+
+// Leaves the instruction at start to the interpreter. Still covers it, so rewriting it into something compilable
+// gets it looked at again.
+static ChippyJitBlock* CHIPPY_JitLeaveToInterpreter(ChippyJit* jit, uint16_t start)
+{
+    ChippyJitBlock* block = &jit->blocks[start];
+    block->code = NULL;
+    block->cycles = 1;
+    block->bytes = 2;
+    CHIPPY_JitCover(jit, start, block->bytes, 1);
+    return block;
+}
+
+static ChippyJitBlock* CHIPPY_JitCompile(ChippyJit* jit, const ChippyMachine* machine, uint16_t start)
+{
+    if (!CHIPPY_JitCompiles(CHIPPY_DecodedOp(machine, start)->handler))
+        return CHIPPY_JitLeaveToInterpreter(jit, start);
+
+    if (CHIPPY_JIT_CACHE_SIZE - jit->cacheUsed < CHIPPY_JIT_MAX_BLOCK_CODE)
+        CHIPPY_JitFlush(jit);
+
+    // The pages the block can reach, which may include the tail of the last one, writable just while it's emitted
+    const size_t pageStart = jit->cacheUsed / jit->pageSize * jit->pageSize;
+    const size_t pageEnd = SDL_min((jit->cacheUsed + CHIPPY_JIT_MAX_BLOCK_CODE + jit->pageSize - 1) / jit->pageSize * jit->pageSize, CHIPPY_JIT_CACHE_SIZE);
+    if (!CHIPPY_JitProtectCode(jit->cache + pageStart, pageEnd - pageStart, false))
+    {
+        fprintf(stderr, "Couldn't make the jit's code cache writable\n");
+        return CHIPPY_JitLeaveToInterpreter(jit, start);
+    }
+
+    ChippyJitEmitter e;
+    e.code = jit->cache + jit->cacheUsed;
+    e.size = 0;
+    e.start = start;
+    e.quirks = g_QuirkFlags[machine->quirks];
+    CHIPPY_JitEmitPrologue(&e);
+
+    // The first instruction always compiles
+    uint16_t ops = 0;
+    bool ended = false;
+    while (ops < CHIPPY_JIT_MAX_BLOCK_OPS && !ended)
+    {
+        const ChippyOp* op = CHIPPY_DecodedOp(machine, start + ops * 2);
+        if (!CHIPPY_JitCompiles(op->handler))
+            break;
+
+        CHIPPY_JitEmitTakeCycle(&e, ops);
+        ++ops;
+        ended = CHIPPY_JitEmitOp(&e, op, ops * 2);
+    }
+
+    // Ran off the end or hit an instruction for the interpreter, carry on from after the last one compiled
+    if (!ended)
+    {
+        CHIPPY_JitEmitAddImm16(&e, CHIPPY_JIT_PC, ops * 2);
+        CHIPPY_JitEmitEpilogue(&e);
+    }
+    CHIPPY_JitEmitExits(&e, ops);
+
+    if (!CHIPPY_JitProtectCode(jit->cache + pageStart, pageEnd - pageStart, true))
+    {
+        // Every block on these pages is lost with them
+        fprintf(stderr, "Couldn't make the jit's code cache executable\n");
+        CHIPPY_JitFlush(jit);
+        return CHIPPY_JitLeaveToInterpreter(jit, start);
+    }
+
+    ChippyJitBlock* block = &jit->blocks[start];
+    block->code = (ChippyJitCode)(void*)e.code;
+    block->cycles = ops;
+    block->bytes = ops * 2;
+    jit->cacheUsed += e.size;
+    ++jit->blocksCompiled;
+    CHIPPY_JitCover(jit, start, block->bytes, 1);
+    return block;
+}
+
+/** JIT **/
+ChippyJit* CHIPPY_CreateJit()
+{
+    ChippyJit* jit = SDL_calloc(1, sizeof(ChippyJit));
+    if (!jit)
+    {
+        perror("Failed to allocate jit");
+        return NULL;
+    }
+
+    // Checked up front, so a machine on a system that won't allow it stays on the interpreter
+    jit->pageSize = CHIPPY_JitPageSize();
+    jit->cache = CHIPPY_JitAllocCode(CHIPPY_JIT_CACHE_SIZE);
+    if (!jit->cache || !CHIPPY_JitProtectCode(jit->cache, CHIPPY_JIT_CACHE_SIZE, true))
+    {
+        fprintf(stderr, "Couldn't allocate executable memory for the jit\n");
+        if (jit->cache)
+            CHIPPY_JitFreeCode(jit->cache, CHIPPY_JIT_CACHE_SIZE);
+        SDL_free(jit);
+        return NULL;
+    }
+
+    return jit;
+}
+
+void CHIPPY_DestroyJit(ChippyJit* jit)
+{
+    if (!jit) return;
+
+    CHIPPY_JitFreeCode(jit->cache, CHIPPY_JIT_CACHE_SIZE);
+    SDL_free(jit);
+}
+
+uint64_t CHIPPY_JitRun(ChippyJit* jit, ChippyMachine* machine, uint64_t cycles)
+{
+    uint64_t remaining = cycles;
+    while (remaining > 0)
+    {
+        const ChippyJitBlock* block = &jit->blocks[machine->programCounter & CHIPPY_ROM_MEM_MASK];
+        if (block->cycles == 0)
+            block = CHIPPY_JitCompile(jit, machine, machine->programCounter & CHIPPY_ROM_MEM_MASK);
+
+        if (!block->code)
+            break;
+
+        remaining = block->code(machine, remaining);
+    }
+    return cycles - remaining;
+}
+
+void CHIPPY_JitInvalidate(ChippyJit* jit, uint16_t address, uint16_t length)
+{
+    if (length >= CHIPPY_ROM_MEM_SIZE)
+    {
+        CHIPPY_JitFlush(jit);
+        return;
+    }
+
+    // Most writes are to data nothing was compiled from
+    bool covered = false;
+    for (uint16_t i = 0; i < length; ++i)
+        covered |= jit->coverage[(address + i) & CHIPPY_ROM_MEM_MASK] != 0;
+    if (!covered) return;
+
+    // Any block covering a written byte starts at most a block's length before it
+    for (uint16_t i = 0; i < length + CHIPPY_JIT_MAX_BLOCK_BYTES - 1; ++i)
+    {
+        const uint16_t start = (address - (CHIPPY_JIT_MAX_BLOCK_BYTES - 1) + i) & CHIPPY_ROM_MEM_MASK;
+        ChippyJitBlock* block = &jit->blocks[start];
+        if (block->cycles == 0) continue;
+
+        // The ranges overlap if either one starts inside the other, distances wrap within the 4K
+        const bool overlaps = ((address - start) & CHIPPY_ROM_MEM_MASK) < block->bytes ||
+                              ((start - address) & CHIPPY_ROM_MEM_MASK) < length;
+        if (!overlaps) continue;
+
+        // The code stays in the cache until the next flush, nothing jumps to it anymore
+        CHIPPY_JitCover(jit, start, block->bytes, -1);
+        block->code = NULL;
+        block->cycles = 0;
+        block->bytes = 0;
+    }
+}
+
+void CHIPPY_JitFlush(ChippyJit* jit)
+{
+    SDL_memset(jit->blocks, 0, sizeof(jit->blocks));
+    SDL_memset(jit->coverage, 0, sizeof(jit->coverage));
+    jit->cacheUsed = 0;
+    ++jit->flushes;
+}
+
+#else
+
+// No recompiler on this platform, CHIPPY_CreateJit failing keeps machines on the interpreter
+ChippyJit* CHIPPY_CreateJit()
+{
+    return NULL;
+}
+
+void CHIPPY_DestroyJit(ChippyJit* jit)
+{
+}
+
+uint64_t CHIPPY_JitRun(ChippyJit* jit, ChippyMachine* machine, uint64_t cycles)
+{
+    return 0;
+}
+
+void CHIPPY_JitInvalidate(ChippyJit* jit, uint16_t address, uint16_t length)
+{
+}
+
+void CHIPPY_JitFlush(ChippyJit* jit)
+{
+}
+
+#endif
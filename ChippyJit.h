@@ -0,0 +1,62 @@
+#ifndef CHIPPY_JIT_H
+#define CHIPPY_JIT_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Basic Block Recompiler
+// Translates straight line runs of decoded instructions into x86-64 and runs those instead of interpreting.
+// A block ends at any jump, call, return or skip (which it compiles), or just before anything it leaves to the
+// interpreter (DXYN, FX0A, the key skips, CXNN and the memory ops). Writes through FX33/FX55 drop every block
+// covering the bytes written, they're recompiled the next time execution reaches them.
+#if (defined(__x86_64__) || defined(_M_X64)) && !defined(CHIPPY_NO_JIT)
+#define CHIPPY_JIT_SUPPORTED 1
+#else
+#define CHIPPY_JIT_SUPPORTED 0
+#endif
+
+#define CHIPPY_JIT_ARG "--jit"
+#define CHIPPY_JIT_CACHE_SIZE (1024 * 1024) // Executable memory per machine, everything is flushed when it fills
+#define CHIPPY_JIT_MAX_BLOCK_OPS 64          // Longest run compiled into one block
+#define CHIPPY_JIT_MAX_BLOCK_BYTES (CHIPPY_JIT_MAX_BLOCK_OPS * 2)
+#define CHIPPY_JIT_MAX_BLOCK_CODE 8192      // Room a single block can need in the cache
+
+// Runs up to cycles instructions and returns how many are left. Blocks stop early when they run out,
+// so they can be any length whatever's left of a batch.
+typedef uint64_t (*ChippyJitCode)(ChippyMachine* machine, uint64_t cycles);
+
+typedef struct ChippyJitBlock
+{
+    ChippyJitCode code; // NULL with cycles set means the instruction here is left to the interpreter
+    uint16_t cycles;    // Instructions in the block, 0 if nothing has been compiled here
+    uint16_t bytes;     // Rom bytes the block was compiled from
+} ChippyJitBlock;
+
+typedef struct ChippyJit
+{
+    uint8_t* cache; // Executable, and only writable while a block is being emitted into it
+    size_t cacheUsed;
+    size_t pageSize;
+
+    // Indexed by the address a block starts at
+    ChippyJitBlock blocks[CHIPPY_ROM_MEM_SIZE];
+    // How many blocks were compiled from each byte, so writes to plain data can skip looking for blocks
+    uint8_t coverage[CHIPPY_ROM_MEM_SIZE];
+
+    uint64_t blocksCompiled;
+    uint64_t flushes;
+} ChippyJit;
+
+// Returns NULL if the platform has no recompiler or executable memory couldn't be had
+ChippyJit* CHIPPY_CreateJit();
+void CHIPPY_DestroyJit(ChippyJit* jit);
+
+// Runs blocks from the current program counter until the cycles given run out or it reaches an instruction
+// left to the interpreter. Returns how many instructions ran.
+uint64_t CHIPPY_JitRun(ChippyJit* jit, ChippyMachine* machine, uint64_t cycles);
+
+// Drops every block compiled from [address, address + length)
+void CHIPPY_JitInvalidate(ChippyJit* jit, uint16_t address, uint16_t length);
+void CHIPPY_JitFlush(ChippyJit* jit);
+
+#endif
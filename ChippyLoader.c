@@ -0,0 +1,119 @@
+#include "ChippyLoader.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Keeps the queue topped up to maxInFlight reads
+static void CHIPPY_LoaderSubmit(ChippyLoader* loader)
+{
+    while (loader->inFlight < loader->maxInFlight && loader->submitted < loader->pathCount)
+    {
+        const int index = loader->submitted++;
+        if (SDL_LoadFileAsync(loader->paths[index], loader->queue, (void*)(intptr_t)index))
+        {
+            ++loader->inFlight;
+        }
+        else
+        {
+            fprintf(stderr, "Couldn't start reading rom %s: %s\n", loader->paths[index], SDL_GetError());
+            loader->failed[loader->failedTail++] = index;
+        }
+    }
+}
+
+ChippyLoader* CHIPPY_CreateLoader(int maxInFlight)
+{
+    ChippyLoader* loader = SDL_calloc(1, sizeof(ChippyLoader));
+    if (!loader)
+    {
+        perror("Failed to allocate loader");
+        return NULL;
+    }
+
+    loader->queue = SDL_CreateAsyncIOQueue();
+    if (!loader->queue)
+    {
+        fprintf(stderr, "Couldn't create async I/O queue: %s\n", SDL_GetError());
+        SDL_free(loader);
+        return NULL;
+    }
+
+    loader->maxInFlight = maxInFlight > 0 ? maxInFlight : CHIPPY_LOADER_MAX_IN_FLIGHT;
+    return loader;
+}
+
+void CHIPPY_DestroyLoader(ChippyLoader* loader)
+{
+    if (!loader) return;
+
+    // Frees the buffers of any reads nobody collected
+    SDL_DestroyAsyncIOQueue(loader->queue);
+    SDL_free(loader->failed);
+    SDL_free(loader);
+}
+
+bool CHIPPY_LoaderStart(ChippyLoader* loader, const char* const* paths, int count)
+{
+    if (loader->paths)
+    {
+        fprintf(stderr, "Loader has already been started\n");
+        return false;
+    }
+
+    loader->failed = SDL_malloc(sizeof(int) * SDL_max(count, 1));
+    if (!loader->failed)
+    {
+        perror("Failed to allocate loader");
+        return false;
+    }
+
+    loader->paths = paths;
+    loader->pathCount = count;
+    CHIPPY_LoaderSubmit(loader);
+    return true;
+}
+
+bool CHIPPY_LoaderNext(ChippyLoader* loader, ChippyLoadedRom* rom, Sint32 timeoutMS)
+{
+    if (CHIPPY_LoaderIsDone(loader))
+        return false;
+
+    if (loader->failedHead < loader->failedTail)
+    {
+        rom->index = loader->failed[loader->failedHead++];
+        rom->path = loader->paths[rom->index];
+        rom->data = NULL;
+        rom->size = 0;
+        ++loader->returned;
+        return true;
+    }
+
+    SDL_AsyncIOOutcome outcome;
+    if (!SDL_WaitAsyncIOResult(loader->queue, &outcome, timeoutMS))
+        return false;
+
+    --loader->inFlight;
+    rom->index = (int)(intptr_t)outcome.userdata;
+    rom->path = loader->paths[rom->index];
+    rom->data = NULL;
+    rom->size = 0;
+    if (outcome.result == SDL_ASYNCIO_COMPLETE)
+    {
+        rom->data = outcome.buffer;
+        rom->size = (size_t)outcome.bytes_transferred;
+    }
+    else
+    {
+        fprintf(stderr, "Couldn't read rom %s: %s\n", rom->path, SDL_GetError());
+        SDL_free(outcome.buffer);
+    }
+    ++loader->returned;
+
+    CHIPPY_LoaderSubmit(loader);
+    return true;
+}
+
+bool CHIPPY_LoaderIsDone(const ChippyLoader* loader)
+{
+    return loader->returned == loader->pathCount;
+}
@@ -0,0 +1,51 @@
+#ifndef CHIPPY_LOADER_H
+#define CHIPPY_LOADER_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Async Rom Loader
+// Reads a corpus of roms through SDL's async I/O, which uses io_uring where the platform has it and a pool of
+// blocking reader threads everywhere else. Many reads are kept in flight at once and each rom is handed back as
+// soon as it lands, in whatever order the disk finishes them, so the caller can start running early roms while
+// later ones are still being read.
+#define CHIPPY_LOADER_MAX_IN_FLIGHT 64 // Reads outstanding at once, so a huge corpus can't exhaust file handles
+
+typedef struct ChippyLoadedRom
+{
+    int index;        // Position of the path given to CHIPPY_LoaderStart
+    const char* path;
+    uint8_t* data;    // NULL if the rom couldn't be read, otherwise the caller frees it with SDL_free
+    size_t size;
+} ChippyLoadedRom;
+
+typedef struct ChippyLoader
+{
+    SDL_AsyncIOQueue* queue;
+    int maxInFlight;
+
+    const char* const* paths; // Not owned, must outlive the loader
+    int pathCount;
+    int submitted; // Reads started, the paths after these are still waiting their turn
+    int inFlight;
+    int returned;  // Roms handed back through CHIPPY_LoaderNext
+
+    // Reads that couldn't even be started, handed back as failures before waiting on the queue
+    int* failed;
+    int failedHead;
+    int failedTail;
+} ChippyLoader;
+
+// maxInFlight <= 0 uses CHIPPY_LOADER_MAX_IN_FLIGHT
+ChippyLoader* CHIPPY_CreateLoader(int maxInFlight);
+// Blocks until any reads still outstanding have finished, then frees everything they read
+void CHIPPY_DestroyLoader(ChippyLoader* loader);
+
+// Starts reading paths, a loader only takes one batch
+bool CHIPPY_LoaderStart(ChippyLoader* loader, const char* const* paths, int count);
+// Waits up to timeoutMS (-1 forever) for the next rom and starts another read in its place.
+// Returns false on timeout, or once every rom has been handed back.
+bool CHIPPY_LoaderNext(ChippyLoader* loader, ChippyLoadedRom* rom, Sint32 timeoutMS);
+bool CHIPPY_LoaderIsDone(const ChippyLoader* loader);
+
+#endif
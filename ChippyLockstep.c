@@ -0,0 +1,500 @@
+#include "ChippyLockstep.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+// The kernels below loop over every lane slot, in lockstep or not, with a fixed trip count so the compiler turns them
+// into vector instructions. Whatever they leave in lanes that aren't in lockstep is never read back.
+#define CHIPPY_FOR_LANES(lane) for (int lane = 0; lane < CHIPPY_LOCKSTEP_MAX_LANES; ++lane)
+
+SDL_COMPILE_TIME_ASSERT(lockstepLanes, CHIPPY_LOCKSTEP_MAX_LANES <= 32);
+
+/** Lanes **/
+static inline uint16_t CHIPPY_LockstepInstruction(const ChippyMachine* machine, uint16_t address)
+{
+    return (uint16_t)CHIPPY_ReadByte(machine, address) << 8 | CHIPPY_ReadByte(machine, address + 1);
+}
+
+// V and I, all the instructions run lane by lane read or write
+static inline void CHIPPY_LockstepGatherRegisters(ChippyLockstep* lockstep, int lane)
+{
+    const ChippyMachine* machine = lockstep->machines[lane];
+    for (int i = 0; i < 16; ++i)
+        lockstep->variableRegisters[i][lane] = machine->variableRegisters[i];
+    lockstep->indexRegister[lane] = machine->indexRegister;
+}
+
+static inline void CHIPPY_LockstepScatterRegisters(const ChippyLockstep* lockstep, int lane)
+{
+    ChippyMachine* machine = lockstep->machines[lane];
+    for (int i = 0; i < 16; ++i)
+        machine->variableRegisters[i] = lockstep->variableRegisters[i][lane];
+    machine->indexRegister = lockstep->indexRegister[lane];
+}
+
+static void CHIPPY_LockstepGather(ChippyLockstep* lockstep, int lane)
+{
+    const ChippyMachine* machine = lockstep->machines[lane];
+    CHIPPY_LockstepGatherRegisters(lockstep, lane);
+    lockstep->delayExpiry[lane] = machine->delayExpiry;
+    lockstep->soundExpiry[lane] = machine->soundExpiry;
+}
+
+static void CHIPPY_LockstepScatter(const ChippyLockstep* lockstep, int lane)
+{
+    ChippyMachine* machine = lockstep->machines[lane];
+    CHIPPY_LockstepScatterRegisters(lockstep, lane);
+    machine->delayExpiry = lockstep->delayExpiry[lane];
+    machine->soundExpiry = lockstep->soundExpiry[lane];
+    machine->programCounter = lockstep->programCounter;
+    machine->addressStack = lockstep->addressStack;
+    machine->cycles = lockstep->cycles;
+}
+
+static void CHIPPY_LockstepSetActive(ChippyLockstep* lockstep, uint32_t active)
+{
+    lockstep->active = active;
+    lockstep->activeCount = 0;
+    lockstep->lead = 0;
+    for (int lane = CHIPPY_LOCKSTEP_MAX_LANES - 1; lane >= 0; --lane)
+    {
+        const bool isActive = (active >> lane) & 1;
+        lockstep->activeMask[lane] = isActive ? 0xFF : 0;
+        lockstep->activeCount += isActive;
+        if (isActive)
+            lockstep->lead = lane;
+    }
+}
+
+static inline void CHIPPY_LockstepMark(ChippyLockstep* lockstep, uint16_t address, bool divergent)
+{
+    const uint64_t bit = 1ull << (address & 63);
+    uint64_t* word = &lockstep->divergentMemory[address >> 6];
+    *word = divergent ? (*word | bit) : (*word & ~bit);
+}
+
+static inline bool CHIPPY_LockstepIsDivergent(const ChippyLockstep* lockstep, uint16_t address)
+{
+    address &= CHIPPY_ROM_MEM_MASK;
+    return (lockstep->divergentMemory[address >> 6] >> (address & 63)) & 1;
+}
+
+// Marks every address where a lane joining the group holds a different byte to the lead, pages they share are skipped
+static void CHIPPY_LockstepDiffMemory(ChippyLockstep* lockstep, int lane)
+{
+    const ChippyMachine* lead = lockstep->machines[lockstep->lead];
+    const ChippyMachine* machine = lockstep->machines[lane];
+    for (int page = 0; page < CHIPPY_PAGE_COUNT; ++page)
+    {
+        if (lead->pages[page] == machine->pages[page])
+            continue;
+
+        for (int i = 0; i < CHIPPY_PAGE_SIZE; ++i)
+        {
+            if (lead->pages[page]->memory[i] != machine->pages[page]->memory[i])
+                CHIPPY_LockstepMark(lockstep, (uint16_t)(page << CHIPPY_PAGE_SHIFT | i), true);
+        }
+    }
+}
+
+// Whether a lane is at the same point in the rom as the lead, and so can run alongside it
+static bool CHIPPY_LockstepCanJoin(const ChippyLockstep* lockstep, int lane)
+{
+    const ChippyMachine* lead = lockstep->machines[lockstep->lead];
+    const ChippyMachine* machine = lockstep->machines[lane];
+    return machine->cycles == lead->cycles && machine->programCounter == lead->programCounter && machine->quirks == lead->quirks &&
+        SDL_memcmp(&machine->addressStack, &lead->addressStack, sizeof(Cstack)) == 0;
+}
+
+// Keeps the lanes whose key is shared by the most others in lockstep. The rest are handed back their machines just as
+// they were before the instruction the keys were taken from, and run on to the end of the run by themselves.
+static void CHIPPY_LockstepSplit(ChippyLockstep* lockstep, const uint16_t* keys)
+{
+    int keep = lockstep->lead;
+    int keepCount = 0;
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (!lockstep->activeMask[lane])
+            continue;
+
+        int count = 0;
+        for (int other = lane; other < lockstep->laneCount; ++other)
+            count += lockstep->activeMask[other] && keys[other] == keys[lane];
+        if (count > keepCount)
+        {
+            keep = lane;
+            keepCount = count;
+        }
+    }
+
+    uint32_t active = lockstep->active;
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (!lockstep->activeMask[lane] || keys[lane] == keys[keep])
+            continue;
+
+        active &= ~(1u << lane);
+        CHIPPY_LockstepScatter(lockstep, lane);
+        CHIPPY_RunCycles(lockstep->machines[lane], lockstep->targetCycles - lockstep->cycles, NULL);
+    }
+    CHIPPY_LockstepSetActive(lockstep, active);
+}
+
+// Splits the group if an 8 bit value isn't the same in every lane, returns whether it did
+static bool CHIPPY_LockstepSplitOn(ChippyLockstep* lockstep, const uint8_t* values)
+{
+    const uint8_t lead = values[lockstep->lead];
+    uint8_t differ = 0;
+    CHIPPY_FOR_LANES(lane)
+        differ |= (values[lane] ^ lead) & lockstep->activeMask[lane];
+    if (!differ)
+        return false;
+
+    uint16_t keys[CHIPPY_LOCKSTEP_MAX_LANES];
+    CHIPPY_FOR_LANES(lane)
+        keys[lane] = values[lane];
+    CHIPPY_LockstepSplit(lockstep, keys);
+    return true;
+}
+
+// Splits the group if the instruction at the program counter isn't the same in every lane, only checked where a lane's
+// memory has been written differently
+static bool CHIPPY_LockstepSplitOnFetch(ChippyLockstep* lockstep)
+{
+    const uint16_t pc = lockstep->programCounter;
+    if (!CHIPPY_LockstepIsDivergent(lockstep, pc) && !CHIPPY_LockstepIsDivergent(lockstep, pc + 1))
+        return false;
+
+    uint16_t keys[CHIPPY_LOCKSTEP_MAX_LANES] = { 0 };
+    bool differ = false;
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (!lockstep->activeMask[lane])
+            continue;
+
+        keys[lane] = CHIPPY_LockstepInstruction(lockstep->machines[lane], pc);
+        differ |= keys[lane] != keys[lockstep->lead];
+    }
+    if (differ)
+        CHIPPY_LockstepSplit(lockstep, keys);
+    return differ;
+}
+
+/** Instructions **/
+// Runs the instruction on each lane's own machine, for the ones that touch more than the registers
+static void CHIPPY_LockstepExecute(ChippyLockstep* lockstep, uint16_t instruction)
+{
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (!lockstep->activeMask[lane])
+            continue;
+
+        ChippyMachine* machine = lockstep->machines[lane];
+        CHIPPY_LockstepScatterRegisters(lockstep, lane);
+        machine->programCounter = lockstep->programCounter + 2;
+        CHIPPY_Execute(machine, instruction);
+        CHIPPY_LockstepGatherRegisters(lockstep, lane);
+    }
+}
+
+// Re-checks the addresses each lane just wrote, from where its index register was when it wrote them, for whether
+// they still agree
+static void CHIPPY_LockstepMarkWrites(ChippyLockstep* lockstep, const uint16_t* index, uint16_t length)
+{
+    const ChippyMachine* lead = lockstep->machines[lockstep->lead];
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (!lockstep->activeMask[lane] || (lane != lockstep->lead && index[lane] == index[lockstep->lead]))
+            continue;
+
+        for (uint16_t i = 0; i < length; ++i)
+        {
+            const uint16_t address = (index[lane] + i) & CHIPPY_ROM_MEM_MASK;
+            const uint8_t byte = CHIPPY_ReadByte(lead, address);
+            bool divergent = false;
+            for (int other = lockstep->lead + 1; other < lockstep->laneCount && !divergent; ++other)
+                divergent = lockstep->activeMask[other] && CHIPPY_ReadByte(lockstep->machines[other], address) != byte;
+            CHIPPY_LockstepMark(lockstep, address, divergent);
+        }
+    }
+}
+
+// Runs the group up to cycles, stopping early if fewer than two lanes are left in lockstep. Divergence is always found
+// before an instruction runs, so lanes split off have nothing to undo.
+static void CHIPPY_LockstepBatch(ChippyLockstep* lockstep, uint64_t cycles)
+{
+    uint8_t skip[CHIPPY_LOCKSTEP_MAX_LANES];
+    uint8_t result[CHIPPY_LOCKSTEP_MAX_LANES];
+    uint8_t flag[CHIPPY_LOCKSTEP_MAX_LANES];
+    uint16_t index[CHIPPY_LOCKSTEP_MAX_LANES];
+    // Batches end where frames do
+    const uint64_t frame = CHIPPY_CycleFrame(lockstep->cycles);
+
+    while (lockstep->cycles < cycles && lockstep->activeCount > 1)
+    {
+        if (CHIPPY_LockstepSplitOnFetch(lockstep))
+            continue;
+
+        const uint16_t pc = lockstep->programCounter;
+        const ChippyMachine* lead = lockstep->machines[lockstep->lead];
+        // Every lane in lockstep runs the same quirk profile
+        const uint8_t quirks = g_QuirkFlags[lead->quirks];
+        // Copied out so the kernels' stores can't alias it
+        const ChippyOp op = *CHIPPY_DecodedOp(lead, pc);
+        uint8_t* vx = lockstep->variableRegisters[op.x];
+        const uint8_t* vy = lockstep->variableRegisters[op.y];
+        uint16_t next = pc + 2;
+
+        switch (op.handler)
+        {
+        case CHIPPY_OP_NOP:
+            break;
+        case CHIPPY_OP_POP_SUBROUTINE:
+            Cstack_Pop(&lockstep->addressStack, &next);
+            break;
+        case CHIPPY_OP_JUMP_PC:
+            next = op.nnn;
+            break;
+        case CHIPPY_OP_PUSH_SUBROUTINE:
+            if (Cstack_Push(&lockstep->addressStack, next))
+                next = op.nnn;
+            break;
+
+        // Skips, the group splits unless every lane goes the same way
+        case CHIPPY_OP_IF_VXNN:
+            CHIPPY_FOR_LANES(lane) skip[lane] = vx[lane] == op.nn;
+            goto skipInstruction;
+        case CHIPPY_OP_IFNOT_VXNN:
+            CHIPPY_FOR_LANES(lane) skip[lane] = vx[lane] != op.nn;
+            goto skipInstruction;
+        case CHIPPY_OP_IF_VXVY:
+            CHIPPY_FOR_LANES(lane) skip[lane] = vx[lane] == vy[lane];
+            goto skipInstruction;
+        case CHIPPY_OP_IFNOT_VXVY:
+            CHIPPY_FOR_LANES(lane) skip[lane] = vx[lane] != vy[lane];
+            goto skipInstruction;
+        case CHIPPY_OP_SKIP_KEYDOWN:
+        case CHIPPY_OP_SKIP_KEYUP:
+            for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+            {
+                const bool down = lockstep->activeMask[lane] && GET_INPUT_FROM_HEX(lockstep->machines[lane]->inputBitMap, vx[lane]);
+                skip[lane] = down == (op.handler == CHIPPY_OP_SKIP_KEYDOWN);
+            }
+        skipInstruction:
+            if (CHIPPY_LockstepSplitOn(lockstep, skip))
+                continue;
+            next += 2 * skip[lockstep->lead];
+            break;
+
+        case CHIPPY_OP_SET_VX:
+            CHIPPY_FOR_LANES(lane) vx[lane] = op.nn;
+            break;
+        case CHIPPY_OP_ADD_VX:
+            CHIPPY_FOR_LANES(lane) vx[lane] += op.nn;
+            break;
+        // VX and VY are the same row when X is Y, results go through a copy so the compiler can still vectorize
+        case CHIPPY_OP_SET_VXVY:
+            SDL_memmove(vx, vy, CHIPPY_LOCKSTEP_MAX_LANES);
+            break;
+        case CHIPPY_OP_OR_VXVY:
+            CHIPPY_FOR_LANES(lane) result[lane] = vx[lane] | vy[lane];
+            goto resultInstruction;
+        case CHIPPY_OP_AND_VXVY:
+            CHIPPY_FOR_LANES(lane) result[lane] = vx[lane] & vy[lane];
+            goto resultInstruction;
+        case CHIPPY_OP_XOR_VXVY:
+            CHIPPY_FOR_LANES(lane) result[lane] = vx[lane] ^ vy[lane];
+        resultInstruction:
+            SDL_memcpy(vx, result, sizeof(result));
+            if (quirks & CHIPPY_QUIRK_VF_RESET)
+                SDL_memset(lockstep->variableRegisters[0xF], 0, CHIPPY_LOCKSTEP_MAX_LANES);
+            break;
+
+        // Flag setting ops work out both results first and write VF last, so the flag wins when X is F
+        case CHIPPY_OP_ADD_VXVY:
+            CHIPPY_FOR_LANES(lane)
+            {
+                result[lane] = vx[lane] + vy[lane];
+                flag[lane] = result[lane] < vx[lane];
+            }
+            goto flagInstruction;
+        case CHIPPY_OP_SUB_VXVY:
+            CHIPPY_FOR_LANES(lane)
+            {
+                result[lane] = vx[lane] - vy[lane];
+                flag[lane] = vx[lane] >= vy[lane];
+            }
+            goto flagInstruction;
+        case CHIPPY_OP_SUB_VYVX:
+            CHIPPY_FOR_LANES(lane)
+            {
+                result[lane] = vy[lane] - vx[lane];
+                flag[lane] = vy[lane] >= vx[lane];
+            }
+            goto flagInstruction;
+        case CHIPPY_OP_SHR_VYVX:
+        {
+            const uint8_t* shifted = quirks & CHIPPY_QUIRK_SHIFT_VX ? vx : vy;
+            CHIPPY_FOR_LANES(lane)
+            {
+                result[lane] = shifted[lane] >> 1;
+                flag[lane] = shifted[lane] & 1;
+            }
+            goto flagInstruction;
+        }
+        case CHIPPY_OP_SHL_VYVX:
+        {
+            const uint8_t* shifted = quirks & CHIPPY_QUIRK_SHIFT_VX ? vx : vy;
+            CHIPPY_FOR_LANES(lane)
+            {
+                result[lane] = shifted[lane] << 1;
+                flag[lane] = shifted[lane] >> 7;
+            }
+        }
+        flagInstruction:
+            SDL_memcpy(vx, result, sizeof(result));
+            SDL_memcpy(lockstep->variableRegisters[0xF], flag, sizeof(flag));
+            break;
+
+        case CHIPPY_OP_SET_IDXREG:
+            CHIPPY_FOR_LANES(lane) lockstep->indexRegister[lane] = op.nnn;
+            break;
+        case CHIPPY_OP_ADD_IDXREG:
+            SDL_memcpy(result, vx, sizeof(result));
+            CHIPPY_FOR_LANES(lane) lockstep->indexRegister[lane] += result[lane];
+            break;
+        case CHIPPY_OP_JUMP_V0PC:
+        {
+            const uint8_t* offset = lockstep->variableRegisters[quirks & CHIPPY_QUIRK_JUMP_VX ? op.x : 0];
+            if (CHIPPY_LockstepSplitOn(lockstep, offset))
+                continue;
+            next = op.nnn + offset[lockstep->lead];
+            break;
+        }
+
+        case CHIPPY_OP_GET_DELAY:
+            CHIPPY_FOR_LANES(lane) vx[lane] = CHIPPY_TimerLeft(lockstep->delayExpiry[lane], frame);
+            break;
+        case CHIPPY_OP_SET_DELAY:
+            CHIPPY_FOR_LANES(lane) lockstep->delayExpiry[lane] = frame + vx[lane];
+            break;
+        case CHIPPY_OP_SET_SOUND:
+            CHIPPY_FOR_LANES(lane) lockstep->soundExpiry[lane] = frame + vx[lane];
+            break;
+
+        case CHIPPY_OP_GET_KEY:
+            // Waits on every lane or none
+            for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+                skip[lane] = lockstep->activeMask[lane] && GET_ANY_INPUT_DOWN(lockstep->machines[lane]->inputBitMap);
+            if (CHIPPY_LockstepSplitOn(lockstep, skip))
+                continue;
+            if (!skip[lockstep->lead])
+                next = pc;
+            else
+                CHIPPY_LockstepExecute(lockstep, CHIPPY_LockstepInstruction(lead, pc));
+            break;
+
+        // Everything else touches the display, random state or memory each lane keeps for itself
+        default:
+        {
+            // The memory index quirk moves I past what was stored
+            SDL_memcpy(index, lockstep->indexRegister, sizeof(index));
+            CHIPPY_LockstepExecute(lockstep, CHIPPY_LockstepInstruction(lead, pc));
+            if (op.handler == CHIPPY_OP_TO_DECIMAL)
+                CHIPPY_LockstepMarkWrites(lockstep, index, 3);
+            else if (op.handler == CHIPPY_OP_MEMORY_STORE)
+                CHIPPY_LockstepMarkWrites(lockstep, index, op.x + 1);
+            break;
+        }
+        }
+
+        lockstep->programCounter = next;
+        ++lockstep->cycles;
+        lockstep->laneCycles += lockstep->activeCount;
+    }
+}
+
+// Only input needs anything done as a frame starts, the timers count themselves down
+static void CHIPPY_LockstepFrame(ChippyLockstep* lockstep, uint64_t frame)
+{
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (lockstep->activeMask[lane])
+            CHIPPY_LatchInput(lockstep->machines[lane], frame);
+    }
+}
+
+/** Groups **/
+ChippyLockstep* CHIPPY_CreateLockstep(ChippyMachine* const* machines, int count)
+{
+    if (count < 1 || count > CHIPPY_LOCKSTEP_MAX_LANES)
+    {
+        fprintf(stderr, "Lockstep groups take 1 to %d machines, not %d\n", CHIPPY_LOCKSTEP_MAX_LANES, count);
+        return NULL;
+    }
+
+    ChippyLockstep* lockstep = SDL_calloc(1, sizeof(ChippyLockstep));
+    if (!lockstep)
+    {
+        perror("Failed to allocate lockstep group");
+        return NULL;
+    }
+
+    SDL_memcpy(lockstep->machines, machines, sizeof(ChippyMachine*) * count);
+    lockstep->laneCount = count;
+    return lockstep;
+}
+
+void CHIPPY_DestroyLockstep(ChippyLockstep* lockstep)
+{
+    SDL_free(lockstep);
+}
+
+int CHIPPY_LockstepRun(ChippyLockstep* lockstep, uint64_t cycles)
+{
+    // Lanes that split off last run can rejoin if they've come back to where the rest are
+    uint32_t active = 0;
+    for (int lane = 0; lane < lockstep->laneCount; ++lane)
+    {
+        if (!CHIPPY_LockstepCanJoin(lockstep, lane))
+        {
+            CHIPPY_RunCycles(lockstep->machines[lane], cycles, NULL);
+            continue;
+        }
+
+        if (!((lockstep->active >> lane) & 1))
+            CHIPPY_LockstepDiffMemory(lockstep, lane);
+        CHIPPY_LockstepGather(lockstep, lane);
+        active |= 1u << lane;
+    }
+    CHIPPY_LockstepSetActive(lockstep, active);
+
+    const ChippyMachine* lead = lockstep->machines[lockstep->lead];
+    const uint64_t cyclesPerSec = (uint64_t)CHIPPY_CYCLES_PER_SEC;
+    lockstep->programCounter = lead->programCounter;
+    lockstep->addressStack = lead->addressStack;
+    lockstep->cycles = lead->cycles;
+    lockstep->targetCycles = lead->cycles + cycles;
+
+    // Frames are batched the same as CHIPPY_RunCycles does, so timers and input land on the same instructions
+    while (lockstep->cycles < lockstep->targetCycles && lockstep->activeCount > 1)
+    {
+        const uint64_t tick = lockstep->cycles * CHIPPY_TIMER_HZ / cyclesPerSec;
+        const uint64_t nextTickCycle = CHIPPY_FrameStartCycle(tick + 1);
+        CHIPPY_LockstepBatch(lockstep, SDL_min(lockstep->targetCycles, nextTickCycle));
+        if (lockstep->cycles == nextTickCycle)
+            CHIPPY_LockstepFrame(lockstep, tick + 1);
+    }
+
+    for (int lane = lockstep->lead; lane < lockstep->laneCount; ++lane)
+    {
+        if (lockstep->activeMask[lane])
+            CHIPPY_LockstepScatter(lockstep, lane);
+    }
+
+    // A lane left on its own is quicker through the interpreter
+    if (lockstep->cycles < lockstep->targetCycles)
+        CHIPPY_RunCycles(lockstep->machines[lockstep->lead], lockstep->targetCycles - lockstep->cycles, NULL);
+
+    return lockstep->activeCount;
+}
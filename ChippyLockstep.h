@@ -0,0 +1,54 @@
+#ifndef CHIPPY_LOCKSTEP_H
+#define CHIPPY_LOCKSTEP_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Lockstep Execution
+// Runs a group of machines on the same rom, from the same point in it, as lanes of one machine. While every lane
+// agrees on where it is, each instruction is decoded once and applied to all of their registers together, held
+// structure of arrays so the arithmetic compiles to vector instructions. A lane that branches the other way, sees
+// other keys or fetches a different instruction (its memory having been written differently) is split off and runs
+// the rest of the way on its own through the interpreter. Drawing, CXNN and the memory ops run lane by lane through
+// CHIPPY_Execute, as each lane has its own display, random state and memory. Lanes forked from one machine share
+// their memory pages, see CHIPPY_ForkMachine, so a seed or input sweep costs little more than the registers.
+#define CHIPPY_LOCKSTEP_MAX_LANES 32
+
+typedef struct ChippyLockstep
+{
+    ChippyMachine* machines[CHIPPY_LOCKSTEP_MAX_LANES]; // Not owned, kept up to date between runs
+    int laneCount;
+    uint32_t active;                                // Bit per lane still in lockstep
+    int activeCount;
+    uint8_t activeMask[CHIPPY_LOCKSTEP_MAX_LANES];  // 0xFF per lane still in lockstep, for the kernels
+    int lead;                                       // Lowest lane in lockstep, the one instructions are fetched from
+
+    // Shared by every lane in lockstep
+    uint16_t programCounter;
+    Cstack addressStack;
+    uint64_t cycles;
+    uint64_t targetCycles; // Where the current run ends, lanes split off run on to here
+
+    // Per lane
+    uint8_t variableRegisters[16][CHIPPY_LOCKSTEP_MAX_LANES];
+    uint16_t indexRegister[CHIPPY_LOCKSTEP_MAX_LANES];
+    uint64_t delayExpiry[CHIPPY_LOCKSTEP_MAX_LANES]; // As on the machines, the frame each timer reaches 0 in
+    uint64_t soundExpiry[CHIPPY_LOCKSTEP_MAX_LANES];
+
+    // Bit per address whose byte may differ between the lanes in lockstep, instructions fetched from these are
+    // checked lane by lane
+    uint64_t divergentMemory[CHIPPY_ROM_MEM_SIZE / 64];
+
+    uint64_t laneCycles; // Instructions run in lockstep, counted once per lane, to see how well a rom stays together
+} ChippyLockstep;
+
+// Groups up to CHIPPY_LOCKSTEP_MAX_LANES machines, all running the same rom. Lanes start in lockstep if they're at
+// the same instruction count with the same program counter and call stack, the rest run on their own.
+ChippyLockstep* CHIPPY_CreateLockstep(ChippyMachine* const* machines, int count);
+void CHIPPY_DestroyLockstep(ChippyLockstep* lockstep);
+// Runs every lane for cycles instructions, leaving each machine exactly where CHIPPY_RunCycles would have. Between
+// runs lanes can be read and given input, anything else (loading a state, writing memory) needs a new group.
+// Returns how many lanes are still in lockstep.
+int CHIPPY_LockstepRun(ChippyLockstep* lockstep, uint64_t cycles);
+
+#endif
@@ -0,0 +1,225 @@
+#include "ChippyMovie.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CHIPPY_INPUT_LAST_KEY_SHIFT 16
+
+/** Input **/
+ChippyFrameInput CHIPPY_PackInput(uint64_t inputBitMap, uint8_t lastInput)
+{
+    ChippyFrameInput input = 0;
+    for (int key = 0; key < 16; ++key)
+    {
+        input |= (ChippyFrameInput)GET_INPUT_FROM_HEX(inputBitMap, key) << key;
+        if (lastInput && g_InputHexTable[key] == lastInput)
+            input |= (ChippyFrameInput)(key + 1) << CHIPPY_INPUT_LAST_KEY_SHIFT;
+    }
+    return input;
+}
+
+void CHIPPY_UnpackInput(ChippyFrameInput input, uint64_t* inputBitMap, uint8_t* lastInput)
+{
+    *inputBitMap = 0;
+    for (int key = 0; key < 16; ++key)
+        SET_INPUT(*inputBitMap, g_InputHexTable[key], (input >> key) & 1);
+
+    const int lastKey = (input >> CHIPPY_INPUT_LAST_KEY_SHIFT) & 0x1F;
+    *lastInput = lastKey ? g_InputHexTable[(lastKey - 1) & 0xF] : 0;
+}
+
+/** Runs **/
+static bool CHIPPY_MovieAppend(ChippyMovie* movie, ChippyFrameInput input, uint32_t frames)
+{
+    if (movie->runCount && movie->runs[movie->runCount - 1].input == input &&
+        movie->runs[movie->runCount - 1].frames <= UINT32_MAX - frames)
+    {
+        movie->runs[movie->runCount - 1].frames += frames;
+        movie->frameCount += frames;
+        return true;
+    }
+
+    if (movie->runCount == movie->runCapacity)
+    {
+        const int capacity = movie->runCapacity ? movie->runCapacity * 2 : 256;
+        ChippyMovieRun* runs = SDL_realloc(movie->runs, sizeof(ChippyMovieRun) * capacity);
+        if (!runs)
+        {
+            perror("Failed to grow movie");
+            return false;
+        }
+        movie->runs = runs;
+        movie->runCapacity = capacity;
+    }
+
+    movie->runs[movie->runCount++] = (ChippyMovieRun){ frames, input };
+    movie->frameCount += frames;
+    return true;
+}
+
+// Drops every frame from frameCount on
+static void CHIPPY_MovieTruncate(ChippyMovie* movie, uint64_t frameCount)
+{
+    while (movie->runCount && movie->frameCount - movie->runs[movie->runCount - 1].frames >= frameCount)
+        movie->frameCount -= movie->runs[--movie->runCount].frames;
+
+    if (movie->frameCount > frameCount)
+    {
+        movie->runs[movie->runCount - 1].frames -= (uint32_t)(movie->frameCount - frameCount);
+        movie->frameCount = frameCount;
+    }
+
+    movie->cursorRun = 0;
+    movie->cursorFrame = 0;
+}
+
+/** Movies **/
+ChippyMovie* CHIPPY_CreateMovie()
+{
+    ChippyMovie* movie = SDL_calloc(1, sizeof(ChippyMovie));
+    if (!movie)
+        perror("Failed to allocate movie");
+    return movie;
+}
+
+void CHIPPY_DestroyMovie(ChippyMovie* movie)
+{
+    if (!movie) return;
+
+    SDL_free(movie->runs);
+    SDL_free(movie);
+}
+
+ChippyMovie* CHIPPY_LoadMovie(const char* path)
+{
+    SDL_IOStream* file = SDL_IOFromFile(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "Couldn't open movie %s: %s\n", path, SDL_GetError());
+        return NULL;
+    }
+
+    ChippyMovie* movie = CHIPPY_CreateMovie();
+    char magic[4];
+    Uint16 version = 0;
+    Uint32 runCount = 0;
+    bool ok = movie &&
+        SDL_ReadIO(file, magic, sizeof(magic)) == sizeof(magic) && SDL_memcmp(magic, CHIPPY_MOVIE_MAGIC, sizeof(magic)) == 0 &&
+        SDL_ReadU16LE(file, &version) && version == CHIPPY_MOVIE_VERSION &&
+        SDL_ReadU32LE(file, &movie->romHash) &&
+        SDL_ReadU64LE(file, &movie->seed) &&
+        SDL_ReadU32LE(file, &runCount);
+
+    for (Uint32 i = 0; ok && i < runCount; ++i)
+    {
+        Uint32 frames;
+        Uint16 keys;
+        Uint8 lastKey;
+        ok = SDL_ReadU32LE(file, &frames) && SDL_ReadU16LE(file, &keys) && SDL_ReadU8(file, &lastKey) &&
+            CHIPPY_MovieAppend(movie, keys | (ChippyFrameInput)lastKey << CHIPPY_INPUT_LAST_KEY_SHIFT, frames);
+    }
+
+    SDL_CloseIO(file);
+    if (!ok)
+    {
+        fprintf(stderr, "Couldn't read movie %s, it's damaged or from another version\n", path);
+        CHIPPY_DestroyMovie(movie);
+        return NULL;
+    }
+
+    movie->mode = CHIPPY_MOVIE_PLAY;
+    return movie;
+}
+
+int CHIPPY_SaveMovie(const ChippyMovie* movie, const char* path)
+{
+    SDL_IOStream* file = SDL_IOFromFile(path, "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Couldn't create movie %s: %s\n", path, SDL_GetError());
+        return 1;
+    }
+
+    bool ok = SDL_WriteIO(file, CHIPPY_MOVIE_MAGIC, 4) == 4 &&
+        SDL_WriteU16LE(file, CHIPPY_MOVIE_VERSION) &&
+        SDL_WriteU32LE(file, movie->romHash) &&
+        SDL_WriteU64LE(file, movie->seed) &&
+        SDL_WriteU32LE(file, (Uint32)movie->runCount);
+
+    for (int i = 0; ok && i < movie->runCount; ++i)
+    {
+        const ChippyMovieRun* run = &movie->runs[i];
+        ok = SDL_WriteU32LE(file, run->frames) &&
+            SDL_WriteU16LE(file, (Uint16)run->input) &&
+            SDL_WriteU8(file, (Uint8)(run->input >> CHIPPY_INPUT_LAST_KEY_SHIFT));
+    }
+
+    // Closing flushes, so it can fail too
+    if (!SDL_CloseIO(file) || !ok)
+    {
+        fprintf(stderr, "Couldn't write movie %s: %s\n", path, SDL_GetError());
+        return 1;
+    }
+    return 0;
+}
+
+void CHIPPY_MovieRecord(ChippyMovie* movie, ChippyMachine* machine, uint64_t seed)
+{
+    CHIPPY_MovieTruncate(movie, 0);
+    movie->romHash = CHIPPY_BaseHash(machine);
+    movie->seed = seed;
+    movie->mode = CHIPPY_MOVIE_RECORD;
+
+    CHIPPY_SeedRandom(machine, seed);
+    machine->movie = movie;
+}
+
+int CHIPPY_MoviePlay(ChippyMovie* movie, ChippyMachine* machine)
+{
+    if (movie->romHash != CHIPPY_BaseHash(machine))
+    {
+        fprintf(stderr, "Movie was recorded against a different rom\n");
+        return 1;
+    }
+
+    movie->mode = CHIPPY_MOVIE_PLAY;
+    movie->cursorRun = 0;
+    movie->cursorFrame = 0;
+
+    CHIPPY_SeedRandom(machine, movie->seed);
+    machine->movie = movie;
+    return 0;
+}
+
+uint64_t CHIPPY_MovieCycles(const ChippyMovie* movie)
+{
+    // Up to the start of the frame after the last
+    return CHIPPY_FrameStartCycle(movie->frameCount + 1);
+}
+
+ChippyFrameInput CHIPPY_MovieFrame(ChippyMovie* movie, uint64_t frame, ChippyFrameInput input)
+{
+    const uint64_t index = frame - 1;
+    if (movie->mode == CHIPPY_MOVIE_RECORD)
+    {
+        CHIPPY_MovieTruncate(movie, index);
+        // Frames skipped over, by loading a later state, keep whatever was held before
+        if (movie->frameCount < index)
+            CHIPPY_MovieAppend(movie, movie->runCount ? movie->runs[movie->runCount - 1].input : 0, (uint32_t)(index - movie->frameCount));
+        CHIPPY_MovieAppend(movie, input, 1);
+        return input;
+    }
+
+    // Keys are all up once the movie runs out
+    if (index >= movie->frameCount)
+        return 0;
+
+    if (index < movie->cursorFrame)
+    {
+        movie->cursorRun = 0;
+        movie->cursorFrame = 0;
+    }
+    while (index >= movie->cursorFrame + movie->runs[movie->cursorRun].frames)
+        movie->cursorFrame += movie->runs[movie->cursorRun++].frames;
+    return movie->runs[movie->cursorRun].input;
+}
@@ -0,0 +1,73 @@
+#ifndef CHIPPY_MOVIE_H
+#define CHIPPY_MOVIE_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Movies
+// A recording of the input a machine saw, one entry per emulated frame (1/60th of a second of instructions), run
+// length encoded as most frames hold the same keys as the last. Along with the rom and the random seed that's all
+// it takes to reproduce a session exactly, so one recorded from a bug report replays headless as a regression test.
+//
+//  magic "CH8M", u16 version, u32 rom hash (the base memory hash save states use), u64 seed
+//  u32 run count, then per run u32 frames, u16 keys held, u8 last key pressed
+#define CHIPPY_MOVIE_MAGIC "CH8M"
+#define CHIPPY_MOVIE_VERSION 1
+#define CHIPPY_RECORD_ARG "--record"
+#define CHIPPY_REPLAY_ARG "--replay"
+
+// One frame of input. Bit n is set while hex key n is held, bits 16-20 are the last key pressed plus one, or 0
+// if a key has been released since.
+typedef uint32_t ChippyFrameInput;
+
+typedef struct ChippyMovieRun
+{
+    uint32_t frames;
+    ChippyFrameInput input;
+} ChippyMovieRun;
+
+typedef enum ChippyMovieMode
+{
+    CHIPPY_MOVIE_RECORD,
+    CHIPPY_MOVIE_PLAY
+} ChippyMovieMode;
+
+typedef struct ChippyMovie
+{
+    uint32_t romHash;
+    uint64_t seed;
+    ChippyMovieMode mode;
+
+    ChippyMovieRun* runs;
+    int runCount;
+    int runCapacity;
+    uint64_t frameCount;
+
+    // Playback looks frames up in order, so the run holding the last one is kept to start from
+    int cursorRun;
+    uint64_t cursorFrame; // First frame of cursorRun
+} ChippyMovie;
+
+ChippyMovie* CHIPPY_CreateMovie();
+void CHIPPY_DestroyMovie(ChippyMovie* movie);
+// Returns NULL if the file can't be read or isn't a movie
+ChippyMovie* CHIPPY_LoadMovie(const char* path);
+// Returns non-zero if the file can't be written
+int CHIPPY_SaveMovie(const ChippyMovie* movie, const char* path);
+
+// Both take a machine that's just loaded its rom, seed it and attach the movie. Recording throws away whatever the
+// movie held. Playback returns non-zero if the movie was recorded against a different rom.
+void CHIPPY_MovieRecord(ChippyMovie* movie, ChippyMachine* machine, uint64_t seed);
+int CHIPPY_MoviePlay(ChippyMovie* movie, ChippyMachine* machine);
+// Instructions it takes to play the whole movie from the start
+uint64_t CHIPPY_MovieCycles(const ChippyMovie* movie);
+
+// Called by the core as each emulated frame (counted from 1) starts, with the host's input. Returns the input the
+// frame runs with: the host's while recording, which is logged, or the movie's while playing. Recording a frame
+// that's already been recorded, after a rewind or loading a state, drops everything recorded after it.
+ChippyFrameInput CHIPPY_MovieFrame(ChippyMovie* movie, uint64_t frame, ChippyFrameInput input);
+
+ChippyFrameInput CHIPPY_PackInput(uint64_t inputBitMap, uint8_t lastInput);
+void CHIPPY_UnpackInput(ChippyFrameInput input, uint64_t* inputBitMap, uint8_t* lastInput);
+
+#endif
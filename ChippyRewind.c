@@ -0,0 +1,252 @@
+#include "ChippyRewind.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define CHIPPY_REWIND_GAP 2 // Unchanged bytes folded into a literal rather than starting a new one
+#define CHIPPY_REWIND_MIN_ENTRY 8 // Sizes the entry ring, smaller entries just mean older ones get dropped sooner
+
+/** Snapshots **/
+static void CHIPPY_RewindCapture(ChippyRewindFrame* frame, const ChippyMachine* machine)
+{
+    CHIPPY_ReadMemory(machine, 0, frame->romMemory, CHIPPY_ROM_MEM_SIZE);
+    SDL_memcpy(frame->displayPlane, machine->displayPlane, sizeof(frame->displayPlane));
+    frame->addressStack = machine->addressStack;
+    frame->programCounter = machine->programCounter;
+    frame->indexRegister = machine->indexRegister;
+    SDL_memcpy(frame->variableRegisters, machine->variableRegisters, sizeof(frame->variableRegisters));
+    frame->delayTimer = CHIPPY_GetDelayTimer(machine);
+    frame->soundTimer = CHIPPY_GetSoundTimer(machine);
+    frame->inputBitMap = machine->inputBitMap;
+    frame->lastInput = machine->lastInput;
+    frame->paused = machine->paused;
+    frame->cycles = machine->cycles;
+    frame->cycleTimer = machine->cycleTimer;
+    frame->randomState = machine->randomState;
+}
+
+static void CHIPPY_RewindApply(const ChippyRewindFrame* frame, ChippyMachine* machine)
+{
+    CHIPPY_WriteMemory(machine, 0, frame->romMemory, CHIPPY_ROM_MEM_SIZE);
+    SDL_memcpy(machine->displayPlane, frame->displayPlane, sizeof(machine->displayPlane));
+    machine->dirtyRows = CHIPPY_DISPLAY_ALL_ROWS;
+    machine->addressStack = frame->addressStack;
+    machine->programCounter = frame->programCounter;
+    machine->indexRegister = frame->indexRegister;
+    SDL_memcpy(machine->variableRegisters, frame->variableRegisters, sizeof(machine->variableRegisters));
+    machine->paused = frame->paused;
+    machine->cycles = frame->cycles;
+    CHIPPY_SetTimers(machine, frame->delayTimer, frame->soundTimer);
+    machine->cycleTimer = frame->cycleTimer;
+    machine->inputBitMap = frame->inputBitMap;
+    machine->lastInput = frame->lastInput;
+    machine->randomState = frame->randomState;
+}
+
+/** Delta Encoding **/
+// Deltas are a list of (unchanged bytes to skip, literal length, literal XORed bytes), lengths as LEB128 varints.
+// Unchanged bytes after the last literal are implied.
+static uint8_t* CHIPPY_PutVarint(uint8_t* at, uint32_t value)
+{
+    while (value >= 0x80)
+    {
+        *at++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *at++ = (uint8_t)value;
+    return at;
+}
+
+static const uint8_t* CHIPPY_GetVarint(const uint8_t* at, uint32_t* value)
+{
+    uint32_t result = 0;
+    int shift = 0;
+    while (*at & 0x80)
+    {
+        result |= (uint32_t)(*at++ & 0x7F) << shift;
+        shift += 7;
+    }
+    *value = result | (uint32_t)*at++ << shift;
+    return at;
+}
+
+// Encodes head XOR frame into delta and brings head up to frame, returns the size of the delta
+static size_t CHIPPY_RewindEncode(uint8_t* head, const uint8_t* frame, size_t size, uint8_t* delta)
+{
+    uint8_t* at = delta;
+    size_t i = 0;
+    while (i < size)
+    {
+        const size_t skipStart = i;
+        while (i + 8 <= size && SDL_memcmp(head + i, frame + i, 8) == 0)
+            i += 8;
+        while (i < size && head[i] == frame[i])
+            ++i;
+        if (i == size)
+            break;
+
+        const size_t literalStart = i;
+        size_t literalEnd = i + 1;
+        for (size_t j = literalEnd; j < size && j - literalEnd < CHIPPY_REWIND_GAP; ++j)
+        {
+            if (head[j] != frame[j])
+                literalEnd = j + 1;
+        }
+
+        at = CHIPPY_PutVarint(at, (uint32_t)(literalStart - skipStart));
+        at = CHIPPY_PutVarint(at, (uint32_t)(literalEnd - literalStart));
+        for (size_t j = literalStart; j < literalEnd; ++j)
+        {
+            *at++ = head[j] ^ frame[j];
+            head[j] = frame[j];
+        }
+        i = literalEnd;
+    }
+    return (size_t)(at - delta);
+}
+
+static void CHIPPY_RewindDecode(uint8_t* head, const uint8_t* delta, size_t size)
+{
+    const uint8_t* end = delta + size;
+    size_t i = 0;
+    while (delta < end)
+    {
+        uint32_t skip, length;
+        delta = CHIPPY_GetVarint(delta, &skip);
+        delta = CHIPPY_GetVarint(delta, &length);
+        i += skip;
+        for (uint32_t j = 0; j < length; ++j)
+            head[i++] ^= *delta++;
+    }
+}
+
+/** Ring Buffer **/
+static void CHIPPY_RewindDropOldest(ChippyRewind* rewind)
+{
+    rewind->oldest = (rewind->oldest + 1) % rewind->entryCapacity;
+    --rewind->count;
+}
+
+// Finds room for an entry of size bytes, dropping the oldest entries until there is some
+static uint32_t CHIPPY_RewindMakeRoom(ChippyRewind* rewind, size_t size)
+{
+    for (;;)
+    {
+        if (rewind->count == 0)
+            return 0;
+
+        if (rewind->count < rewind->entryCapacity)
+        {
+            const ChippyRewindEntry* first = &rewind->entries[rewind->oldest];
+            const ChippyRewindEntry* last = &rewind->entries[(rewind->oldest + rewind->count - 1) % rewind->entryCapacity];
+            const size_t end = (size_t)last->offset + last->size;
+            if (last->offset >= first->offset)
+            {
+                // Entries run from first to end, there's space after them and before them
+                if (rewind->bufferSize - end >= size)
+                    return (uint32_t)end;
+                if (first->offset >= size)
+                    return 0;
+            }
+            else if (first->offset - end >= size)
+            {
+                // Entries have wrapped around, the only space is the gap between the newest and the oldest
+                return (uint32_t)end;
+            }
+        }
+
+        CHIPPY_RewindDropOldest(rewind);
+    }
+}
+
+ChippyRewind* CHIPPY_CreateRewind(size_t bufferSize, int interval)
+{
+    ChippyRewind* rewind = SDL_calloc(1, sizeof(ChippyRewind));
+    if (!rewind)
+    {
+        perror("Failed to allocate rewind");
+        return NULL;
+    }
+
+    // Always room for at least one worst case delta next to another
+    rewind->bufferSize = SDL_max(bufferSize ? bufferSize : CHIPPY_REWIND_BUFFER_SIZE, sizeof(rewind->delta) * 2);
+    rewind->entryCapacity = (int)(rewind->bufferSize / CHIPPY_REWIND_MIN_ENTRY);
+    rewind->interval = interval > 0 ? interval : CHIPPY_REWIND_INTERVAL;
+    rewind->buffer = SDL_malloc(rewind->bufferSize);
+    rewind->entries = SDL_malloc(sizeof(ChippyRewindEntry) * rewind->entryCapacity);
+    if (!rewind->buffer || !rewind->entries)
+    {
+        perror("Failed to allocate rewind buffer");
+        CHIPPY_DestroyRewind(rewind);
+        return NULL;
+    }
+
+    return rewind;
+}
+
+void CHIPPY_DestroyRewind(ChippyRewind* rewind)
+{
+    if (!rewind) return;
+
+    SDL_free(rewind->entries);
+    SDL_free(rewind->buffer);
+    SDL_free(rewind);
+}
+
+void CHIPPY_RewindClear(ChippyRewind* rewind)
+{
+    rewind->oldest = 0;
+    rewind->count = 0;
+    rewind->untilSnapshot = 0;
+    rewind->ahead = false;
+    // The first snapshot is encoded against zeroes, which also keeps the struct padding zero in both frames
+    SDL_zero(rewind->head);
+    SDL_zero(rewind->frame);
+}
+
+void CHIPPY_RewindRecord(ChippyRewind* rewind, const ChippyMachine* machine)
+{
+    if (rewind->untilSnapshot > 0)
+    {
+        --rewind->untilSnapshot;
+        rewind->ahead = true;
+        return;
+    }
+    rewind->untilSnapshot = rewind->interval - 1;
+    rewind->ahead = false;
+
+    CHIPPY_RewindCapture(&rewind->frame, machine);
+    const size_t size = CHIPPY_RewindEncode((uint8_t*)&rewind->head, (const uint8_t*)&rewind->frame, sizeof(ChippyRewindFrame), rewind->delta);
+
+    const uint32_t offset = CHIPPY_RewindMakeRoom(rewind, size);
+    SDL_memcpy(rewind->buffer + offset, rewind->delta, size);
+
+    ChippyRewindEntry* entry = &rewind->entries[(rewind->oldest + rewind->count) % rewind->entryCapacity];
+    entry->offset = offset;
+    entry->size = (uint32_t)size;
+    ++rewind->count;
+}
+
+bool CHIPPY_RewindStep(ChippyRewind* rewind, ChippyMachine* machine)
+{
+    // The first step back from a machine that's run on only needs to return to the newest snapshot
+    if (!rewind->ahead)
+    {
+        // The oldest entry leads back to a snapshot that's already been dropped
+        if (rewind->count < 2)
+            return false;
+
+        const ChippyRewindEntry* newest = &rewind->entries[(rewind->oldest + rewind->count - 1) % rewind->entryCapacity];
+        CHIPPY_RewindDecode((uint8_t*)&rewind->head, rewind->buffer + newest->offset, newest->size);
+        --rewind->count;
+    }
+    else if (rewind->count == 0)
+    {
+        return false;
+    }
+
+    CHIPPY_RewindApply(&rewind->head, machine);
+    rewind->untilSnapshot = rewind->interval - 1;
+    rewind->ahead = false;
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef CHIPPY_REWIND_H
+#define CHIPPY_REWIND_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Rewind
+// Records a snapshot every few frames into a fixed size ring buffer. Each entry is the XOR of a snapshot with the
+// one before it, with runs of zeroes (everything that didn't change) squeezed out, so a frame that only ticked a
+// timer and ran a dozen instructions costs tens of bytes. The newest snapshot is kept whole, stepping back just
+// XORs the newest entry into it and drops the entry, so each step costs the same however much history there is.
+// Once the buffer fills the oldest entries are dropped to make room.
+#define CHIPPY_REWIND_BUFFER_SIZE (4 * 1024 * 1024)
+#define CHIPPY_REWIND_INTERVAL 4 // Frames between snapshots
+#define CHIPPY_REWIND_KEY SDL_SCANCODE_BACKSPACE // Held to rewind
+
+// Everything a snapshot restores, held flat so consecutive snapshots can be XORed byte for byte. The input latched
+// for the frame comes back with the rest, the host's pending input is left alone.
+typedef struct ChippyRewindFrame
+{
+    uint8_t romMemory[CHIPPY_ROM_MEM_SIZE];
+    uint64_t displayPlane[CHIPPY_DISPLAY_HEIGHT];
+    Cstack addressStack;
+    uint16_t programCounter;
+    uint16_t indexRegister;
+    uint8_t variableRegisters[16];
+    uint8_t delayTimer;
+    uint8_t soundTimer;
+    uint64_t inputBitMap;
+    uint8_t lastInput;
+    bool paused;
+    uint64_t cycles;
+    double cycleTimer;
+    uint64_t randomState;
+} ChippyRewindFrame;
+
+typedef struct ChippyRewindEntry
+{
+    uint32_t offset; // Into the ring buffer, entries never wrap around its end
+    uint32_t size;
+} ChippyRewindEntry;
+
+typedef struct ChippyRewind
+{
+    uint8_t* buffer;
+    size_t bufferSize;
+    ChippyRewindEntry* entries;
+    int entryCapacity;
+    int oldest;
+    int count;
+
+    int interval;
+    int untilSnapshot; // Frames left to record before the next snapshot
+    bool ahead;        // The machine has run on since the newest snapshot
+
+    ChippyRewindFrame head;  // The newest snapshot, entries walk back from here
+    ChippyRewindFrame frame; // Scratch for the snapshot being taken
+    uint8_t delta[sizeof(ChippyRewindFrame) + 16]; // Scratch for encoding, big enough for every byte changing
+} ChippyRewind;
+
+// bufferSize 0 uses CHIPPY_REWIND_BUFFER_SIZE, interval 0 uses CHIPPY_REWIND_INTERVAL
+ChippyRewind* CHIPPY_CreateRewind(size_t bufferSize, int interval);
+void CHIPPY_DestroyRewind(ChippyRewind* rewind);
+// Forgets all history, needed whenever the machine is reset or loads another rom
+void CHIPPY_RewindClear(ChippyRewind* rewind);
+
+// Call once per frame after CHIPPY_Update, takes a snapshot every interval frames
+void CHIPPY_RewindRecord(ChippyRewind* rewind, const ChippyMachine* machine);
+// Puts the machine back to the previous snapshot, in place of a CHIPPY_Update. Returns false once there's no
+// history left. Recording afterwards carries on from the restored snapshot, the history after it is gone.
+bool CHIPPY_RewindStep(ChippyRewind* rewind, ChippyMachine* machine);
+
+#endif
@@ -0,0 +1,304 @@
+#include "ChippyRunner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/** Work Queues **/
+static bool CHIPPY_QueueInit(ChippyRunnerQueue* queue, int capacity)
+{
+    queue->lock = 0;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->capacity = capacity;
+    queue->items = SDL_malloc(sizeof(int) * capacity);
+    return queue->items != NULL;
+}
+
+// An instance is only ever in one queue at a time, so a queue sized to the instance count can't overflow
+static void CHIPPY_QueuePush(ChippyRunnerQueue* queue, int item)
+{
+    SDL_LockSpinlock(&queue->lock);
+    queue->items[queue->tail % queue->capacity] = item;
+    ++queue->tail;
+    SDL_UnlockSpinlock(&queue->lock);
+}
+
+// Owner side, LIFO keeps the instance it just ran hot in cache
+static bool CHIPPY_QueuePop(ChippyRunnerQueue* queue, int* item)
+{
+    bool found = false;
+    SDL_LockSpinlock(&queue->lock);
+    if (queue->tail > queue->head)
+    {
+        --queue->tail;
+        *item = queue->items[queue->tail % queue->capacity];
+        found = true;
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+    return found;
+}
+
+// Thief side, FIFO takes the instance the owner is least likely to touch next
+static bool CHIPPY_QueueSteal(ChippyRunnerQueue* queue, int* item)
+{
+    bool found = false;
+    SDL_LockSpinlock(&queue->lock);
+    if (queue->tail > queue->head)
+    {
+        *item = queue->items[queue->head % queue->capacity];
+        ++queue->head;
+        found = true;
+    }
+    SDL_UnlockSpinlock(&queue->lock);
+    return found;
+}
+
+static bool CHIPPY_RunnerFindWork(ChippyRunnerWorker* worker, int* item)
+{
+    if (CHIPPY_QueuePop(&worker->queue, item))
+        return true;
+
+    // Start with the next worker along so thieves spread out instead of all hitting worker 0
+    ChippyRunner* runner = worker->runner;
+    for (int i = 1; i < runner->workerCount; ++i)
+    {
+        ChippyRunnerWorker* victim = &runner->workers[(worker->index + i) % runner->workerCount];
+        if (CHIPPY_QueueSteal(&victim->queue, item))
+            return true;
+    }
+    return false;
+}
+
+/** Workers **/
+static int SDLCALL CHIPPY_RunnerWorker(void* data)
+{
+    ChippyRunnerWorker* worker = data;
+    ChippyRunner* runner = worker->runner;
+
+    int idleSpins = 0;
+    while (SDL_GetAtomicInt(&runner->remaining) > 0)
+    {
+        int item;
+        if (!CHIPPY_RunnerFindWork(worker, &item))
+        {
+            // Everything left is being run by other workers, or is a reserved instance still loading. A slice
+            // requeued elsewhere turns up quickly, past that there's no telling how long it'll be so stop spinning.
+            if (idleSpins < CHIPPY_RUNNER_IDLE_SPINS)
+            {
+                ++idleSpins;
+                SDL_CPUPauseInstruction();
+                SDL_DelayNS(0);
+            }
+            else
+            {
+                SDL_DelayNS(CHIPPY_RUNNER_IDLE_SLEEP_NS);
+            }
+            continue;
+        }
+        idleSpins = 0;
+
+        ChippyRunnerInstance* instance = &runner->instances[item];
+        const uint64_t slice = SDL_min(runner->sliceCycles, instance->cycles - instance->cyclesRun);
+        ChippyRunStats stats;
+        CHIPPY_RunCycles(instance->machine, slice, &stats);
+        instance->cyclesRun += slice;
+        instance->idleCycles += stats.idleCycles;
+        SDL_AddAtomicInt(&instance->slicesDone, 1);
+
+        if (instance->cyclesRun < instance->cycles)
+            CHIPPY_QueuePush(&worker->queue, item);
+        else
+            SDL_AddAtomicInt(&runner->remaining, -1);
+    }
+
+    return 0;
+}
+
+/** Runner **/
+ChippyRunner* CHIPPY_CreateRunner(int workerCount, uint64_t sliceCycles)
+{
+    ChippyRunner* runner = SDL_calloc(1, sizeof(ChippyRunner));
+    if (!runner)
+    {
+        perror("Failed to allocate runner");
+        return NULL;
+    }
+
+    runner->workerCount = workerCount > 0 ? workerCount : SDL_max(SDL_GetNumLogicalCPUCores(), 1);
+    runner->sliceCycles = sliceCycles > 0 ? sliceCycles : CHIPPY_RUNNER_SLICE_CYCLES;
+    return runner;
+}
+
+void CHIPPY_DestroyRunner(ChippyRunner* runner)
+{
+    if (!runner) return;
+
+    if (runner->workers)
+    {
+        for (int i = 0; i < runner->workerCount; ++i)
+        {
+            SDL_WaitThread(runner->workers[i].thread, NULL);
+            SDL_free(runner->workers[i].queue.items);
+        }
+        SDL_free(runner->workers);
+    }
+
+    SDL_free(runner->instances);
+    SDL_free(runner);
+}
+
+static bool CHIPPY_RunnerGrow(ChippyRunner* runner, int capacity)
+{
+    if (capacity <= runner->instanceCapacity)
+        return true;
+
+    ChippyRunnerInstance* instances = SDL_realloc(runner->instances, sizeof(ChippyRunnerInstance) * capacity);
+    if (!instances)
+    {
+        perror("Failed to grow runner instances");
+        return false;
+    }
+    runner->instances = instances;
+    runner->instanceCapacity = capacity;
+    return true;
+}
+
+int CHIPPY_RunnerAdd(ChippyRunner* runner, ChippyMachine* machine, uint64_t cycles)
+{
+    const bool started = runner->workers != NULL;
+    if (started && runner->reserved == 0)
+    {
+        fprintf(stderr, "Can't add instances to a runner that has already started without reserving them\n");
+        return -1;
+    }
+
+    // Reserved instances already have room, and the array can't move once workers are reading it
+    if (runner->reserved > 0)
+        --runner->reserved;
+    else if (runner->instanceCount == runner->instanceCapacity && !CHIPPY_RunnerGrow(runner, runner->instanceCapacity ? runner->instanceCapacity * 2 : 16))
+        return -1;
+
+    const int index = runner->instanceCount;
+    ChippyRunnerInstance* instance = &runner->instances[index];
+    instance->machine = machine;
+    instance->cycles = cycles;
+    instance->cyclesRun = 0;
+    instance->idleCycles = 0;
+    SDL_SetAtomicInt(&instance->slicesDone, 0);
+    ++runner->instanceCount;
+
+    // The queue lock publishes the instance to whichever worker picks it up
+    if (started)
+    {
+        if (cycles > 0)
+            CHIPPY_QueuePush(&runner->workers[index % runner->workerCount].queue, index);
+        else
+            SDL_AddAtomicInt(&runner->remaining, -1);
+    }
+    return index;
+}
+
+bool CHIPPY_RunnerReserve(ChippyRunner* runner, int count)
+{
+    if (runner->workers)
+    {
+        fprintf(stderr, "Can't reserve instances on a runner that has already started\n");
+        return false;
+    }
+
+    if (!CHIPPY_RunnerGrow(runner, runner->instanceCount + runner->reserved + count))
+        return false;
+    runner->reserved += count;
+    return true;
+}
+
+void CHIPPY_RunnerCancelReserved(ChippyRunner* runner, int count)
+{
+    count = SDL_min(count, runner->reserved);
+    runner->reserved -= count;
+    if (runner->workers)
+        SDL_AddAtomicInt(&runner->remaining, -count);
+}
+
+bool CHIPPY_RunnerStart(ChippyRunner* runner)
+{
+    runner->workers = SDL_calloc(runner->workerCount, sizeof(ChippyRunnerWorker));
+    if (!runner->workers)
+    {
+        perror("Failed to allocate runner workers");
+        return false;
+    }
+
+    // Deal instances out round robin, stealing evens things out from there
+    int remaining = 0;
+    for (int i = 0; i < runner->workerCount; ++i)
+    {
+        ChippyRunnerWorker* worker = &runner->workers[i];
+        worker->runner = runner;
+        worker->index = i;
+        if (!CHIPPY_QueueInit(&worker->queue, SDL_max(runner->instanceCount + runner->reserved, 1)))
+        {
+            perror("Failed to allocate runner queue");
+            return false;
+        }
+    }
+    for (int i = 0; i < runner->instanceCount; ++i)
+    {
+        if (runner->instances[i].cycles == 0) continue;
+
+        CHIPPY_QueuePush(&runner->workers[i % runner->workerCount].queue, i);
+        ++remaining;
+    }
+    SDL_SetAtomicInt(&runner->remaining, remaining + runner->reserved);
+
+    runner->startTime = SDL_GetTicksNS();
+    for (int i = 0; i < runner->workerCount; ++i)
+    {
+        char name[32];
+        SDL_snprintf(name, sizeof(name), "ChippyWorker%d", i);
+        runner->workers[i].thread = SDL_CreateThread(CHIPPY_RunnerWorker, name, &runner->workers[i]);
+        if (!runner->workers[i].thread)
+        {
+            // Workers that did start will still drain every queue through stealing
+            SDL_Log("Couldn't create runner worker %d: %s", i, SDL_GetError());
+            if (i == 0) return false;
+        }
+    }
+
+    return true;
+}
+
+void CHIPPY_RunnerWait(ChippyRunner* runner, ChippyRunStats* stats)
+{
+    for (int i = 0; i < runner->workerCount; ++i)
+    {
+        SDL_WaitThread(runner->workers[i].thread, NULL);
+        runner->workers[i].thread = NULL;
+    }
+
+    if (stats)
+    {
+        stats->cycles = 0;
+        stats->idleCycles = 0;
+        for (int i = 0; i < runner->instanceCount; ++i)
+        {
+            stats->cycles += runner->instances[i].cyclesRun;
+            stats->idleCycles += runner->instances[i].idleCycles;
+        }
+
+        stats->elapsedNS = SDL_GetTicksNS() - runner->startTime;
+        stats->cyclesPerSec = stats->elapsedNS ? (double)stats->cycles * SDL_NS_PER_SECOND / stats->elapsedNS : 0.0;
+    }
+}
+
+bool CHIPPY_RunnerIsDone(ChippyRunner* runner)
+{
+    return SDL_GetAtomicInt(&runner->remaining) == 0;
+}
+
+uint64_t CHIPPY_RunnerGetProgress(ChippyRunner* runner, int instance)
+{
+    ChippyRunnerInstance* inst = &runner->instances[instance];
+    const uint64_t slices = (uint64_t)SDL_GetAtomicInt(&inst->slicesDone);
+    return SDL_min(slices * runner->sliceCycles, inst->cycles);
+}
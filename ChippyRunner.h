@@ -0,0 +1,76 @@
+#ifndef CHIPPY_RUNNER_H
+#define CHIPPY_RUNNER_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Parallel Instance Runner
+// Schedules many machines across worker threads. Each worker owns a queue of instances and runs them
+// in time slices of CHIPPY_RUNNER_SLICE_CYCLES, re-queueing unfinished ones. Idle workers steal from
+// the front of other workers' queues, so a few long running roms can't leave cores sitting idle.
+#define CHIPPY_RUNNER_SLICE_CYCLES 100000ull
+#define CHIPPY_RUNNER_IDLE_SPINS 64              // Failed looks for work before an idle worker starts sleeping
+#define CHIPPY_RUNNER_IDLE_SLEEP_NS (100 * 1000) // How long it sleeps between looks from then on
+#define CHIPPY_RUNNER_ARG "--parallel"
+
+typedef struct ChippyRunnerInstance
+{
+    ChippyMachine* machine; // Not owned by the runner
+    uint64_t cycles;        // Cycles to run in total
+    uint64_t cyclesRun;     // Only touched by the worker currently holding the instance
+    uint64_t idleCycles;    // Of those, skipped over in idle loops
+    SDL_AtomicInt slicesDone; // Published progress, safe to read from any thread
+} ChippyRunnerInstance;
+
+typedef struct ChippyRunnerQueue
+{
+    SDL_SpinLock lock;
+    int* items; // Ring of instance indices
+    int head;   // Thieves take from here
+    int tail;   // Owner pushes and pops here
+    int capacity;
+} ChippyRunnerQueue;
+
+typedef struct ChippyRunnerWorker
+{
+    struct ChippyRunner* runner;
+    SDL_Thread* thread;
+    ChippyRunnerQueue queue;
+    int index;
+} ChippyRunnerWorker;
+
+typedef struct ChippyRunner
+{
+    ChippyRunnerInstance* instances;
+    int instanceCount;
+    int instanceCapacity;
+    int reserved; // Instances promised through CHIPPY_RunnerReserve that haven't been added yet
+
+    ChippyRunnerWorker* workers;
+    int workerCount;
+
+    uint64_t sliceCycles;
+    SDL_AtomicInt remaining; // Instances that haven't finished yet, reserved ones included
+    uint64_t startTime;
+} ChippyRunner;
+
+// workerCount <= 0 uses one worker per logical core, sliceCycles == 0 uses CHIPPY_RUNNER_SLICE_CYCLES
+ChippyRunner* CHIPPY_CreateRunner(int workerCount, uint64_t sliceCycles);
+void CHIPPY_DestroyRunner(ChippyRunner* runner);
+
+// Returns the instance index, or -1 on failure. Once the runner has started only reserved instances can be added,
+// from one thread at a time.
+int CHIPPY_RunnerAdd(ChippyRunner* runner, ChippyMachine* machine, uint64_t cycles);
+// Promises count more instances before starting, so they can be added while the others are already running
+// (e.g. as their roms finish loading). The runner isn't done until each has been added or cancelled.
+bool CHIPPY_RunnerReserve(ChippyRunner* runner, int count);
+void CHIPPY_RunnerCancelReserved(ChippyRunner* runner, int count);
+
+bool CHIPPY_RunnerStart(ChippyRunner* runner);
+void CHIPPY_RunnerWait(ChippyRunner* runner, ChippyRunStats* stats);
+bool CHIPPY_RunnerIsDone(ChippyRunner* runner);
+
+// Cycles completed so far by an instance, can be polled while the runner is going
+uint64_t CHIPPY_RunnerGetProgress(ChippyRunner* runner, int instance);
+
+#endif
@@ -0,0 +1,282 @@
+#include "ChippyState.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+/** Writing **/
+typedef struct ChippyStateWriter
+{
+    uint8_t* at;
+    uint8_t* end;
+    bool overflow;
+} ChippyStateWriter;
+
+static inline void CHIPPY_PutBytes(ChippyStateWriter* writer, const void* data, size_t size)
+{
+    if ((size_t)(writer->end - writer->at) < size)
+    {
+        writer->overflow = true;
+        return;
+    }
+    SDL_memcpy(writer->at, data, size);
+    writer->at += size;
+}
+
+static inline void CHIPPY_PutU8(ChippyStateWriter* writer, uint8_t value)
+{
+    CHIPPY_PutBytes(writer, &value, 1);
+}
+
+static inline void CHIPPY_PutU16(ChippyStateWriter* writer, uint16_t value)
+{
+    const uint8_t bytes[2] = { (uint8_t)value, (uint8_t)(value >> 8) };
+    CHIPPY_PutBytes(writer, bytes, sizeof(bytes));
+}
+
+static inline void CHIPPY_PutU32(ChippyStateWriter* writer, uint32_t value)
+{
+    CHIPPY_PutU16(writer, (uint16_t)value);
+    CHIPPY_PutU16(writer, (uint16_t)(value >> 16));
+}
+
+static inline void CHIPPY_PutU64(ChippyStateWriter* writer, uint64_t value)
+{
+    CHIPPY_PutU32(writer, (uint32_t)value);
+    CHIPPY_PutU32(writer, (uint32_t)(value >> 32));
+}
+
+static inline void CHIPPY_PutF64(ChippyStateWriter* writer, double value)
+{
+    uint64_t bits;
+    SDL_memcpy(&bits, &value, sizeof(bits));
+    CHIPPY_PutU64(writer, bits);
+}
+
+/** Reading **/
+typedef struct ChippyStateReader
+{
+    const uint8_t* at;
+    const uint8_t* end;
+    bool underflow;
+} ChippyStateReader;
+
+// Reads past the end give zeroes and set underflow, which is checked once everything has been read
+static inline const uint8_t* CHIPPY_GetBytes(ChippyStateReader* reader, size_t size)
+{
+    static const uint8_t zeroes[8] = { 0 };
+    if ((size_t)(reader->end - reader->at) < size)
+    {
+        reader->underflow = true;
+        reader->at = reader->end;
+        return zeroes;
+    }
+    const uint8_t* bytes = reader->at;
+    reader->at += size;
+    return bytes;
+}
+
+static inline uint8_t CHIPPY_GetU8(ChippyStateReader* reader)
+{
+    return CHIPPY_GetBytes(reader, 1)[0];
+}
+
+static inline uint16_t CHIPPY_GetU16(ChippyStateReader* reader)
+{
+    const uint8_t* bytes = CHIPPY_GetBytes(reader, 2);
+    return (uint16_t)(bytes[0] | bytes[1] << 8);
+}
+
+static inline uint32_t CHIPPY_GetU32(ChippyStateReader* reader)
+{
+    const uint32_t low = CHIPPY_GetU16(reader);
+    return low | (uint32_t)CHIPPY_GetU16(reader) << 16;
+}
+
+static inline uint64_t CHIPPY_GetU64(ChippyStateReader* reader)
+{
+    const uint64_t low = CHIPPY_GetU32(reader);
+    return low | (uint64_t)CHIPPY_GetU32(reader) << 32;
+}
+
+static inline double CHIPPY_GetF64(ChippyStateReader* reader)
+{
+    const uint64_t bits = CHIPPY_GetU64(reader);
+    double value;
+    SDL_memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/** Save States **/
+size_t CHIPPY_SaveState(const ChippyMachine* machine, uint8_t* buffer, size_t size)
+{
+    ChippyStateWriter writer = { buffer, buffer + size, false };
+
+    CHIPPY_PutBytes(&writer, CHIPPY_STATE_MAGIC, 4);
+    CHIPPY_PutU16(&writer, CHIPPY_STATE_VERSION);
+    CHIPPY_PutU32(&writer, CHIPPY_BaseHash(machine));
+
+    CHIPPY_PutU16(&writer, machine->programCounter);
+    CHIPPY_PutU16(&writer, machine->indexRegister);
+    CHIPPY_PutBytes(&writer, machine->variableRegisters, sizeof(machine->variableRegisters));
+    CHIPPY_PutU8(&writer, machine->addressStack.count);
+    CHIPPY_PutU8(&writer, machine->addressStack.errors);
+    for (int i = 0; i < machine->addressStack.count; ++i)
+        CHIPPY_PutU16(&writer, machine->addressStack.items[i]);
+
+    CHIPPY_PutU8(&writer, CHIPPY_GetDelayTimer(machine));
+    CHIPPY_PutU8(&writer, CHIPPY_GetSoundTimer(machine));
+    CHIPPY_PutU64(&writer, machine->cycles);
+    CHIPPY_PutF64(&writer, machine->cycleTimer);
+    CHIPPY_PutU8(&writer, machine->paused);
+    CHIPPY_PutU64(&writer, machine->randomState);
+    CHIPPY_PutU64(&writer, machine->inputBitMap);
+    CHIPPY_PutU8(&writer, machine->lastInput);
+
+    // Blank rows are left out
+    uint32_t drawnRows = 0;
+    for (int y = 0; y < CHIPPY_DISPLAY_HEIGHT; ++y)
+        drawnRows |= (uint32_t)(machine->displayPlane[y] != 0) << y;
+    CHIPPY_PutU32(&writer, drawnRows);
+    for (int y = 0; y < CHIPPY_DISPLAY_HEIGHT; ++y)
+    {
+        if (drawnRows & (1u << y))
+            CHIPPY_PutU64(&writer, machine->displayPlane[y]);
+    }
+
+    // Runs of memory that differ from the loaded image, the count is filled in once they've all been written
+    uint8_t* runCount = writer.at;
+    CHIPPY_PutU16(&writer, 0);
+    uint16_t runs = 0;
+    uint8_t memory[CHIPPY_ROM_MEM_SIZE];
+    CHIPPY_ReadMemory(machine, 0, memory, CHIPPY_ROM_MEM_SIZE);
+    const uint8_t* base = machine->baseMemory->memory;
+    int address = 0;
+    while (address < CHIPPY_ROM_MEM_SIZE)
+    {
+        // Most of memory is untouched, skip over it a word at a time
+        if (address + 8 <= CHIPPY_ROM_MEM_SIZE && SDL_memcmp(memory + address, base + address, 8) == 0)
+        {
+            address += 8;
+            continue;
+        }
+        if (memory[address] == base[address])
+        {
+            ++address;
+            continue;
+        }
+
+        const int start = address;
+        int end = address + 1;
+        for (int i = end; i < CHIPPY_ROM_MEM_SIZE && i - end < CHIPPY_STATE_RUN_GAP; ++i)
+        {
+            if (memory[i] != base[i])
+                end = i + 1;
+        }
+
+        CHIPPY_PutU16(&writer, (uint16_t)start);
+        CHIPPY_PutU16(&writer, (uint16_t)(end - start));
+        CHIPPY_PutBytes(&writer, memory + start, end - start);
+        ++runs;
+        address = end;
+    }
+
+    if (writer.overflow)
+        return 0;
+
+    runCount[0] = (uint8_t)runs;
+    runCount[1] = (uint8_t)(runs >> 8);
+    return (size_t)(writer.at - buffer);
+}
+
+int CHIPPY_LoadState(ChippyMachine* machine, const uint8_t* buffer, size_t size)
+{
+    ChippyStateReader reader = { buffer, buffer + size, false };
+
+    if (SDL_memcmp(CHIPPY_GetBytes(&reader, 4), CHIPPY_STATE_MAGIC, 4) != 0 || reader.underflow)
+    {
+        fprintf(stderr, "Not a save state\n");
+        return 1;
+    }
+    const uint16_t version = CHIPPY_GetU16(&reader);
+    if (version != CHIPPY_STATE_VERSION)
+    {
+        fprintf(stderr, "Save state is version %d, only version %d can be loaded\n", version, CHIPPY_STATE_VERSION);
+        return 1;
+    }
+    if (CHIPPY_GetU32(&reader) != CHIPPY_BaseHash(machine))
+    {
+        fprintf(stderr, "Save state was taken from a different rom\n");
+        return 1;
+    }
+
+    // Everything is read and checked before any of it is applied
+    const uint16_t programCounter = CHIPPY_GetU16(&reader);
+    const uint16_t indexRegister = CHIPPY_GetU16(&reader);
+    const uint8_t* variableRegisters = CHIPPY_GetBytes(&reader, sizeof(machine->variableRegisters));
+    Cstack addressStack;
+    addressStack.count = CHIPPY_GetU8(&reader);
+    addressStack.errors = CHIPPY_GetU8(&reader);
+    if (addressStack.count > CSTACK_CAPACITY)
+    {
+        fprintf(stderr, "Save state has %d stack entries, only %d fit\n", addressStack.count, CSTACK_CAPACITY);
+        return 1;
+    }
+    for (int i = 0; i < addressStack.count; ++i)
+        addressStack.items[i] = CHIPPY_GetU16(&reader);
+
+    const uint8_t delayTimer = CHIPPY_GetU8(&reader);
+    const uint8_t soundTimer = CHIPPY_GetU8(&reader);
+    const uint64_t cycles = CHIPPY_GetU64(&reader);
+    const double cycleTimer = CHIPPY_GetF64(&reader);
+    const bool paused = CHIPPY_GetU8(&reader) != 0;
+    const uint64_t randomState = CHIPPY_GetU64(&reader);
+    const uint64_t inputBitMap = CHIPPY_GetU64(&reader);
+    const uint8_t lastInput = CHIPPY_GetU8(&reader);
+
+    uint64_t displayPlane[CHIPPY_DISPLAY_HEIGHT];
+    const uint32_t drawnRows = CHIPPY_GetU32(&reader);
+    for (int y = 0; y < CHIPPY_DISPLAY_HEIGHT; ++y)
+        displayPlane[y] = (drawnRows & (1u << y)) ? CHIPPY_GetU64(&reader) : 0;
+
+    uint8_t memory[CHIPPY_ROM_MEM_SIZE];
+    SDL_memcpy(memory, machine->baseMemory->memory, sizeof(memory));
+    const uint16_t runs = CHIPPY_GetU16(&reader);
+    for (int i = 0; i < runs && !reader.underflow; ++i)
+    {
+        const uint16_t start = CHIPPY_GetU16(&reader);
+        const uint16_t length = CHIPPY_GetU16(&reader);
+        if (start + length > CHIPPY_ROM_MEM_SIZE)
+        {
+            fprintf(stderr, "Save state writes past the end of memory\n");
+            return 1;
+        }
+        SDL_memcpy(memory + start, CHIPPY_GetBytes(&reader, length), reader.underflow ? 0 : length);
+    }
+
+    if (reader.underflow)
+    {
+        fprintf(stderr, "Save state is truncated\n");
+        return 1;
+    }
+
+    // Memory goes first, it's the only part that can fail
+    if (CHIPPY_WriteMemory(machine, 0, memory, CHIPPY_ROM_MEM_SIZE) != 0)
+        return 1;
+
+    machine->programCounter = programCounter;
+    machine->indexRegister = indexRegister;
+    SDL_memcpy(machine->variableRegisters, variableRegisters, sizeof(machine->variableRegisters));
+    machine->addressStack = addressStack;
+    machine->cycles = cycles;
+    CHIPPY_SetTimers(machine, delayTimer, soundTimer);
+    machine->cycleTimer = cycleTimer;
+    machine->paused = paused;
+    machine->randomState = randomState;
+    machine->inputBitMap = inputBitMap;
+    machine->lastInput = lastInput;
+
+    SDL_memcpy(machine->displayPlane, displayPlane, sizeof(displayPlane));
+    machine->dirtyRows = CHIPPY_DISPLAY_ALL_ROWS;
+
+    return 0;
+}
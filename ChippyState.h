@@ -0,0 +1,32 @@
+#ifndef CHIPPY_STATE_H
+#define CHIPPY_STATE_H
+
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+// Save States
+// A versioned binary snapshot of everything a rom can see: registers, call stack, timers, input, display and memory.
+// Memory is stored as runs of bytes that differ from the image the rom loaded with, and only display rows with
+// something drawn on them are stored, so a typical snapshot is a few hundred bytes. All values are little endian.
+//
+//  magic "CH8S", u16 version, u32 base memory hash
+//  u16 pc, u16 index, u8 V0-VF, u8 stack count, u8 stack errors, u16 stack[count]
+//  u8 delay, u8 sound, u64 cycles, f64 cycle timer, u8 paused, u64 random state
+//  u64 input bitmap, u8 last input
+//  u32 drawn rows, u64 row for each bit set
+//  u16 run count, then per run u16 address, u16 length, u8 bytes[length]
+#define CHIPPY_STATE_MAGIC "CH8S"
+#define CHIPPY_STATE_VERSION 2
+#define CHIPPY_STATE_RUN_GAP 4 // Unchanged bytes folded into a run rather than starting a new one, a run costs 4 bytes
+
+// Enough for any snapshot. Runs are at least CHIPPY_STATE_RUN_GAP + 1 bytes apart, so their headers can't add up
+// to more than the memory they cover.
+#define CHIPPY_STATE_MAX_SIZE (128 + CSTACK_CAPACITY * 2 + CHIPPY_DISPLAY_HEIGHT * 8 + CHIPPY_ROM_MEM_SIZE * 2)
+
+// Writes a snapshot of the machine into buffer, returns the bytes used or 0 if it didn't fit
+size_t CHIPPY_SaveState(const ChippyMachine* machine, uint8_t* buffer, size_t size);
+// Restores a snapshot taken from a machine running the same rom. Returns non-zero, leaving the machine untouched,
+// if the snapshot is damaged, from another version or from another rom.
+int CHIPPY_LoadState(ChippyMachine* machine, const uint8_t* buffer, size_t size);
+
+#endif
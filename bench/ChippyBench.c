@@ -0,0 +1,395 @@
+/*
+    Interpreter benchmark. Runs every rom in roms/ plus a few synthetic opcode mixes headlessly for a fixed
+    number of instructions, once per dispatch mode, and prints one JSON object per run on stdout:
+
+    ChippyBench [--cycles N] [--repeat N] [--roms DIR] [--dispatch call|threaded|jit|all] [--lanes N] [rom...]
+
+    --lanes also runs N forks of each case in lockstep (see ChippyLockstep.h), splitting the instructions between
+    them, and reports the time per instruction across every lane.
+*/
+#include <SDL3/SDL.h>
+#include <stdio.h>
+
+#include "Chippy.h"
+#include "ChippyJit.h"
+#include "ChippyLockstep.h"
+
+#define BENCH_DEFAULT_CYCLES 10000000ull
+#define BENCH_DEFAULT_REPEAT 3
+#define BENCH_DEFAULT_ROM_DIR "roms"
+#define BENCH_SEED 1 // Every run is reseeded so CXNN does the same thing each time
+
+typedef struct BenchCase
+{
+    char name[64];
+    const char* kind; // "rom" or "mix"
+    uint8_t* data;
+    size_t size;
+    uint64_t families[16]; // Instructions executed per leading nibble
+} BenchCase;
+
+static const char* g_DefaultRoms[] =
+{
+    "1-ibm-logo.ch8",
+    "2-bc-test.ch8",
+    "3-corax+.ch8",
+    "3-test-opcode.ch8",
+    "4-flags.ch8",
+    "5-quirks.ch8",
+    "6-keypad.ch8"
+};
+
+static const char* g_DispatchNames[CHIPPY_DISPATCH_COUNT] =
+{
+    [CHIPPY_DISPATCH_CALL] = "call",
+    [CHIPPY_DISPATCH_THREADED] = "threaded",
+    [CHIPPY_DISPATCH_JIT] = "jit"
+};
+
+/** Synthetic Mixes **/
+// Each one loops forever from 0x200, so any instruction count can be run
+
+// Register arithmetic and the flag setting 8XY_ ops
+static const uint16_t g_MixAlu[] =
+{
+    0x6001, 0x610F, 0x6233, 0x8014, 0x8125, 0x8216, 0x821E, 0x8017,
+    0x8121, 0x8232, 0x8303, 0x7305, 0x8300, 0x1200
+};
+
+// Every skip, taken and not taken
+static const uint16_t g_MixBranch[] =
+{
+    0x7001, 0x3080, 0x1208, 0x6000, 0x4133, 0x7101, 0x5010, 0x9010, 0x7201, 0x1200
+};
+
+// Nested calls and returns
+static const uint16_t g_MixCall[] =
+{
+    0x2208, 0x220C, 0x1200, 0x0000, 0x7001, 0x00EE, 0x2208, 0x00EE
+};
+
+// BCD, register stores and loads, all into 0x300 so the code itself is never rewritten
+static const uint16_t g_MixMemory[] =
+{
+    0xA300, 0x6080, 0xF033, 0xF355, 0xF365, 0xF01E, 0x7001, 0x1200
+};
+
+// Font sprites drawn across the screen, cleared every pass
+static const uint16_t g_MixDraw[] =
+{
+    0x00E0, 0x6000, 0x6100, 0xF029, 0xD015, 0x7004, 0x7101, 0x3040, 0x1206, 0x1200
+};
+
+// Spinning on the delay timer, the way most roms wait out a frame
+static const uint16_t g_MixTimer[] =
+{
+    0x6010, 0xF015, 0xF018, 0xF007, 0x3000, 0x1206, 0x1200
+};
+
+/** Allocation Counting **/
+// Everything in the core allocates through SDL, so swapping in counting wrappers catches all of it
+static SDL_AtomicInt g_Allocations;
+static SDL_malloc_func g_Malloc;
+static SDL_calloc_func g_Calloc;
+static SDL_realloc_func g_Realloc;
+static SDL_free_func g_Free;
+
+static void* SDLCALL CountingMalloc(size_t size)
+{
+    SDL_AddAtomicInt(&g_Allocations, 1);
+    return g_Malloc(size);
+}
+
+static void* SDLCALL CountingCalloc(size_t count, size_t size)
+{
+    SDL_AddAtomicInt(&g_Allocations, 1);
+    return g_Calloc(count, size);
+}
+
+static void* SDLCALL CountingRealloc(void* memory, size_t size)
+{
+    SDL_AddAtomicInt(&g_Allocations, 1);
+    return g_Realloc(memory, size);
+}
+
+static void SDLCALL CountingFree(void* memory)
+{
+    g_Free(memory);
+}
+
+/** Cases **/
+static bool AddMix(BenchCase* bench, const char* name, const uint16_t* instructions, size_t count)
+{
+    SDL_snprintf(bench->name, sizeof(bench->name), "mix-%s", name);
+    bench->kind = "mix";
+    bench->size = count * 2;
+    bench->data = SDL_malloc(bench->size);
+    if (!bench->data)
+        return false;
+
+    // Roms are big endian
+    for (size_t i = 0; i < count; ++i)
+    {
+        bench->data[i * 2] = (uint8_t)(instructions[i] >> 8);
+        bench->data[i * 2 + 1] = (uint8_t)instructions[i];
+    }
+    return true;
+}
+
+static bool AddRom(BenchCase* bench, const char* path)
+{
+    // Name it after the file, without the directory or extension
+    const char* name = SDL_strrchr(path, '/');
+    const char* backslash = SDL_strrchr(path, '\\');
+    if (!name || (backslash && backslash > name))
+        name = backslash;
+    name = name ? name + 1 : path;
+    SDL_strlcpy(bench->name, name, sizeof(bench->name));
+    char* extension = SDL_strrchr(bench->name, '.');
+    if (extension)
+        *extension = '\0';
+
+    bench->kind = "rom";
+    bench->data = SDL_LoadFile(path, &bench->size);
+    if (!bench->data)
+    {
+        SDL_Log("Couldn't load %s: %s", path, SDL_GetError());
+        return false;
+    }
+    return true;
+}
+
+static ChippyMachine* CreateBenchMachine(const BenchCase* bench, ChippyDispatch dispatch)
+{
+    ChippyMachine* machine = CHIPPY_CreateMachine();
+    if (!machine)
+        return NULL;
+
+    if (!CHIPPY_SetDispatch(machine, dispatch) || CHIPPY_LoadRomFromMemory(machine, bench->data, bench->size) != 0)
+    {
+        CHIPPY_DestroyMachine(machine);
+        return NULL;
+    }
+    return machine;
+}
+
+/* Steps one instruction at a time, untimed, to see what the timed runs are actually executing. */
+static void CountFamilies(BenchCase* bench, uint64_t cycles)
+{
+    SDL_zeroa(bench->families);
+
+    ChippyMachine* machine = CreateBenchMachine(bench, CHIPPY_DISPATCH_THREADED);
+    if (!machine)
+        return;
+
+    CHIPPY_SeedRandom(machine, BENCH_SEED);
+    for (uint64_t i = 0; i < cycles; ++i)
+    {
+        ++bench->families[CHIPPY_ReadByte(machine, machine->programCounter) >> 4];
+        CHIPPY_RunCycles(machine, 1, NULL);
+    }
+    CHIPPY_DestroyMachine(machine);
+}
+
+/* Prints a JSON string, escaping the few characters a file name could trip over. */
+static void PrintJsonString(const char* text)
+{
+    putchar('"');
+    for (; *text; ++text)
+    {
+        if (*text == '"' || *text == '\\')
+            putchar('\\');
+        putchar(*text);
+    }
+    putchar('"');
+}
+
+static bool RunBench(const BenchCase* bench, ChippyDispatch dispatch, uint64_t cycles, int repeat)
+{
+    const int setupStart = SDL_GetAtomicInt(&g_Allocations);
+    ChippyMachine* machine = CreateBenchMachine(bench, dispatch);
+    const int setupAllocations = SDL_GetAtomicInt(&g_Allocations) - setupStart;
+    if (!machine)
+    {
+        SDL_Log("Couldn't set up %s with %s dispatch", bench->name, g_DispatchNames[dispatch]);
+        return false;
+    }
+
+    uint64_t bestNS = UINT64_MAX;
+    uint64_t idleCycles = 0; // The same every run
+    int runAllocations = 0;
+    for (int i = 0; i < repeat; ++i)
+    {
+        // Every run starts from the same state, the jit (if any) is flushed by the reset and recompiles as it goes
+        if (i > 0)
+        {
+            CHIPPY_ResetMachine(machine);
+            CHIPPY_LoadRomFromMemory(machine, bench->data, bench->size);
+        }
+        CHIPPY_SeedRandom(machine, BENCH_SEED);
+
+        ChippyRunStats stats;
+        const int runStart = SDL_GetAtomicInt(&g_Allocations);
+        CHIPPY_RunCycles(machine, cycles, &stats);
+        runAllocations = SDL_max(runAllocations, SDL_GetAtomicInt(&g_Allocations) - runStart);
+        bestNS = SDL_min(bestNS, stats.elapsedNS);
+        idleCycles = stats.idleCycles;
+    }
+    CHIPPY_DestroyMachine(machine);
+
+    printf("{\"name\":");
+    PrintJsonString(bench->name);
+    printf(",\"kind\":\"%s\",\"dispatch\":\"%s\",\"cycles\":%" SDL_PRIu64 ",\"repeat\":%d", bench->kind, g_DispatchNames[dispatch], cycles, repeat);
+    printf(",\"elapsedNS\":%" SDL_PRIu64 ",\"nsPerInstruction\":%.4f,\"instructionsPerSec\":%.0f",
+        bestNS, (double)bestNS / cycles, bestNS ? (double)cycles * SDL_NS_PER_SECOND / bestNS : 0.0);
+    printf(",\"idleCycles\":%" SDL_PRIu64 ",\"setupAllocations\":%d,\"runAllocations\":%d,\"families\":{", idleCycles, setupAllocations, runAllocations);
+    for (int i = 0; i < 16; ++i)
+        printf("%s\"%X\":%" SDL_PRIu64, i ? "," : "", i, bench->families[i]);
+    printf("}}\n");
+    fflush(stdout);
+    return true;
+}
+
+static bool RunLockstepBench(const BenchCase* bench, int laneCount, uint64_t cycles, int repeat)
+{
+    const uint64_t laneCycles = cycles / laneCount;
+    ChippyMachine* lanes[CHIPPY_LOCKSTEP_MAX_LANES] = { NULL };
+    ChippyMachine* prototype = CreateBenchMachine(bench, CHIPPY_DISPATCH_THREADED);
+    bool ok = prototype != NULL;
+
+    uint64_t bestNS = UINT64_MAX;
+    int inLockstep = 0;
+    uint64_t lockstepCycles = 0;
+    for (int i = 0; i < repeat && ok; ++i)
+    {
+        // Fresh forks every run, all sharing the prototype's untouched memory. Each is seeded apart and every other
+        // one holds a key, as in a real seed and input sweep, so lanes split wherever CXNN or the keypad steer them.
+        for (int lane = 0; lane < laneCount && ok; ++lane)
+        {
+            CHIPPY_DestroyMachine(lanes[lane]);
+            lanes[lane] = CHIPPY_ForkMachine(prototype);
+            ok = lanes[lane] != NULL;
+            if (ok)
+            {
+                CHIPPY_SeedRandom(lanes[lane], BENCH_SEED + lane);
+                CHIPPY_InputEvent(lanes[lane], g_InputHexTable[(lane / 2) & 0xF], lane % 2);
+            }
+        }
+        ChippyLockstep* lockstep = ok ? CHIPPY_CreateLockstep(lanes, laneCount) : NULL;
+        if (!lockstep)
+        {
+            ok = false;
+            break;
+        }
+
+        const uint64_t startTime = SDL_GetTicksNS();
+        inLockstep = CHIPPY_LockstepRun(lockstep, laneCycles);
+        bestNS = SDL_min(bestNS, SDL_GetTicksNS() - startTime);
+        lockstepCycles = lockstep->laneCycles;
+        CHIPPY_DestroyLockstep(lockstep);
+    }
+
+    for (int lane = 0; lane < laneCount; ++lane)
+        CHIPPY_DestroyMachine(lanes[lane]);
+    CHIPPY_DestroyMachine(prototype);
+    if (!ok)
+    {
+        SDL_Log("Couldn't set up %s with %d lanes in lockstep", bench->name, laneCount);
+        return false;
+    }
+
+    const uint64_t total = laneCycles * laneCount;
+    printf("{\"name\":");
+    PrintJsonString(bench->name);
+    printf(",\"kind\":\"%s\",\"dispatch\":\"lockstep\",\"lanes\":%d,\"cycles\":%" SDL_PRIu64 ",\"repeat\":%d", bench->kind, laneCount, total, repeat);
+    printf(",\"elapsedNS\":%" SDL_PRIu64 ",\"nsPerInstruction\":%.4f,\"instructionsPerSec\":%.0f",
+        bestNS, (double)bestNS / total, bestNS ? (double)total * SDL_NS_PER_SECOND / bestNS : 0.0);
+    printf(",\"lanesInLockstep\":%d,\"lockstepShare\":%.4f}\n", inLockstep, total ? (double)lockstepCycles / total : 0.0);
+    fflush(stdout);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    SDL_GetOriginalMemoryFunctions(&g_Malloc, &g_Calloc, &g_Realloc, &g_Free);
+    SDL_SetMemoryFunctions(CountingMalloc, CountingCalloc, CountingRealloc, CountingFree);
+
+    uint64_t cycles = BENCH_DEFAULT_CYCLES;
+    int repeat = BENCH_DEFAULT_REPEAT;
+    const char* romDir = BENCH_DEFAULT_ROM_DIR;
+    int firstDispatch = 0;
+    int lastDispatch = CHIPPY_DISPATCH_COUNT - 1;
+    int laneCount = 0;
+    int romArgs = 0;
+    char** roms = SDL_calloc(argc, sizeof(char*));
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            cycles = SDL_strtoull(argv[++i], NULL, 10);
+        else if (SDL_strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+        {
+            // SDL_max evaluates its arguments twice
+            repeat = SDL_atoi(argv[++i]);
+            repeat = SDL_max(repeat, 1);
+        }
+        else if (SDL_strcmp(argv[i], "--roms") == 0 && i + 1 < argc)
+            romDir = argv[++i];
+        else if (SDL_strcmp(argv[i], "--dispatch") == 0 && i + 1 < argc)
+        {
+            const char* name = argv[++i];
+            for (int d = 0; d < CHIPPY_DISPATCH_COUNT; ++d)
+            {
+                if (SDL_strcmp(name, g_DispatchNames[d]) == 0)
+                    firstDispatch = lastDispatch = d;
+            }
+        }
+        else if (SDL_strcmp(argv[i], "--lanes") == 0 && i + 1 < argc)
+        {
+            laneCount = SDL_atoi(argv[++i]);
+            laneCount = SDL_clamp(laneCount, 1, CHIPPY_LOCKSTEP_MAX_LANES);
+        }
+        else
+            roms[romArgs++] = argv[i];
+    }
+
+    // The default roms plus any given on the command line, then the mixes
+    const int defaultRoms = romArgs ? 0 : SDL_arraysize(g_DefaultRoms);
+    const int caseCapacity = defaultRoms + romArgs + 6;
+    BenchCase* cases = SDL_calloc(caseCapacity, sizeof(BenchCase));
+    int caseCount = 0;
+    for (int i = 0; i < defaultRoms; ++i)
+    {
+        char path[512];
+        SDL_snprintf(path, sizeof(path), "%s/%s", romDir, g_DefaultRoms[i]);
+        caseCount += AddRom(&cases[caseCount], path);
+    }
+    for (int i = 0; i < romArgs; ++i)
+        caseCount += AddRom(&cases[caseCount], roms[i]);
+    caseCount += AddMix(&cases[caseCount], "alu", g_MixAlu, SDL_arraysize(g_MixAlu));
+    caseCount += AddMix(&cases[caseCount], "branch", g_MixBranch, SDL_arraysize(g_MixBranch));
+    caseCount += AddMix(&cases[caseCount], "call", g_MixCall, SDL_arraysize(g_MixCall));
+    caseCount += AddMix(&cases[caseCount], "memory", g_MixMemory, SDL_arraysize(g_MixMemory));
+    caseCount += AddMix(&cases[caseCount], "draw", g_MixDraw, SDL_arraysize(g_MixDraw));
+    caseCount += AddMix(&cases[caseCount], "timer", g_MixTimer, SDL_arraysize(g_MixTimer));
+
+    int failures = 0;
+    for (int i = 0; i < caseCount; ++i)
+    {
+        CountFamilies(&cases[i], cycles);
+        for (int d = firstDispatch; d <= lastDispatch; ++d)
+        {
+            // No recompiler on this platform, nothing to measure
+            if (d == CHIPPY_DISPATCH_JIT && !CHIPPY_JIT_SUPPORTED)
+                continue;
+            failures += !RunBench(&cases[i], d, cycles, repeat);
+        }
+        if (laneCount)
+            failures += !RunLockstepBench(&cases[i], laneCount, cycles, repeat);
+        SDL_free(cases[i].data);
+    }
+
+    SDL_free(cases);
+    SDL_free(roms);
+    return failures ? 1 : 0;
+}
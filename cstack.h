@@ -1,26 +1,62 @@
 #ifndef CSTACK_H
 #define CSTACK_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-typedef struct Node Node;
+// Fixed size call stack, embedded directly in whatever owns it so push and pop never allocate.
+// The original COSMAC VIP interpreter had room for 12 return addresses, most later ones have 16.
+// Define CSTACK_CAPACITY before including (or on the command line) for roms that nest deeper.
+#ifndef CSTACK_CAPACITY
+#define CSTACK_CAPACITY 16
+#endif
 
-struct Node
-{
-	Node* next;
-	uint16_t val;
-};
+// Sticky error flags, set when a push or pop is refused and kept until Cstack_Init
+#define CSTACK_OVERFLOW 0x1
+#define CSTACK_UNDERFLOW 0x2
 
 typedef struct Cstack
 {
-	Node* top;
-	size_t count;
+	uint16_t items[CSTACK_CAPACITY];
+	uint8_t count;
+	uint8_t errors;
 } Cstack;
 
-Cstack* Cstack_Init();
-void Cstack_Clean(Cstack* stack);
-void Cstack_Push(Cstack* stack, uint16_t value);
-uint16_t Cstack_Pop(Cstack* stack);
-uint16_t Cstack_Peek(Cstack* stack);
+// Empties the stack and clears its errors. Nothing is heap allocated, so there's nothing to free.
+void Cstack_Init(Cstack* stack);
+
+// Push and pop are on the hot path of every 2NNN/00EE, so they live here to be inlined
+static inline bool Cstack_Push(Cstack* stack, uint16_t value)
+{
+	if (stack->count >= CSTACK_CAPACITY)
+	{
+		stack->errors |= CSTACK_OVERFLOW;
+		return false;
+	}
+
+	stack->items[stack->count++] = value;
+	return true;
+}
+
+static inline bool Cstack_Pop(Cstack* stack, uint16_t* value)
+{
+	if (stack->count == 0)
+	{
+		stack->errors |= CSTACK_UNDERFLOW;
+		return false;
+	}
+
+	*value = stack->items[--stack->count];
+	return true;
+}
+
+static inline bool Cstack_Peek(const Cstack* stack, uint16_t* value)
+{
+	if (stack->count == 0)
+		return false;
+
+	*value = stack->items[stack->count - 1];
+	return true;
+}
 
-#endif 
\ No newline at end of file
+#endif 
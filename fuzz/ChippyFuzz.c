@@ -0,0 +1,543 @@
+/*
+    Coverage guided fuzzer. Mutates roms and the keys held each frame, runs them against the core in process and
+    keeps any that take an edge (from one instruction's address to the next) not seen before, so the corpus works its
+    way further into each rom and the interpreter. Needs the core built with CHIPPY_COVERAGE=1, which the ChippyFuzz
+    target does, along with the sanitizers so an out of bounds access is caught where it happens.
+
+    ChippyFuzz [--runs N] [--seconds N] [--cycles N] [--seed N] [--jit] [--out DIR] [rom or dir...]
+
+    Every run resets the machine in place, without allocating, and runs the rom for --cycles instructions. With --jit
+    each run is repeated on the recompiler, which has to leave the machine in the same state. Anything that crashes or
+    disagrees is written to DIR as <kind>-<hash>.ch8 along with a movie of its keys, replayed with
+    CHIPPY08 --replay <kind>-<hash>.ch8m <kind>-<hash>.ch8
+*/
+#include <SDL3/SDL.h>
+#include <signal.h>
+#include <stdio.h>
+
+#include "Chippy.h"
+#include "ChippyJit.h"
+#include "ChippyMovie.h"
+
+#if !CHIPPY_COVERAGE
+#error ChippyFuzz needs the core built with CHIPPY_COVERAGE=1
+#endif
+
+// The sanitizers exit without raising a signal, they call back instead
+#if defined(__SANITIZE_ADDRESS__)
+#define FUZZ_SANITIZED 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define FUZZ_SANITIZED 1
+#endif
+#endif
+#ifdef FUZZ_SANITIZED
+#include <sanitizer/common_interface_defs.h>
+#endif
+
+#define FUZZ_DEFAULT_ROM_DIR "roms"
+#define FUZZ_DEFAULT_OUT_DIR "."
+#define FUZZ_DEFAULT_CYCLES 500ull // A little over 40 frames, short runs get through far more cases
+#define FUZZ_DEFAULT_SECONDS 10
+#define FUZZ_MACHINE_SEED 1 // CXNN has to do the same thing every time a case runs
+#define FUZZ_MAX_FRAMES 256 // Longest run a case holds input for, --cycles is capped to fit
+#define FUZZ_MAX_CORPUS 4096
+#define FUZZ_MAX_MUTATIONS 4 // Stacked on a case per run
+#define FUZZ_MAX_COPY 32 // Bytes copied from one case into another
+#define FUZZ_MAX_SLIDE 64 // Bytes moved along by inserting instructions, the ones pushed off the end are dropped
+#define FUZZ_RUNS_PER_PARENT 64 // Mutations of one corpus case run back to back before picking another
+#define FUZZ_STATUS_INTERVAL_NS SDL_NS_PER_SECOND
+
+typedef struct FuzzCase
+{
+    uint16_t romSize;
+    uint8_t rom[CHIPPY_ROM_MAX_SIZE];
+    ChippyFrameInput input[FUZZ_MAX_FRAMES]; // input[f] is latched as frame f + 1 starts, frame 0 starts with none
+} FuzzCase;
+
+typedef struct Fuzzer
+{
+    ChippyMachine* machine;
+    ChippyMachine* jitMachine; // Only with --jit
+    uint64_t cycles;
+    int frames; // Frames a run starts
+    uint64_t random;
+    const char* outDir;
+
+    FuzzCase** corpus;
+    int corpusCount;
+    FuzzCase current; // The case running now, saved if it crashes
+
+    uint8_t coverage[CHIPPY_COVERAGE_MAP_SIZE];
+    uint8_t seen[CHIPPY_COVERAGE_MAP_SIZE]; // Hit count buckets any run has reached, one bit each
+    int edges;
+
+    uint64_t runs;
+    int findings;
+} Fuzzer;
+
+static Fuzzer* g_Fuzzer; // For the crash handlers
+
+// Hit counts in AFL style buckets, so a loop going round a few more times is new but every extra time round isn't
+static uint8_t g_Buckets[256];
+
+/** Allocation Counting **/
+// Everything in the core allocates through SDL, so swapping in counting wrappers catches all of it
+static SDL_AtomicInt g_Allocations;
+static SDL_malloc_func g_Malloc;
+static SDL_calloc_func g_Calloc;
+static SDL_realloc_func g_Realloc;
+static SDL_free_func g_Free;
+
+static void* SDLCALL CountingMalloc(size_t size)
+{
+    SDL_AddAtomicInt(&g_Allocations, 1);
+    return g_Malloc(size);
+}
+
+static void* SDLCALL CountingCalloc(size_t count, size_t size)
+{
+    SDL_AddAtomicInt(&g_Allocations, 1);
+    return g_Calloc(count, size);
+}
+
+static void* SDLCALL CountingRealloc(void* memory, size_t size)
+{
+    SDL_AddAtomicInt(&g_Allocations, 1);
+    return g_Realloc(memory, size);
+}
+
+static void SDLCALL CountingFree(void* memory)
+{
+    g_Free(memory);
+}
+
+/** Random **/
+static uint64_t FuzzRandom(Fuzzer* fuzzer)
+{
+    // xorshift64*
+    fuzzer->random ^= fuzzer->random >> 12;
+    fuzzer->random ^= fuzzer->random << 25;
+    fuzzer->random ^= fuzzer->random >> 27;
+    return fuzzer->random * 2685821657736338717ull;
+}
+
+static uint32_t FuzzBelow(Fuzzer* fuzzer, uint32_t bound)
+{
+    return (uint32_t)((FuzzRandom(fuzzer) >> 32) * bound >> 32);
+}
+
+/** Running **/
+static void RunCase(Fuzzer* fuzzer, ChippyMachine* machine, const FuzzCase* fuzzCase)
+{
+    CHIPPY_ResetWithRom(machine, fuzzCase->rom, fuzzCase->romSize);
+    CHIPPY_SeedRandom(machine, FUZZ_MACHINE_SEED);
+    for (int frame = 0; machine->cycles < fuzzer->cycles; ++frame)
+    {
+        // Keys are mostly held for many frames at a time
+        if (frame == 0 || fuzzCase->input[frame] != fuzzCase->input[frame - 1])
+            CHIPPY_UnpackInput(fuzzCase->input[frame], &machine->pendingInputBitMap, &machine->pendingLastInput);
+        const uint64_t frameEnd = SDL_min(fuzzer->cycles, CHIPPY_FrameStartCycle(frame + 1));
+        CHIPPY_RunCycles(machine, frameEnd - machine->cycles, NULL);
+    }
+}
+
+// Everything a rom can observe or leave behind, the jit's code cache and the cycle timers aside
+static bool SameState(const ChippyMachine* a, const ChippyMachine* b)
+{
+    return a->programCounter == b->programCounter &&
+        a->indexRegister == b->indexRegister &&
+        SDL_memcmp(a->variableRegisters, b->variableRegisters, sizeof(a->variableRegisters)) == 0 &&
+        a->addressStack.count == b->addressStack.count &&
+        a->addressStack.errors == b->addressStack.errors &&
+        SDL_memcmp(a->addressStack.items, b->addressStack.items, sizeof(a->addressStack.items[0]) * a->addressStack.count) == 0 &&
+        CHIPPY_GetDelayTimer(a) == CHIPPY_GetDelayTimer(b) &&
+        CHIPPY_GetSoundTimer(a) == CHIPPY_GetSoundTimer(b) &&
+        a->cycles == b->cycles &&
+        CHIPPY_SameMemory(a, b) &&
+        SDL_memcmp(a->displayPlane, b->displayPlane, sizeof(a->displayPlane)) == 0;
+}
+
+// Folds the run's hit counts into what's been seen and clears them for the next run, returns true if anything's new
+static bool TakeCoverage(Fuzzer* fuzzer)
+{
+    bool found = false;
+    for (int i = 0; i < CHIPPY_COVERAGE_MAP_SIZE; i += 8)
+    {
+        // Most of the map is never touched by a run
+        uint64_t word;
+        SDL_memcpy(&word, fuzzer->coverage + i, sizeof(word));
+        if (!word)
+            continue;
+
+        for (int j = i; j < i + 8; ++j)
+        {
+            const uint8_t bucket = g_Buckets[fuzzer->coverage[j]];
+            if (bucket & ~fuzzer->seen[j])
+            {
+                fuzzer->edges += fuzzer->seen[j] == 0;
+                fuzzer->seen[j] |= bucket;
+                found = true;
+            }
+            fuzzer->coverage[j] = 0;
+        }
+    }
+    return found;
+}
+
+/** Findings **/
+static uint64_t HashBytes(uint64_t hash, const void* data, size_t size)
+{
+    // 64 bit FNV-1a
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < size; ++i)
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    return hash;
+}
+
+// Names findings, so the same one found twice overwrites itself
+static uint64_t HashCase(const FuzzCase* fuzzCase)
+{
+    const uint64_t hash = HashBytes(14695981039346656037ull, fuzzCase->rom, fuzzCase->romSize);
+    return HashBytes(hash, fuzzCase->input, sizeof(fuzzCase->input));
+}
+
+// Writes the case out as a rom and a movie of its keys, so it replays in the emulator
+static void SaveFinding(Fuzzer* fuzzer, const FuzzCase* fuzzCase, const char* kind)
+{
+    char path[512];
+    const int length = SDL_snprintf(path, sizeof(path), "%s/%s-%016" SDL_PRIx64 ".ch8", fuzzer->outDir, kind, HashCase(fuzzCase));
+    if (!SDL_SaveFile(path, fuzzCase->rom, fuzzCase->romSize))
+    {
+        SDL_Log("Couldn't write %s: %s", path, SDL_GetError());
+        return;
+    }
+    SDL_Log("Wrote %s", path);
+
+    // Movies are tied to the rom loaded in the machine they're recorded on
+    ChippyMovie* movie = CHIPPY_CreateMovie();
+    if (!movie)
+        return;
+    CHIPPY_ResetWithRom(fuzzer->machine, fuzzCase->rom, fuzzCase->romSize);
+    CHIPPY_MovieRecord(movie, fuzzer->machine, FUZZ_MACHINE_SEED);
+    fuzzer->machine->movie = NULL;
+    for (int frame = 1; frame <= fuzzer->frames; ++frame)
+        CHIPPY_MovieFrame(movie, frame, fuzzCase->input[frame - 1]);
+
+    SDL_strlcpy(path + length, "m", sizeof(path) - length);
+    CHIPPY_SaveMovie(movie, path);
+    CHIPPY_DestroyMovie(movie);
+}
+
+static void OnCrash(void)
+{
+    SDL_Log("Crashed after %" SDL_PRIu64 " runs", g_Fuzzer->runs);
+    SaveFinding(g_Fuzzer, &g_Fuzzer->current, "crash");
+}
+
+static void OnCrashSignal(int signalNumber)
+{
+    OnCrash();
+    // Let the default handler finish the process off
+    signal(signalNumber, SIG_DFL);
+    raise(signalNumber);
+}
+
+/** Mutation **/
+// Resizing at the end, rather than inserting or removing part way through, leaves the rest of the rom where it was so
+// the next reset doesn't have to re-decode all of it
+static void Resize(Fuzzer* fuzzer, FuzzCase* fuzzCase, int size)
+{
+    size = SDL_clamp(size, 0, CHIPPY_ROM_MAX_SIZE);
+    for (int i = fuzzCase->romSize; i < size; ++i)
+        fuzzCase->rom[i] = (uint8_t)FuzzRandom(fuzzer);
+    fuzzCase->romSize = (uint16_t)size;
+}
+
+static void Mutate(Fuzzer* fuzzer, FuzzCase* fuzzCase)
+{
+    const int mutations = 1 + FuzzBelow(fuzzer, FUZZ_MAX_MUTATIONS);
+    for (int m = 0; m < mutations; ++m)
+    {
+        // Everything but resizing needs some rom to work on
+        if (fuzzCase->romSize < 2)
+            Resize(fuzzer, fuzzCase, 2);
+
+        const int size = fuzzCase->romSize;
+        // Instructions run from even addresses unless a jump says otherwise
+        const int instruction = FuzzBelow(fuzzer, size / 2) * 2;
+        switch (FuzzBelow(fuzzer, 12))
+        {
+        case 0: case 1: // Flip a bit
+            fuzzCase->rom[FuzzBelow(fuzzer, size)] ^= 1 << FuzzBelow(fuzzer, 8);
+            break;
+        case 2: case 3: // Any byte
+            fuzzCase->rom[FuzzBelow(fuzzer, size)] = (uint8_t)FuzzRandom(fuzzer);
+            break;
+        case 4: case 5: // Any instruction
+            fuzzCase->rom[instruction] = (uint8_t)FuzzRandom(fuzzer);
+            fuzzCase->rom[instruction + 1] = (uint8_t)FuzzRandom(fuzzer);
+            break;
+        case 6: // Point I into the last few bytes, where FX33, FX55, FX65 and DXYN run off the end of memory
+            fuzzCase->rom[instruction] = 0xAF;
+            fuzzCase->rom[instruction + 1] = (uint8_t)(0xF0 | FuzzBelow(fuzzer, 16));
+            break;
+        case 7: case 8: // Copy a few bytes from another case
+        {
+            const FuzzCase* other = fuzzer->corpus[FuzzBelow(fuzzer, fuzzer->corpusCount)];
+            if (other->romSize == 0)
+                break;
+            const int from = FuzzBelow(fuzzer, other->romSize);
+            const int to = FuzzBelow(fuzzer, size);
+            const int count = 1 + FuzzBelow(fuzzer, SDL_min(SDL_min(other->romSize - from, size - to), FUZZ_MAX_COPY));
+            SDL_memcpy(fuzzCase->rom + to, other->rom + from, count);
+            break;
+        }
+        case 9: // Slide a few instructions along, dropping as many a little further on
+        {
+            const int window = SDL_min(size - instruction, FUZZ_MAX_SLIDE);
+            const int count = 2 * (1 + FuzzBelow(fuzzer, 4));
+            if (window <= count)
+                break;
+            SDL_memmove(fuzzCase->rom + instruction + count, fuzzCase->rom + instruction, window - count);
+            for (int i = instruction; i < instruction + count; ++i)
+                fuzzCase->rom[i] = (uint8_t)FuzzRandom(fuzzer);
+            break;
+        }
+        case 10: // Grow or shrink
+            Resize(fuzzer, fuzzCase, size + (FuzzBelow(fuzzer, 2) ? 1 : -1) * 2 * (1 + FuzzBelow(fuzzer, 4)));
+            break;
+        case 11: // Hold some keys for a while, pressing the last of them
+        {
+            const int first = FuzzBelow(fuzzer, fuzzer->frames);
+            const int count = 1 + FuzzBelow(fuzzer, fuzzer->frames - first);
+            const uint16_t keys = (uint16_t)FuzzRandom(fuzzer) & (uint16_t)FuzzRandom(fuzzer);
+            // The keys held, with the last pressed plus one above them
+            const ChippyFrameInput input = keys | (ChippyFrameInput)(SDL_MostSignificantBitIndex32(keys) + 1) << 16;
+            for (int frame = first; frame < first + count; ++frame)
+                fuzzCase->input[frame] = input;
+            break;
+        }
+        }
+    }
+}
+
+/** Corpus **/
+static bool AddToCorpus(Fuzzer* fuzzer, const FuzzCase* fuzzCase)
+{
+    if (fuzzer->corpusCount == FUZZ_MAX_CORPUS)
+        return false;
+
+    FuzzCase* copy = SDL_malloc(sizeof(FuzzCase));
+    if (!copy)
+        return false;
+
+    *copy = *fuzzCase;
+    fuzzer->corpus[fuzzer->corpusCount++] = copy;
+    return true;
+}
+
+// Runs the current case, on the recompiler as well with --jit. Returns true if it reached anything new.
+static bool RunCurrent(Fuzzer* fuzzer)
+{
+    RunCase(fuzzer, fuzzer->machine, &fuzzer->current);
+    ++fuzzer->runs;
+
+    if (fuzzer->jitMachine)
+    {
+        RunCase(fuzzer, fuzzer->jitMachine, &fuzzer->current);
+        if (!SameState(fuzzer->machine, fuzzer->jitMachine))
+        {
+            SDL_Log("The recompiler disagrees with the interpreter");
+            ++fuzzer->findings;
+            SaveFinding(fuzzer, &fuzzer->current, "mismatch");
+        }
+    }
+
+    return TakeCoverage(fuzzer);
+}
+
+static void AddSeeds(Fuzzer* fuzzer, const char* path)
+{
+    int count = 0;
+    char** roms = CHIPPY_FindRoms(path, &count);
+    for (int i = 0; i < count; ++i)
+    {
+        size_t size = 0;
+        uint8_t* data = SDL_LoadFile(roms[i], &size);
+        if (!data || size > CHIPPY_ROM_MAX_SIZE)
+        {
+            SDL_Log("Skipping %s, it can't be read or doesn't fit in memory", roms[i]);
+            SDL_free(data);
+            continue;
+        }
+
+        SDL_zero(fuzzer->current);
+        fuzzer->current.romSize = (uint16_t)size;
+        SDL_memcpy(fuzzer->current.rom, data, size);
+        SDL_free(data);
+
+        // Seeds are kept whether or not they reach anything new, they're the starting points
+        RunCurrent(fuzzer);
+        AddToCorpus(fuzzer, &fuzzer->current);
+    }
+    SDL_free(roms);
+}
+
+static void LogStatus(const Fuzzer* fuzzer, uint64_t elapsedNS, int runAllocations)
+{
+    SDL_Log("%" SDL_PRIu64 " runs, %.0f runs/s, %d edges, %d in corpus, %d findings, %d allocations while running",
+        fuzzer->runs, elapsedNS ? (double)fuzzer->runs * SDL_NS_PER_SECOND / elapsedNS : 0.0,
+        fuzzer->edges, fuzzer->corpusCount, fuzzer->findings, runAllocations);
+}
+
+int main(int argc, char* argv[])
+{
+    SDL_GetOriginalMemoryFunctions(&g_Malloc, &g_Calloc, &g_Realloc, &g_Free);
+    SDL_SetMemoryFunctions(CountingMalloc, CountingCalloc, CountingRealloc, CountingFree);
+
+    uint64_t maxRuns = 0;
+    uint64_t seconds = FUZZ_DEFAULT_SECONDS;
+    uint64_t cycles = FUZZ_DEFAULT_CYCLES;
+    uint64_t seed = SDL_GetTicksNS();
+    bool jit = false;
+    const char* outDir = FUZZ_DEFAULT_OUT_DIR;
+    int seedArgs = 0;
+    char** seeds = SDL_calloc(argc, sizeof(char*));
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], "--runs") == 0 && i + 1 < argc)
+            maxRuns = SDL_strtoull(argv[++i], NULL, 10);
+        else if (SDL_strcmp(argv[i], "--seconds") == 0 && i + 1 < argc)
+            seconds = SDL_strtoull(argv[++i], NULL, 10);
+        else if (SDL_strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            cycles = SDL_strtoull(argv[++i], NULL, 10);
+        else if (SDL_strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            seed = SDL_strtoull(argv[++i], NULL, 10);
+        else if (SDL_strcmp(argv[i], "--out") == 0 && i + 1 < argc)
+            outDir = argv[++i];
+        else if (SDL_strcmp(argv[i], "--jit") == 0)
+            jit = true;
+        else
+            seeds[seedArgs++] = argv[i];
+    }
+    if (seedArgs == 0)
+        seeds[seedArgs++] = FUZZ_DEFAULT_ROM_DIR;
+
+    // Input is only held for so many frames
+    const uint64_t maxCycles = CHIPPY_FrameStartCycle(FUZZ_MAX_FRAMES);
+    if (cycles == 0 || cycles > maxCycles)
+    {
+        SDL_Log("--cycles has to be between 1 and %" SDL_PRIu64, maxCycles);
+        SDL_free(seeds);
+        return 1;
+    }
+
+    for (int count = 0; count < 256; ++count)
+    {
+        g_Buckets[count] = count == 0 ? 0 : count == 1 ? 1 : count == 2 ? 2 : count == 3 ? 4 :
+            count < 8 ? 8 : count < 16 ? 16 : count < 32 ? 32 : count < 128 ? 64 : 128;
+    }
+
+    Fuzzer* fuzzer = SDL_calloc(1, sizeof(Fuzzer));
+    FuzzCase** corpus = SDL_calloc(FUZZ_MAX_CORPUS, sizeof(FuzzCase*));
+    ChippyMachine* machine = CHIPPY_CreateMachine();
+    if (!fuzzer || !corpus || !machine)
+    {
+        SDL_Log("Couldn't set up the fuzzer");
+        return 1;
+    }
+
+    fuzzer->machine = machine;
+    fuzzer->cycles = cycles;
+    while (CHIPPY_FrameStartCycle(fuzzer->frames) < cycles)
+        ++fuzzer->frames;
+    fuzzer->random = seed | 1; // xorshift never leaves zero
+    fuzzer->outDir = outDir;
+    fuzzer->corpus = corpus;
+    machine->coverage = fuzzer->coverage;
+
+    if (jit)
+    {
+        fuzzer->jitMachine = CHIPPY_CreateMachine();
+        if (!fuzzer->jitMachine || !CHIPPY_SetDispatch(fuzzer->jitMachine, CHIPPY_DISPATCH_JIT))
+        {
+            SDL_Log("The recompiler isn't available here, fuzzing the interpreter alone");
+            CHIPPY_DestroyMachine(fuzzer->jitMachine);
+            fuzzer->jitMachine = NULL;
+        }
+    }
+
+    g_Fuzzer = fuzzer;
+#ifdef FUZZ_SANITIZED
+    __sanitizer_set_death_callback(OnCrash);
+#endif
+    signal(SIGSEGV, OnCrashSignal);
+    signal(SIGABRT, OnCrashSignal);
+    signal(SIGFPE, OnCrashSignal);
+    signal(SIGILL, OnCrashSignal);
+
+    for (int i = 0; i < seedArgs; ++i)
+        AddSeeds(fuzzer, seeds[i]);
+    SDL_free(seeds);
+    if (fuzzer->corpusCount == 0)
+    {
+        // Nothing to start from, an empty rom grows from its first mutation
+        SDL_zero(fuzzer->current);
+        AddToCorpus(fuzzer, &fuzzer->current);
+    }
+    SDL_Log("Fuzzing from %d seeds, %" SDL_PRIu64 " instructions a run, random seed %" SDL_PRIu64, fuzzer->corpusCount, cycles, seed);
+
+    int runAllocations = 0;
+    const uint64_t startTime = SDL_GetTicksNS();
+    uint64_t nextStatus = startTime + FUZZ_STATUS_INTERVAL_NS;
+    const FuzzCase* parent = NULL;
+    int parentRuns = 0;
+    for (;;)
+    {
+        // Runs of the same parent share most of their rom, so each reset only re-decodes what the mutations touched
+        if (parentRuns-- == 0)
+        {
+            parent = fuzzer->corpus[FuzzBelow(fuzzer, fuzzer->corpusCount)];
+            parentRuns = FUZZ_RUNS_PER_PARENT - 1;
+        }
+        fuzzer->current = *parent;
+        Mutate(fuzzer, &fuzzer->current);
+
+        const int allocationsBefore = SDL_GetAtomicInt(&g_Allocations);
+        const bool found = RunCurrent(fuzzer);
+        runAllocations += SDL_GetAtomicInt(&g_Allocations) - allocationsBefore;
+        if (found)
+            AddToCorpus(fuzzer, &fuzzer->current);
+
+        if (maxRuns && fuzzer->runs >= maxRuns)
+            break;
+
+        // Checking the clock every run would cost more than some runs
+        if ((fuzzer->runs & 0xFF) == 0)
+        {
+            const uint64_t now = SDL_GetTicksNS();
+            if (now >= nextStatus)
+            {
+                LogStatus(fuzzer, now - startTime, runAllocations);
+                nextStatus += FUZZ_STATUS_INTERVAL_NS;
+            }
+            if (seconds && now - startTime >= seconds * SDL_NS_PER_SECOND)
+                break;
+        }
+    }
+    LogStatus(fuzzer, SDL_GetTicksNS() - startTime, runAllocations);
+
+    const int failures = fuzzer->findings + (runAllocations != 0);
+    if (runAllocations)
+        SDL_Log("Resetting and running a machine shouldn't allocate");
+
+    for (int i = 0; i < fuzzer->corpusCount; ++i)
+        SDL_free(fuzzer->corpus[i]);
+    SDL_free(corpus);
+    CHIPPY_DestroyMachine(fuzzer->jitMachine);
+    CHIPPY_DestroyMachine(machine);
+    SDL_free(fuzzer);
+    return failures ? 1 : 0;
+}
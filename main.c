@@ -5,30 +5,393 @@
 SDL_Window *g_Window = NULL;
 SDL_Renderer *g_Renderer = NULL;
 
+bool g_UseVSync = false;
+uint64_t g_NextFrameTime = 0;
+
 #include "Chippy.h"
+#include "ChippyRunner.h"
+#include "ChippyLoader.h"
+#include "ChippyJit.h"
+#include "ChippyMovie.h"
+#include "ChippyRewind.h"
+
+ChippyDispatch g_Dispatch = CHIPPY_DISPATCH_DEFAULT;
+ChippyQuirks g_Quirks = CHIPPY_QUIRKS_COUNT; // Picked from each rom's name unless --quirks gives one
+
+ChippyRewind* g_Rewind = NULL; // Only kept for the windowed emulator
+bool g_Rewinding = false;
+
+ChippyMovie* g_Movie = NULL;
+const char* g_MoviePath = NULL; // Where a recording is saved on exit
+
+/* Switches a machine over to the dispatch picked on the command line. */
+static void ApplyDispatch(ChippyMachine* machine)
+{
+    if (!CHIPPY_SetDispatch(machine, g_Dispatch))
+        SDL_Log("Couldn't start the recompiler, falling back to the interpreter");
+}
+
+/* Overrides the quirk profile the rom's name picked, if one was given on the command line. */
+static void ApplyQuirks(ChippyMachine* machine)
+{
+    if (g_Quirks != CHIPPY_QUIRKS_COUNT)
+        CHIPPY_SetQuirks(machine, g_Quirks);
+}
+
+/* Removes a flag that can go anywhere on the command line, returns whether it was there. */
+static bool TakeFlag(int* argc, char* argv[], const char* flag)
+{
+    for (int i = 1; i < *argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], flag) == 0)
+        {
+            SDL_memmove(&argv[i], &argv[i + 1], sizeof(char*) * (*argc - i - 1));
+            --*argc;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Removes an option and the value after it from anywhere on the command line, returns the value or NULL. */
+static const char* TakeOption(int* argc, char* argv[], const char* option)
+{
+    for (int i = 1; i + 1 < *argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], option) == 0)
+        {
+            const char* value = argv[i + 1];
+            SDL_memmove(&argv[i], &argv[i + 2], sizeof(char*) * (*argc - i - 2));
+            *argc -= 2;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/* Runs the rom without a window, as fast as the host allows, and reports throughput. */
+static SDL_AppResult RunHeadless(ChippyMachine** machine, uint64_t cycles, const char* romPath)
+{
+    if (CHIPPY_InitHeadless(machine, romPath) != SDL_APP_CONTINUE)
+        return SDL_APP_FAILURE;
+    ApplyDispatch(*machine);
+    ApplyQuirks(*machine);
+
+    ChippyRunStats stats;
+    CHIPPY_RunCycles(*machine, cycles, &stats);
+
+    SDL_Log("Ran %" SDL_PRIu64 " instructions in %.3f ms (%.0f instructions/sec)",
+        stats.cycles, (double)stats.elapsedNS / SDL_NS_PER_MS, stats.cyclesPerSec);
+    if (stats.idleCycles)
+        SDL_Log("%" SDL_PRIu64 " of them were skipped over in idle loops", stats.idleCycles);
+
+    if ((*machine)->addressStack.errors & CSTACK_OVERFLOW)
+        SDL_Log("Rom overflowed the %d entry call stack", CSTACK_CAPACITY);
+    if ((*machine)->addressStack.errors & CSTACK_UNDERFLOW)
+        SDL_Log("Rom returned from a subroutine with an empty call stack");
+    return SDL_APP_SUCCESS;
+}
+
+/* Plays a recorded movie back without a window, as fast as the host allows. The run is identical to the one
+   that was recorded. */
+static SDL_AppResult RunReplay(ChippyMachine** machine, const char* moviePath, const char* romPath)
+{
+    if (CHIPPY_InitHeadless(machine, romPath) != SDL_APP_CONTINUE)
+        return SDL_APP_FAILURE;
+    ApplyDispatch(*machine);
+    ApplyQuirks(*machine);
+
+    g_Movie = CHIPPY_LoadMovie(moviePath);
+    if (!g_Movie || CHIPPY_MoviePlay(g_Movie, *machine) != 0)
+        return SDL_APP_FAILURE;
+
+    ChippyRunStats stats;
+    CHIPPY_RunCycles(*machine, CHIPPY_MovieCycles(g_Movie), &stats);
+
+    SDL_Log("Replayed %" SDL_PRIu64 " frames (%" SDL_PRIu64 " instructions) in %.3f ms (%.0f instructions/sec)",
+        g_Movie->frameCount, stats.cycles, (double)stats.elapsedNS / SDL_NS_PER_MS, stats.cyclesPerSec);
+    SDL_Log("Display hash %016" SDL_PRIx64, CHIPPY_HashDisplay(*machine));
+    return SDL_APP_SUCCESS;
+}
+
+/* Finds the machine holding this rom as it loaded, never run, or loads a new one. Every instance of a rom is
+   forked from it, so running the same rom many times over shares its memory until each instance writes to it. */
+static ChippyMachine* FindPrototype(ChippyMachine** prototypes, int* prototypeCount, const ChippyLoadedRom* rom)
+{
+    const ChippyQuirks quirks = g_Quirks != CHIPPY_QUIRKS_COUNT ? g_Quirks : CHIPPY_QuirksForRom(rom->path);
+    uint8_t memory[CHIPPY_ROM_MAX_SIZE];
+    for (int i = 0; i < *prototypeCount; ++i)
+    {
+        ChippyMachine* prototype = prototypes[i];
+        if (prototype->romSize != rom->size || prototype->quirks != quirks)
+            continue;
+        CHIPPY_ReadMemory(prototype, CHIPPY_STARTING_PROGRAM_COUNTER, memory, (uint16_t)rom->size);
+        if (SDL_memcmp(memory, rom->data, rom->size) == 0)
+            return prototype;
+    }
+
+    ChippyMachine* prototype = CHIPPY_CreateMachine();
+    if (!prototype || CHIPPY_LoadRomFromMemory(prototype, rom->data, rom->size) != 0)
+    {
+        CHIPPY_DestroyMachine(prototype);
+        return NULL;
+    }
+    CHIPPY_SetQuirks(prototype, quirks);
+    prototypes[(*prototypeCount)++] = prototype;
+    return prototype;
+}
+
+/* Creates a machine for a rom the loader has finished reading and hands it to the runner. */
+static void AddLoadedRom(ChippyRunner* runner, ChippyMachine** machines, ChippyMachine** prototypes, int* prototypeCount,
+    const ChippyLoadedRom* rom, uint64_t cycles)
+{
+    ChippyMachine* prototype = rom->data ? FindPrototype(prototypes, prototypeCount, rom) : NULL;
+    ChippyMachine* machine = prototype ? CHIPPY_ForkMachine(prototype) : NULL;
+    if (!machine)
+    {
+        SDL_Log("Skipping %s", rom->path);
+        CHIPPY_DestroyMachine(machine);
+        CHIPPY_RunnerCancelReserved(runner, 1);
+        return;
+    }
+
+    ApplyDispatch(machine);
+    const int index = CHIPPY_RunnerAdd(runner, machine, cycles);
+    if (index < 0)
+    {
+        CHIPPY_DestroyMachine(machine);
+        CHIPPY_RunnerCancelReserved(runner, 1);
+        return;
+    }
+    machines[index] = machine;
+}
+
+/* Runs every rom given across all cores, logging progress while roms are still loading. Directories and
+   globs are expanded to every rom they match. Roms are read asynchronously and each starts running as soon
+   as it has loaded, roms that fail to load are skipped. */
+static SDL_AppResult RunParallel(uint64_t cycles, int argCount, char* args[])
+{
+    SDL_AppResult result = SDL_APP_FAILURE;
+    char*** found = SDL_calloc(argCount, sizeof(char**));
+    const char** paths = NULL;
+    ChippyMachine** machines = NULL;
+    ChippyMachine** prototypes = NULL;
+    int prototypeCount = 0;
+    ChippyRunner* runner = CHIPPY_CreateRunner(0, 0);
+    ChippyLoader* loader = CHIPPY_CreateLoader(0);
+    int pathCount = 0;
+    if (!found || !runner || !loader)
+        goto cleanup;
+
+    // Gather every path up front, the loader keeps as many reads in flight as it can
+    for (int i = 0; i < argCount; ++i)
+    {
+        int count = 0;
+        found[i] = CHIPPY_FindRoms(args[i], &count);
+        if (found[i] && count == 0)
+            SDL_Log("No roms found at %s", args[i]);
+        pathCount += count;
+    }
+    if (pathCount == 0)
+    {
+        SDL_Log("No roms to run");
+        goto cleanup;
+    }
+
+    paths = SDL_malloc(sizeof(char*) * pathCount);
+    machines = SDL_calloc(pathCount, sizeof(ChippyMachine*));
+    prototypes = SDL_calloc(pathCount, sizeof(ChippyMachine*));
+    if (!paths || !machines || !prototypes)
+        goto cleanup;
+    for (int i = 0, p = 0; i < argCount; ++i)
+    {
+        for (char** path = found[i]; path && *path; ++path)
+            paths[p++] = *path;
+    }
+
+    if (!CHIPPY_RunnerReserve(runner, pathCount) || !CHIPPY_RunnerStart(runner) || !CHIPPY_LoaderStart(loader, paths, pathCount))
+        goto cleanup;
+
+    // Every rom comes back from the loader, failed ones included, so once it's done nothing's left reserved and the
+    // runner can just be waited on
+    uint64_t nextLog = SDL_GetTicks() + 100;
+    while (!CHIPPY_LoaderIsDone(loader))
+    {
+        ChippyLoadedRom rom;
+        if (CHIPPY_LoaderNext(loader, &rom, 100))
+        {
+            AddLoadedRom(runner, machines, prototypes, &prototypeCount, &rom, cycles);
+            SDL_free(rom.data);
+        }
+
+        if (SDL_GetTicks() >= nextLog && runner->instanceCount)
+        {
+            uint64_t done = 0;
+            for (int i = 0; i < runner->instanceCount; ++i)
+                done += CHIPPY_RunnerGetProgress(runner, i);
+            SDL_Log("Progress %.1f%% (%d/%d roms loaded)", 100.0 * done / ((double)cycles * runner->instanceCount), runner->instanceCount, pathCount);
+            nextLog = SDL_GetTicks() + 100;
+        }
+    }
+
+    ChippyRunStats stats;
+    CHIPPY_RunnerWait(runner, &stats);
+    SDL_Log("Ran %d roms (%d distinct) for %" SDL_PRIu64 " instructions in %.3f ms (%.0f instructions/sec)",
+        runner->instanceCount, prototypeCount, stats.cycles, (double)stats.elapsedNS / SDL_NS_PER_MS, stats.cyclesPerSec);
+    if (stats.idleCycles)
+        SDL_Log("%" SDL_PRIu64 " of them were skipped over in idle loops", stats.idleCycles);
+    result = SDL_APP_SUCCESS;
+
+cleanup:
+    // Workers are joined before the machines they run go away, anything never added would keep them waiting
+    if (runner)
+        CHIPPY_RunnerCancelReserved(runner, runner->reserved);
+    CHIPPY_DestroyRunner(runner);
+    CHIPPY_DestroyLoader(loader);
+    if (machines)
+    {
+        for (int i = 0; i < pathCount; ++i)
+            CHIPPY_DestroyMachine(machines[i]);
+        SDL_free(machines);
+    }
+    for (int i = 0; i < prototypeCount; ++i)
+        CHIPPY_DestroyMachine(prototypes[i]);
+    SDL_free(prototypes);
+    for (int i = 0; found && i < argCount; ++i)
+        SDL_free(found[i]);
+    SDL_free(found);
+    SDL_free(paths);
+    return result;
+}
+
+/* Blocks until the next fixed timestep frame is due and returns the time it's due at. */
+static uint64_t WaitForNextFrame()
+{
+    const uint64_t frameTime = NANOSECONDS(g_TimeStep);
+    uint64_t now = SDL_GetTicksNS();
+    if (g_NextFrameTime == 0)
+        g_NextFrameTime = now + frameTime;
+
+    // Sleep through most of the wait, then spin for the last stretch to hit the deadline precisely
+    if (now + CHIPPY_FRAME_SPIN_NS < g_NextFrameTime)
+        SDL_DelayNS(g_NextFrameTime - now - CHIPPY_FRAME_SPIN_NS);
+
+    while ((now = SDL_GetTicksNS()) < g_NextFrameTime)
+        SDL_CPUPauseInstruction();
+
+    // Schedule off the deadline rather than now so small overshoots don't accumulate.
+    // If we've fallen a whole frame behind (e.g. the window was dragged), resync instead of bursting to catch up.
+    g_NextFrameTime += frameTime;
+    if (g_NextFrameTime <= now)
+        g_NextFrameTime = now + frameTime;
+
+    return now;
+}
 
 /* This function runs once at startup. */
 SDL_AppResult SDL_AppInit(void** appstate, int argc, char* argv[])
 {
+    // The machine is handed back to SDL as the appstate for the other callbacks
+    ChippyMachine** machine = (ChippyMachine**)appstate;
+
+    // --jit, --vsync, --record and --quirks can go anywhere, they're taken out before the other arguments are looked at
+    if (TakeFlag(&argc, argv, CHIPPY_JIT_ARG))
+        g_Dispatch = CHIPPY_DISPATCH_JIT;
+    const bool wantVSync = TakeFlag(&argc, argv, CHIPPY_VSYNC_ARG);
+    g_MoviePath = TakeOption(&argc, argv, CHIPPY_RECORD_ARG);
+    const char* quirks = TakeOption(&argc, argv, CHIPPY_QUIRKS_ARG);
+    if (quirks)
+    {
+        g_Quirks = CHIPPY_FindQuirks(quirks);
+        if (g_Quirks == CHIPPY_QUIRKS_COUNT)
+        {
+            SDL_Log("Unknown quirk profile %s, pick one of vip, schip or xochip", quirks);
+            return SDL_APP_FAILURE;
+        }
+    }
+
+    // --headless [cycles] [rom]
+    if (argc > 1 && SDL_strcmp(argv[1], CHIPPY_HEADLESS_ARG) == 0)
+    {
+        const uint64_t cycles = argc > 2 ? SDL_strtoull(argv[2], NULL, 10) : CHIPPY_HEADLESS_DEFAULT_CYCLES;
+        return RunHeadless(machine, cycles, argc > 3 ? argv[3] : NULL);
+    }
+
+    // --replay movie [rom]
+    if (argc > 2 && SDL_strcmp(argv[1], CHIPPY_REPLAY_ARG) == 0)
+    {
+        return RunReplay(machine, argv[2], argc > 3 ? argv[3] : NULL);
+    }
+
+    // --parallel cycles rom|directory|glob [...]
+    if (argc > 3 && SDL_strcmp(argv[1], CHIPPY_RUNNER_ARG) == 0)
+    {
+        return RunParallel(SDL_strtoull(argv[2], NULL, 10), argc - 3, &argv[3]);
+    }
+
+    // [--record movie] [rom]
+    const char* romPath = argc > 1 ? argv[1] : NULL;
+
     /* Create the window */
     if (!SDL_CreateWindowAndRenderer(CHIPPY_WINDOW_NAME, CHIPPY_WINDOW_WIDTH, CHIPPY_WINDOW_HEIGHT, SDL_WINDOW_MOUSE_FOCUS | SDL_WINDOW_MAXIMIZED, &g_Window, &g_Renderer)) {
         SDL_Log("Couldn't create window and renderer: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
 
-    return CHIPPY_Init(g_Renderer);
+    // Falls back to sleeping if the renderer can't do vsync
+    if (wantVSync)
+    {
+        g_UseVSync = SDL_SetRenderVSync(g_Renderer, 1);
+        if (!g_UseVSync)
+            SDL_Log("Couldn't enable vsync, pacing frames with sleeps: %s", SDL_GetError());
+    }
+
+    const SDL_AppResult result = CHIPPY_Init(machine, g_Renderer, romPath);
+    if (result == SDL_APP_CONTINUE)
+    {
+        ApplyDispatch(*machine);
+        ApplyQuirks(*machine);
+
+        // Runs without rewind rather than not at all
+        g_Rewind = CHIPPY_CreateRewind(0, 0);
+        if (!g_Rewind)
+            SDL_Log("Couldn't create the rewind buffer, rewinding is off");
+
+        if (g_MoviePath)
+        {
+            SDL_Time now = 0;
+            SDL_GetCurrentTime(&now);
+            g_Movie = CHIPPY_CreateMovie();
+            if (!g_Movie)
+                return SDL_APP_FAILURE;
+            CHIPPY_MovieRecord(g_Movie, *machine, (uint64_t)now);
+        }
+    }
+    return result;
 };
 
 /* This function runs when a new event (mouse input, keypresses, etc) occurs. */
 SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
 {
+    ChippyMachine* machine = appstate;
+
     switch (event->type) {
     case SDL_EVENT_QUIT:
         return SDL_APP_SUCCESS;
     case SDL_EVENT_KEY_DOWN:
-        return CHIPPY_InputEvent(event->key.scancode, 1);
+        if (event->key.scancode == CHIPPY_REWIND_KEY)
+        {
+            g_Rewinding = g_Rewind != NULL;
+            return SDL_APP_CONTINUE;
+        }
+        return CHIPPY_InputEvent(machine, event->key.scancode, 1);
     case SDL_EVENT_KEY_UP:
-        return CHIPPY_InputEvent(event->key.scancode, 0);
+        if (event->key.scancode == CHIPPY_REWIND_KEY)
+        {
+            g_Rewinding = false;
+            return SDL_APP_CONTINUE;
+        }
+        return CHIPPY_InputEvent(machine, event->key.scancode, 0);
     }
     return SDL_APP_CONTINUE;
 }
@@ -36,16 +399,12 @@ SDL_AppResult SDL_AppEvent(void *appstate, SDL_Event *event)
 /* This function runs once per frame, and is the heart of the program. */
 SDL_AppResult SDL_AppIterate(void *appstate)
 {
-    uint64_t time = SDL_GetTicks();
-    g_CurrentTime = time;
-    
-    // fixed timestep
-    while (g_CurrentTime < time + MILLISECONDS(g_TimeStep))
-    {
-        g_CurrentTime = SDL_GetTicks();
-    }
+    ChippyMachine* machine = appstate;
+    const uint64_t lastTime = g_CurrentTime;
 
-    g_DeltaTime = (g_CurrentTime - time);
+    // With vsync SDL_RenderPresent already blocked until the display was ready, otherwise wait out the fixed timestep
+    g_CurrentTime = g_UseVSync ? SDL_GetTicksNS() : WaitForNextFrame();
+    g_DeltaTime = g_CurrentTime - lastTime;
 
     if (SECONDS(g_CurrentTime) < CHIPPY_START_SCREEN_DELAY) 
     {
@@ -53,9 +412,35 @@ SDL_AppResult SDL_AppIterate(void *appstate)
     }
     else
     {
-        CHIPPY_Update();
+        // While rewinding each frame steps back a snapshot instead of running, and holds on the oldest one
+        if (g_Rewinding)
+        {
+            CHIPPY_RewindStep(g_Rewind, machine);
+        }
+        else
+        {
+            CHIPPY_Update(machine);
+            if (g_Rewind)
+                CHIPPY_RewindRecord(g_Rewind, machine);
+        }
+
+        // Expand the 1bit display straight into the streaming texture, but only the band of rows that
+        // changed. Most frames of most roms draw nothing, in which case the upload is skipped entirely.
+        const uint32_t dirtyRows = CHIPPY_TakeDirtyRows(machine);
+        if (dirtyRows)
+        {
+            const int firstRow = SDL_MostSignificantBitIndex32(dirtyRows & (~dirtyRows + 1));
+            const int lastRow = SDL_MostSignificantBitIndex32(dirtyRows);
+            const SDL_Rect rect = { 0, firstRow, CHIPPY_DISPLAY_WIDTH, lastRow - firstRow + 1 };
 
-        SDL_UpdateTexture(CHIPPY_GetDisplayTexture(), NULL, CHIPPY_GetDisplayBuffer(), sizeof(uint32_t) * CHIPPY_DISPLAY_WIDTH);
+            void* pixels;
+            int pitch;
+            if (SDL_LockTexture(CHIPPY_GetDisplayTexture(), &rect, &pixels, &pitch))
+            {
+                CHIPPY_ExpandDisplay(machine, pixels, pitch, rect.y, rect.h);
+                SDL_UnlockTexture(CHIPPY_GetDisplayTexture());
+            }
+        }
         
         SDL_SetRenderDrawColor(g_Renderer, g_DisplayColors[0].r, g_DisplayColors[0].g, g_DisplayColors[0].b, g_DisplayColors[0].a);
         SDL_RenderClear(g_Renderer);
@@ -71,7 +456,12 @@ SDL_AppResult SDL_AppIterate(void *appstate)
 /* This function runs once at shutdown. */
 void SDL_AppQuit(void *appstate, SDL_AppResult result)
 {
-    CHIPPY_Shutdown();
+    if (g_Movie && g_Movie->mode == CHIPPY_MOVIE_RECORD && CHIPPY_SaveMovie(g_Movie, g_MoviePath) == 0)
+        SDL_Log("Saved %" SDL_PRIu64 " frames of input to %s", g_Movie->frameCount, g_MoviePath);
+
+    CHIPPY_DestroyRewind(g_Rewind);
+    CHIPPY_Shutdown(appstate);
+    CHIPPY_DestroyMovie(g_Movie);
     SDL_DestroyRenderer(g_Renderer);
     SDL_DestroyWindow(g_Window);
 }
@@ -0,0 +1,235 @@
+/*
+    Golden display tests. Runs each rom listed in the goldens file headlessly for a fixed number of emulated frames,
+    pressing any keys it scripts along the way, and compares a hash of the display with the one recorded. Every
+    mismatch dumps the display to <rom>.pbm in the working directory to look at.
+
+    ChippyGoldens [roms dir] [goldens file] [--update]
+
+    --update writes this run's hashes back to the goldens file, and dumps every display so they can be checked.
+*/
+#include <SDL3/SDL.h>
+#include "Chippy.h"
+
+#define GOLDEN_DEFAULT_ROM_DIR "roms"
+#define GOLDEN_DEFAULT_FILE "tests/goldens.txt"
+#define GOLDEN_UPDATE_ARG "--update"
+#define GOLDEN_SEED 1
+#define GOLDEN_MAX_KEYS 16
+#define GOLDEN_PRESS_FRAMES 6 // A scripted key is held this many frames, long enough for any rom to notice
+
+typedef struct GoldenKey
+{
+    uint8_t key; // Hex key
+    uint32_t frame;
+} GoldenKey;
+
+// One line of the goldens file: rom frames hash [quirks=profile] [key@frame ...]
+typedef struct Golden
+{
+    char rom[128];
+    uint32_t frames;
+    uint64_t hash;
+    ChippyQuirks quirks; // Picked from the rom's name unless the line gives one
+    bool quirksGiven;
+    GoldenKey keys[GOLDEN_MAX_KEYS];
+    int keyCount;
+} Golden;
+
+static bool ParseGolden(const char* line, Golden* golden)
+{
+    SDL_zerop(golden);
+    char hash[17];
+    unsigned int frames;
+    int used = 0;
+    if (SDL_sscanf(line, "%127s %u %16s%n", golden->rom, &frames, hash, &used) != 3)
+        return false;
+    golden->frames = frames;
+    golden->hash = SDL_strtoull(hash, NULL, 16);
+    golden->quirks = CHIPPY_QuirksForRom(golden->rom);
+
+    for (line += used; *line; )
+    {
+        char quirks[16];
+        if (SDL_sscanf(line, " quirks=%15s%n", quirks, &used) == 1)
+        {
+            golden->quirks = CHIPPY_FindQuirks(quirks);
+            golden->quirksGiven = true;
+            if (golden->quirks == CHIPPY_QUIRKS_COUNT)
+                return false;
+            line += used;
+            while (*line == ' ' || *line == '\t')
+                ++line;
+            continue;
+        }
+
+        unsigned int key, frame;
+        if (SDL_sscanf(line, " %x@%u%n", &key, &frame, &used) != 2 || key > 0xF || golden->keyCount == GOLDEN_MAX_KEYS)
+            return false;
+        golden->keys[golden->keyCount++] = (GoldenKey){ (uint8_t)key, frame };
+        line += used;
+        while (*line == ' ' || *line == '\t')
+            ++line;
+    }
+    return true;
+}
+
+static uint64_t RunGolden(const Golden* golden, const uint8_t* data, size_t size, ChippyMachine* machine)
+{
+    CHIPPY_ResetMachine(machine);
+    CHIPPY_SeedRandom(machine, GOLDEN_SEED);
+    CHIPPY_SetQuirks(machine, golden->quirks);
+    if (CHIPPY_LoadRomFromMemory(machine, data, size) != 0)
+        return 0;
+
+    for (uint32_t frame = 0; frame < golden->frames; ++frame)
+    {
+        for (int i = 0; i < golden->keyCount; ++i)
+        {
+            const GoldenKey* key = &golden->keys[i];
+            if (frame == key->frame || frame == key->frame + GOLDEN_PRESS_FRAMES)
+                CHIPPY_InputEvent(machine, g_InputHexTable[key->key], frame == key->frame);
+        }
+        CHIPPY_RunCycles(machine, CHIPPY_FrameStartCycle(frame + 1) - machine->cycles, NULL);
+    }
+    return CHIPPY_HashDisplay(machine);
+}
+
+// Binary PBM, which stores rows the same way the display plane does: 1 bit a pixel, leftmost in the top bit. Named
+// after the rom, and the profile if the line gives one.
+static void DumpDisplay(const ChippyMachine* machine, const Golden* golden)
+{
+    char path[256];
+    if (golden->quirksGiven)
+        SDL_snprintf(path, sizeof(path), "%s.%s.pbm", golden->rom, g_QuirkNames[golden->quirks]);
+    else
+        SDL_snprintf(path, sizeof(path), "%s.pbm", golden->rom);
+    SDL_IOStream* file = SDL_IOFromFile(path, "wb");
+    if (!file)
+    {
+        SDL_Log("Couldn't write %s: %s", path, SDL_GetError());
+        return;
+    }
+
+    SDL_IOprintf(file, "P4\n%d %d\n", CHIPPY_DISPLAY_WIDTH, CHIPPY_DISPLAY_HEIGHT);
+    for (int y = 0; y < CHIPPY_DISPLAY_HEIGHT; ++y)
+    {
+        for (int shift = CHIPPY_DISPLAY_WIDTH - 8; shift >= 0; shift -= 8)
+            SDL_WriteU8(file, (Uint8)(machine->displayPlane[y] >> shift));
+    }
+    SDL_CloseIO(file);
+    SDL_Log("Wrote %s", path);
+}
+
+static void WriteGolden(SDL_IOStream* file, const Golden* golden)
+{
+    SDL_IOprintf(file, "%s %" SDL_PRIu32 " %016" SDL_PRIx64, golden->rom, golden->frames, golden->hash);
+    if (golden->quirksGiven)
+        SDL_IOprintf(file, " quirks=%s", g_QuirkNames[golden->quirks]);
+    for (int i = 0; i < golden->keyCount; ++i)
+        SDL_IOprintf(file, " %X@%" SDL_PRIu32, golden->keys[i].key, golden->keys[i].frame);
+    SDL_IOprintf(file, "\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* romDir = GOLDEN_DEFAULT_ROM_DIR;
+    const char* goldensPath = GOLDEN_DEFAULT_FILE;
+    bool update = false;
+    for (int i = 1, positional = 0; i < argc; ++i)
+    {
+        if (SDL_strcmp(argv[i], GOLDEN_UPDATE_ARG) == 0)
+            update = true;
+        else if (positional++ == 0)
+            romDir = argv[i];
+        else
+            goldensPath = argv[i];
+    }
+
+    // Updates go to a copy that replaces the goldens once every rom has run, so a bad run can't leave them half done
+    char updatePath[512];
+    SDL_snprintf(updatePath, sizeof(updatePath), "%s.new", goldensPath);
+
+    char* goldens = SDL_LoadFile(goldensPath, NULL);
+    ChippyMachine* machine = CHIPPY_CreateMachine();
+    SDL_IOStream* updated = update ? SDL_IOFromFile(updatePath, "wb") : NULL;
+    if (!goldens || !machine || (update && !updated))
+    {
+        SDL_Log("Couldn't set up goldens from %s: %s", goldensPath, SDL_GetError());
+        return 1;
+    }
+
+    int checked = 0, failures = 0;
+    const uint64_t startTime = SDL_GetTicksNS();
+    char* next = goldens;
+    while (*next)
+    {
+        // Split by hand, SDL_strtok_r would swallow the blank lines
+        char* line = next;
+        char* newline = SDL_strchr(line, '\n');
+        next = newline ? newline + 1 : line + SDL_strlen(line);
+        if (newline)
+            *newline = '\0';
+        char* end = SDL_strchr(line, '\r');
+        if (end)
+            *end = '\0';
+
+        // Comments and blank lines are kept as they are
+        Golden golden;
+        if (line[0] == '#' || line[0] == '\0')
+        {
+            if (updated)
+                SDL_IOprintf(updated, "%s\n", line);
+            continue;
+        }
+        if (!ParseGolden(line, &golden))
+        {
+            SDL_Log("Can't parse golden: %s", line);
+            ++failures;
+            continue;
+        }
+
+        char path[512];
+        SDL_snprintf(path, sizeof(path), "%s/%s", romDir, golden.rom);
+        size_t size = 0;
+        uint8_t* data = SDL_LoadFile(path, &size);
+        const uint64_t hash = data ? RunGolden(&golden, data, size, machine) : 0;
+        SDL_free(data);
+        ++checked;
+
+        if (!data)
+        {
+            SDL_Log("Couldn't load %s: %s", path, SDL_GetError());
+            ++failures;
+        }
+        else if (update)
+        {
+            golden.hash = hash;
+            DumpDisplay(machine, &golden);
+        }
+        else if (hash != golden.hash)
+        {
+            SDL_Log("%s after %" SDL_PRIu32 " frames: display hash %016" SDL_PRIx64 ", expected %016" SDL_PRIx64,
+                golden.rom, golden.frames, hash, golden.hash);
+            DumpDisplay(machine, &golden);
+            ++failures;
+        }
+
+        if (updated)
+            WriteGolden(updated, &golden);
+    }
+    const uint64_t elapsedNS = SDL_GetTicksNS() - startTime;
+
+    if (updated && (!SDL_CloseIO(updated) || !SDL_RenamePath(updatePath, goldensPath)))
+    {
+        SDL_Log("Couldn't write %s: %s", goldensPath, SDL_GetError());
+        ++failures;
+    }
+
+    CHIPPY_DestroyMachine(machine);
+    SDL_free(goldens);
+
+    SDL_Log("%s %d golden(s) in %.3f ms", update ? "Updated" : "Checked", checked, (double)elapsedNS / SDL_NS_PER_MS);
+    if (failures)
+        SDL_Log("%d golden(s) failed", failures);
+    return failures ? 1 : 0;
+}
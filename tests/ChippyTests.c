@@ -0,0 +1,834 @@
+/*
+    Core tests. Checks decoding, rom loading, that every dispatch mode leaves a machine in exactly the same
+    state after running each rom in roms/, that save states and rewind pick up exactly where they left off, and
+    that a recorded movie replays the same run, even one rewound partway through recording.
+    Machines run in lockstep have to end up where each would have on its own, as do machines skipping over idle loops.
+    Machines run in slices by the parallel runner have to end up where a direct run leaves them.
+
+    ChippyTests [roms dir]
+*/
+#include <SDL3/SDL.h>
+#include <stdio.h>
+
+#include "Chippy.h"
+#include "ChippyJit.h"
+#include "ChippyLockstep.h"
+#include "ChippyMovie.h"
+#include "ChippyRewind.h"
+#include "ChippyRunner.h"
+#include "ChippyState.h"
+
+#define TEST_DEFAULT_ROM_DIR "roms"
+#define TEST_SEED 1
+#define TEST_DISPATCH_CYCLES 500000ull
+#define TEST_RUNNER_INSTANCES 6
+#define TEST_RUNNER_WORKERS 3
+#define TEST_RUNNER_SLICE_CYCLES 1000ull
+#define TEST_RUNNER_CYCLES 50000ull
+#define TEST_STATE_CYCLES 100000ull
+#define TEST_REWIND_FRAMES 2000
+#define TEST_MOVIE_CYCLES 200000ull
+#define TEST_MOVIE_PATH "ChippyTests.ch8m"
+#define TEST_MOVIE_REWIND_STEPS 20
+#define TEST_MOVIE_REWIND_CYCLES 5000ull
+#define TEST_LOCKSTEP_LANES 12
+#define TEST_LOCKSTEP_CYCLES 100000ull
+#define TEST_IDLE_CYCLES 20000ull
+#define TEST_REWIND_BUFFER_SIZE 1 // Rounded up to the smallest buffer allowed, so the ring wraps and drops history
+
+static int g_Failures = 0;
+
+#define TEST_CHECK(condition, ...) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            SDL_Log(__VA_ARGS__); \
+            ++g_Failures; \
+        } \
+    } while (0)
+
+static const char* g_TestRoms[] =
+{
+    "1-ibm-logo.ch8",
+    "2-bc-test.ch8",
+    "3-corax+.ch8",
+    "3-test-opcode.ch8",
+    "4-flags.ch8",
+    "5-quirks.ch8",
+    "6-keypad.ch8"
+};
+
+// Reads a rom from romDir, counting a failure if it can't. Freed with SDL_free.
+static uint8_t* LoadTestRom(const char* romDir, const char* name, size_t* size)
+{
+    char path[512];
+    SDL_snprintf(path, sizeof(path), "%s/%s", romDir, name);
+    uint8_t* data = SDL_LoadFile(path, size);
+    TEST_CHECK(data, "Couldn't load %s: %s", path, SDL_GetError());
+    return data;
+}
+
+/** Decoding **/
+static void TestDecode()
+{
+    static const struct { uint16_t instruction; ChippyOpHandler handler; } cases[] =
+    {
+        { 0x0123, CHIPPY_OP_NOP },
+        { 0x00E0, CHIPPY_OP_CLEAR_SCREEN },
+        { 0x00EE, CHIPPY_OP_POP_SUBROUTINE },
+        { 0x1ABC, CHIPPY_OP_JUMP_PC },
+        { 0x2ABC, CHIPPY_OP_PUSH_SUBROUTINE },
+        { 0x8124, CHIPPY_OP_ADD_VXVY },
+        { 0x812E, CHIPPY_OP_SHL_VYVX },
+        { 0x8128, CHIPPY_OP_NOP },
+        { 0xD125, CHIPPY_OP_DRAW_SPRITE },
+        { 0xE19E, CHIPPY_OP_SKIP_KEYDOWN },
+        { 0xE1A1, CHIPPY_OP_SKIP_KEYUP },
+        { 0xE100, CHIPPY_OP_NOP },
+        { 0xF10A, CHIPPY_OP_GET_KEY },
+        { 0xF165, CHIPPY_OP_MEMORY_LOAD },
+        { 0xF1FF, CHIPPY_OP_NOP }
+    };
+
+    for (size_t i = 0; i < SDL_arraysize(cases); ++i)
+    {
+        const ChippyOp op = CHIPPY_Decode(cases[i].instruction);
+        TEST_CHECK(op.handler == cases[i].handler, "Decode %04X: handler %d, expected %d", cases[i].instruction, op.handler, cases[i].handler);
+    }
+
+    const ChippyOp op = CHIPPY_Decode(0xD12F);
+    TEST_CHECK(op.x == 0x1 && op.y == 0x2 && op.n == 0xF && op.nn == 0x2F && op.nnn == 0x12F, "Decode D12F: wrong fields");
+}
+
+/** Rom Loading **/
+static void TestLoadRom()
+{
+    ChippyMachine* machine = CHIPPY_CreateMachine();
+    if (!machine)
+    {
+        TEST_CHECK(false, "Couldn't create a machine");
+        return;
+    }
+
+    static uint8_t tooBig[CHIPPY_ROM_MAX_SIZE + 1];
+    TEST_CHECK(CHIPPY_LoadRomFromMemory(machine, tooBig, sizeof(tooBig)) != 0, "Loaded a rom bigger than memory");
+
+    const uint8_t rom[] = { 0x60, 0x2A, 0x12, 0x02 };
+    TEST_CHECK(CHIPPY_LoadRomFromMemory(machine, rom, sizeof(rom)) == 0, "Couldn't load a 4 byte rom");
+    TEST_CHECK(CHIPPY_DecodedOp(machine, CHIPPY_STARTING_PROGRAM_COUNTER)->handler == CHIPPY_OP_SET_VX, "Rom wasn't decoded on load");
+
+    CHIPPY_RunCycles(machine, 10, NULL);
+    TEST_CHECK(machine->variableRegisters[0] == 0x2A && machine->programCounter == 0x202, "Rom didn't run as expected");
+
+    CHIPPY_DestroyMachine(machine);
+}
+
+/** Dispatch **/
+// Everything a rom can observe or leave behind, the jit's code cache and the cycle timers aside
+static bool SameState(const ChippyMachine* a, const ChippyMachine* b)
+{
+    return a->programCounter == b->programCounter &&
+        a->indexRegister == b->indexRegister &&
+        SDL_memcmp(a->variableRegisters, b->variableRegisters, sizeof(a->variableRegisters)) == 0 &&
+        a->addressStack.count == b->addressStack.count &&
+        a->addressStack.errors == b->addressStack.errors &&
+        SDL_memcmp(a->addressStack.items, b->addressStack.items, sizeof(a->addressStack.items[0]) * a->addressStack.count) == 0 &&
+        CHIPPY_GetDelayTimer(a) == CHIPPY_GetDelayTimer(b) &&
+        CHIPPY_GetSoundTimer(a) == CHIPPY_GetSoundTimer(b) &&
+        a->cycles == b->cycles &&
+        CHIPPY_SameMemory(a, b) &&
+        SDL_memcmp(a->displayPlane, b->displayPlane, sizeof(a->displayPlane)) == 0;
+}
+
+static ChippyMachine* RunRom(const uint8_t* data, size_t size, ChippyDispatch dispatch, uint64_t cycles)
+{
+    ChippyMachine* machine = CHIPPY_CreateMachine();
+    if (!machine)
+        return NULL;
+
+    // Dispatches that aren't available fall back to the threaded one, which still has to agree
+    CHIPPY_SetDispatch(machine, dispatch);
+    if (CHIPPY_LoadRomFromMemory(machine, data, size) != 0)
+    {
+        CHIPPY_DestroyMachine(machine);
+        return NULL;
+    }
+
+    CHIPPY_SeedRandom(machine, TEST_SEED);
+    CHIPPY_RunCycles(machine, cycles, NULL);
+    return machine;
+}
+
+static void TestDispatchAgrees(const char* romDir)
+{
+    for (size_t i = 0; i < SDL_arraysize(g_TestRoms); ++i)
+    {
+        size_t size = 0;
+        uint8_t* data = LoadTestRom(romDir, g_TestRoms[i], &size);
+        if (!data)
+            continue;
+
+        ChippyMachine* reference = RunRom(data, size, CHIPPY_DISPATCH_CALL, TEST_DISPATCH_CYCLES);
+        for (int dispatch = CHIPPY_DISPATCH_CALL + 1; dispatch < CHIPPY_DISPATCH_COUNT && reference; ++dispatch)
+        {
+            ChippyMachine* machine = RunRom(data, size, dispatch, TEST_DISPATCH_CYCLES);
+            TEST_CHECK(machine && SameState(reference, machine), "%s: dispatch %d doesn't match the call dispatcher", g_TestRoms[i], dispatch);
+            CHIPPY_DestroyMachine(machine);
+        }
+        TEST_CHECK(reference, "%s: couldn't run", g_TestRoms[i]);
+
+        CHIPPY_DestroyMachine(reference);
+        SDL_free(data);
+    }
+}
+
+/** Runner **/
+// Machines run in slices across workers, some of them stolen from one worker by another, have to end up where one
+// direct run leaves them, and the run's stats have to add up across every instance
+static void TestRunner()
+{
+    const uint8_t count[] =
+    {
+        0x76, 0x01, // 0x200: V6 += 1
+        0x12, 0x00,
+    };
+    const uint8_t spin[] =
+    {
+        0x60, 0x30, // V0 = 0x30
+        0xF0, 0x18, // ST = V0
+        0x12, 0x04, // 0x204: Loop here
+    };
+
+    ChippyMachine* machines[TEST_RUNNER_INSTANCES] = { 0 };
+    ChippyMachine* expected[TEST_RUNNER_INSTANCES] = { 0 };
+    ChippyRunner* runner = CHIPPY_CreateRunner(TEST_RUNNER_WORKERS, TEST_RUNNER_SLICE_CYCLES);
+    uint64_t expectedCycles = 0;
+    uint64_t expectedIdle = 0;
+    if (!runner)
+    {
+        TEST_CHECK(false, "Couldn't create a runner");
+        return;
+    }
+
+    for (int i = 0; i < TEST_RUNNER_INSTANCES; ++i)
+    {
+        // Uneven runs, so the workers dealt the short ones run out of work and steal the rest
+        const uint64_t cycles = TEST_RUNNER_CYCLES * (1 + i % 3);
+        const uint8_t* rom = i % 2 ? count : spin;
+        const size_t size = i % 2 ? sizeof(count) : sizeof(spin);
+        machines[i] = RunRom(rom, size, CHIPPY_DISPATCH_THREADED, 0);
+        expected[i] = RunRom(rom, size, CHIPPY_DISPATCH_THREADED, 0);
+        if (!machines[i] || !expected[i] || CHIPPY_RunnerAdd(runner, machines[i], cycles) != i)
+        {
+            TEST_CHECK(false, "Couldn't set up runner test");
+            goto cleanup;
+        }
+
+        ChippyRunStats run = { 0 };
+        CHIPPY_RunCycles(expected[i], cycles, &run);
+        expectedCycles += cycles;
+        expectedIdle += run.idleCycles;
+    }
+
+    if (!CHIPPY_RunnerStart(runner))
+    {
+        TEST_CHECK(false, "Couldn't start runner");
+        goto cleanup;
+    }
+    ChippyRunStats stats = { 0 };
+    CHIPPY_RunnerWait(runner, &stats);
+
+    TEST_CHECK(CHIPPY_RunnerIsDone(runner), "Runner finished with instances left");
+    TEST_CHECK(stats.cycles == expectedCycles, "Runner ran %llu instructions, not %llu",
+        (unsigned long long)stats.cycles, (unsigned long long)expectedCycles);
+    TEST_CHECK(stats.idleCycles == expectedIdle, "Runner skipped %llu instructions in idle loops, not %llu",
+        (unsigned long long)stats.idleCycles, (unsigned long long)expectedIdle);
+#if CHIPPY_IDLE_SKIP
+    TEST_CHECK(expectedIdle > 0, "The spinning roms skipped no idle loops");
+#endif
+    for (int i = 0; i < TEST_RUNNER_INSTANCES; ++i)
+        TEST_CHECK(SameState(machines[i], expected[i]), "Runner instance %d didn't end up where a direct run did", i);
+
+cleanup:
+    CHIPPY_DestroyRunner(runner);
+    for (int i = 0; i < TEST_RUNNER_INSTANCES; ++i)
+    {
+        CHIPPY_DestroyMachine(machines[i]);
+        CHIPPY_DestroyMachine(expected[i]);
+    }
+}
+
+/** Forks **/
+static void TestFork(const char* romDir)
+{
+    for (size_t i = 0; i < SDL_arraysize(g_TestRoms); ++i)
+    {
+        size_t size = 0;
+        uint8_t* data = LoadTestRom(romDir, g_TestRoms[i], &size);
+        if (!data)
+            continue;
+
+        // Parent and fork carrying on from the same point, each writing to their shared memory, both have to end up
+        // where a machine run straight through does
+        ChippyMachine* reference = RunRom(data, size, CHIPPY_DISPATCH_CALL, TEST_STATE_CYCLES * 2);
+        ChippyMachine* parent = RunRom(data, size, CHIPPY_DISPATCH_CALL, TEST_STATE_CYCLES);
+        ChippyMachine* fork = parent ? CHIPPY_ForkMachine(parent) : NULL;
+        if (!reference || !fork)
+        {
+            TEST_CHECK(false, "%s: couldn't fork", g_TestRoms[i]);
+        }
+        else
+        {
+            TEST_CHECK(fork->pages[0] == parent->pages[0], "%s: fork copied memory it hasn't written", g_TestRoms[i]);
+            CHIPPY_SetDispatch(fork, CHIPPY_DISPATCH_JIT);
+            CHIPPY_RunCycles(fork, TEST_STATE_CYCLES, NULL);
+            CHIPPY_RunCycles(parent, TEST_STATE_CYCLES, NULL);
+            TEST_CHECK(SameState(reference, parent), "%s: parent ran differently after forking", g_TestRoms[i]);
+            TEST_CHECK(SameState(reference, fork), "%s: fork ran differently from its parent", g_TestRoms[i]);
+
+            const uint8_t scribble[CHIPPY_PAGE_SIZE] = { 0xFF };
+            TEST_CHECK(CHIPPY_WriteMemory(fork, 0, scribble, sizeof(scribble)) == 0, "%s: couldn't write to fork", g_TestRoms[i]);
+            TEST_CHECK(fork->pages[0] != parent->pages[0] && SameState(reference, parent), "%s: fork wrote to its parent's memory", g_TestRoms[i]);
+        }
+
+        CHIPPY_DestroyMachine(reference);
+        CHIPPY_DestroyMachine(fork);
+        CHIPPY_DestroyMachine(parent);
+        SDL_free(data);
+    }
+}
+
+/** Lockstep **/
+// Runs a group of forks of the rom in lockstep beside the same forks run on their own, every lane has to end up
+// where its reference does
+static void CheckLockstep(const char* name, const uint8_t* data, size_t size, ChippyQuirks quirks)
+{
+    ChippyMachine* prototype = RunRom(data, size, CHIPPY_DISPATCH_CALL, 0);
+    if (prototype)
+        CHIPPY_SetQuirks(prototype, quirks);
+    ChippyMachine* lanes[TEST_LOCKSTEP_LANES] = { NULL };
+    ChippyMachine* references[TEST_LOCKSTEP_LANES] = { NULL };
+    bool ok = prototype != NULL;
+    for (int lane = 0; lane < TEST_LOCKSTEP_LANES && ok; ++lane)
+    {
+        lanes[lane] = CHIPPY_ForkMachine(prototype);
+        references[lane] = CHIPPY_ForkMachine(prototype);
+        ok = lanes[lane] && references[lane];
+        if (ok && lane % 4 == 3)
+        {
+            CHIPPY_SeedRandom(lanes[lane], TEST_SEED + lane);
+            CHIPPY_SeedRandom(references[lane], TEST_SEED + lane);
+        }
+    }
+    ChippyLockstep* lockstep = ok ? CHIPPY_CreateLockstep(lanes, TEST_LOCKSTEP_LANES) : NULL;
+    if (!lockstep)
+    {
+        TEST_CHECK(false, "%s: couldn't set up lockstep", name);
+    }
+    else
+    {
+        // Runs of uneven length with a few of the lanes pressing keys between them, so some split off partway
+        uint32_t random = 1;
+        uint64_t cycles = 0;
+        while (cycles < TEST_LOCKSTEP_CYCLES)
+        {
+            random = random * 1103515245 + 12345;
+            const int lane = (random >> 16) % TEST_LOCKSTEP_LANES;
+            if (lane % 2)
+            {
+                const SDL_Scancode key = g_InputHexTable[(random >> 8) & 0xF];
+                CHIPPY_InputEvent(lanes[lane], key, (random >> 24) & 1);
+                CHIPPY_InputEvent(references[lane], key, (random >> 24) & 1);
+            }
+
+            const uint64_t run = SDL_min(100 + (random >> 4) % 2000, TEST_LOCKSTEP_CYCLES - cycles);
+            CHIPPY_LockstepRun(lockstep, run);
+            for (int reference = 0; reference < TEST_LOCKSTEP_LANES; ++reference)
+                CHIPPY_RunCycles(references[reference], run, NULL);
+            cycles += run;
+        }
+
+        for (int lane = 0; lane < TEST_LOCKSTEP_LANES; ++lane)
+            TEST_CHECK(SameState(references[lane], lanes[lane]), "%s: lane %d ran differently in lockstep", name, lane);
+        TEST_CHECK(lockstep->laneCycles > 0, "%s: no lanes ran in lockstep", name);
+    }
+
+    CHIPPY_DestroyLockstep(lockstep);
+    for (int lane = 0; lane < TEST_LOCKSTEP_LANES; ++lane)
+    {
+        CHIPPY_DestroyMachine(lanes[lane]);
+        CHIPPY_DestroyMachine(references[lane]);
+    }
+    CHIPPY_DestroyMachine(prototype);
+}
+
+static void TestLockstep(const char* romDir)
+{
+    for (size_t i = 0; i < SDL_arraysize(g_TestRoms); ++i)
+    {
+        size_t size = 0;
+        uint8_t* data = LoadTestRom(romDir, g_TestRoms[i], &size);
+        if (!data)
+            continue;
+        CheckLockstep(g_TestRoms[i], data, size, CHIPPY_QUIRKS_DEFAULT);
+        SDL_free(data);
+    }
+
+    // Writes a random 62NN into its own path, so lanes end up fetching different instructions from memory that's
+    // written the same way everywhere else
+    const uint8_t selfModifying[] =
+    {
+        0xC1, 0x03, // V1 = random & 3
+        0x60, 0x62, // V0 = 0x62
+        0xA2, 0x0C, // I = 0x20C
+        0xF1, 0x55, // Store V0 and V1 at 0x20C
+        0x12, 0x0C, // Jump to 0x20C
+        0x00, 0x00,
+        0x00, 0x00, // V2 = V1, written here
+        0x12, 0x00, // Jump to 0x200
+    };
+    CheckLockstep("self modifying", selfModifying, sizeof(selfModifying), CHIPPY_QUIRKS_DEFAULT);
+}
+
+/** Quirks **/
+static void TestQuirks()
+{
+    TEST_CHECK(CHIPPY_QuirksForRom("roms/game.ch8") == CHIPPY_QUIRKS_VIP, "A .ch8 rom didn't pick the VIP quirks");
+    TEST_CHECK(CHIPPY_QuirksForRom("roms/game.SC8") == CHIPPY_QUIRKS_SCHIP, "A .sc8 rom didn't pick the SUPER-CHIP quirks");
+    TEST_CHECK(CHIPPY_QuirksForRom("roms.xo8/game") == CHIPPY_QUIRKS_VIP, "A rom without an extension didn't pick the VIP quirks");
+    TEST_CHECK(CHIPPY_QuirksForRom("game.xo8") == CHIPPY_QUIRKS_XOCHIP, "A .xo8 rom didn't pick the XO-CHIP quirks");
+    TEST_CHECK(CHIPPY_FindQuirks("schip") == CHIPPY_QUIRKS_SCHIP && CHIPPY_FindQuirks("chip48") == CHIPPY_QUIRKS_COUNT, "Quirk profiles looked up wrong");
+
+    // Leaves each quirk's effect somewhere to check
+    const uint8_t rom[] =
+    {
+        0x60, 0xF0, // V0 = 0xF0
+        0x61, 0x0F, // V1 = 0x0F
+        0x6F, 0x07, // VF = 7
+        0x80, 0x11, // V0 |= V1, clears VF with the VF reset quirk
+        0x87, 0xF0, // V7 = VF
+        0x63, 0x81, // V3 = 0x81
+        0x64, 0x02, // V4 = 2
+        0x83, 0x46, // V3 = V4 >> 1, or V3 >> 1 with the shift quirk
+        0x69, 0x00, // V9 = 0
+        0xF9, 0x29, // I = font 0
+        0x6A, 0x3E, // VA = 62
+        0x6B, 0x1E, // VB = 30
+        0xDA, 0xB5, // Draw 5 rows at (62, 30), off the bottom right corner
+        0xA3, 0x00, // I = 0x300
+        0xF1, 0x55, // Store V0 and V1 at 0x300, moving I past them with the memory quirk
+        0x60, 0x02, // V0 = 2
+        0x62, 0x06, // V2 = 6
+        0xB2, 0x26, // Jump to 0x226 + V0, or + V2 with the jump quirk
+        0x00, 0x00,
+        0x00, 0x00,
+        0x68, 0x01, // 0x228: V8 = 1
+        0x12, 0x2E,
+        0x68, 0x02, // 0x22C: V8 = 2
+        0x12, 0x2E, // 0x22E: Loop here
+    };
+
+    for (int dispatch = 0; dispatch < CHIPPY_DISPATCH_COUNT; ++dispatch)
+    {
+        // One machine runs every profile, so a profile can't be left running on blocks compiled for the last one
+        ChippyMachine* machine = CHIPPY_CreateMachine();
+        if (!machine)
+        {
+            TEST_CHECK(false, "Couldn't create a machine");
+            return;
+        }
+        CHIPPY_SetDispatch(machine, dispatch);
+
+        for (int quirks = 0; quirks < CHIPPY_QUIRKS_COUNT; ++quirks)
+        {
+            const uint8_t flags = g_QuirkFlags[quirks];
+            CHIPPY_ResetWithRom(machine, rom, sizeof(rom));
+            CHIPPY_SetQuirks(machine, quirks);
+            CHIPPY_RunCycles(machine, 100, NULL);
+
+            const char* name = g_QuirkNames[quirks];
+            TEST_CHECK(machine->variableRegisters[7] == (flags & CHIPPY_QUIRK_VF_RESET ? 0 : 7), "%s, dispatch %d: VF reset quirk", name, dispatch);
+            TEST_CHECK(machine->variableRegisters[3] == (flags & CHIPPY_QUIRK_SHIFT_VX ? 0x40 : 0x01), "%s, dispatch %d: shift quirk", name, dispatch);
+            TEST_CHECK(machine->indexRegister == (flags & CHIPPY_QUIRK_MEMORY_INDEX ? 0x302 : 0x300), "%s, dispatch %d: memory quirk", name, dispatch);
+            TEST_CHECK(machine->variableRegisters[8] == (flags & CHIPPY_QUIRK_JUMP_VX ? 2 : 1), "%s, dispatch %d: jump quirk", name, dispatch);
+
+            // The first and last rows of a 0 are 0xF0, the top one lands in the corner with the rest of it either
+            // wrapping round to the left edge or clipped, and the bottom one either wraps round to row 2 or is clipped
+            const bool wrap = (flags & CHIPPY_QUIRK_WRAP) != 0;
+            const uint64_t corner = wrap ? 0xC000000000000003ull : 0x3;
+            TEST_CHECK(machine->displayPlane[30] == corner && machine->displayPlane[2] == (wrap ? corner : 0), "%s, dispatch %d: wrap quirk", name, dispatch);
+        }
+        CHIPPY_DestroyMachine(machine);
+    }
+
+    for (int quirks = 0; quirks < CHIPPY_QUIRKS_COUNT; ++quirks)
+        CheckLockstep(g_QuirkNames[quirks], rom, sizeof(rom), quirks);
+}
+
+/** Timers **/
+static void TestTimers()
+{
+    const uint8_t rom[] =
+    {
+        0x60, 0x0A, // V0 = 10
+        0xF0, 0x15, // DT = V0
+        0xF0, 0x18, // ST = V0
+        0xF1, 0x07, // 0x206: V1 = DT
+        0x12, 0x06, // Loop back
+    };
+
+    for (int dispatch = 0; dispatch < CHIPPY_DISPATCH_COUNT; ++dispatch)
+    {
+        ChippyMachine* machine = RunRom(rom, sizeof(rom), dispatch, 0);
+        if (!machine)
+        {
+            TEST_CHECK(false, "Couldn't set up timer test");
+            return;
+        }
+
+        // Set in frame 0, so they've counted down once for each frame started since
+        for (uint64_t frame = 1; frame <= 12; ++frame)
+        {
+            CHIPPY_RunCycles(machine, CHIPPY_FrameStartCycle(frame) + 3 - machine->cycles, NULL);
+            const uint8_t expected = frame < 10 ? (uint8_t)(10 - frame) : 0;
+            TEST_CHECK(machine->variableRegisters[1] == expected && CHIPPY_GetDelayTimer(machine) == expected &&
+                CHIPPY_GetSoundTimer(machine) == expected, "Dispatch %d: timers read %d/%d/%d in frame %d, not %d", dispatch,
+                machine->variableRegisters[1], CHIPPY_GetDelayTimer(machine), CHIPPY_GetSoundTimer(machine), (int)frame, expected);
+        }
+
+        // Set from outside, they count down from the frame the machine's in
+        CHIPPY_SetTimers(machine, 3, 200);
+        CHIPPY_RunCycles(machine, CHIPPY_FrameStartCycle(14) + 3 - machine->cycles, NULL);
+        TEST_CHECK(machine->variableRegisters[1] == 1 && CHIPPY_GetSoundTimer(machine) == 198, "Dispatch %d: timers set from outside ran wrong", dispatch);
+        CHIPPY_DestroyMachine(machine);
+    }
+}
+
+/** Idle Skip **/
+// Runs in steps of one instruction never cross a frame so never skip, giving the state a big run has to match
+static void CheckIdleSkip(const char* name, const uint8_t* data, size_t size)
+{
+    for (int dispatch = 0; dispatch < CHIPPY_DISPATCH_COUNT; ++dispatch)
+    {
+        ChippyMachine* skipped = RunRom(data, size, dispatch, 0);
+        ChippyMachine* stepped = RunRom(data, size, dispatch, 0);
+        ChippyMovie* movie = CHIPPY_CreateMovie();
+        ChippyMachine* replayed = RunRom(data, size, dispatch, 0);
+        if (!skipped || !stepped || !movie || !replayed)
+        {
+            TEST_CHECK(false, "Couldn't set up idle skip test: %s", name);
+            goto cleanup;
+        }
+
+        // Press and release a key partway through, with the stepped run recorded for the replay to skip through
+        CHIPPY_MovieRecord(movie, stepped, TEST_SEED);
+        uint64_t idleCycles = 0;
+        for (int phase = 0; phase < 3; ++phase)
+        {
+            if (phase > 0)
+            {
+                CHIPPY_InputEvent(skipped, g_InputHexTable[5], phase == 1);
+                CHIPPY_InputEvent(stepped, g_InputHexTable[5], phase == 1);
+            }
+            ChippyRunStats stats = { 0 };
+            CHIPPY_RunCycles(skipped, TEST_IDLE_CYCLES, &stats);
+            idleCycles += stats.idleCycles;
+            for (uint64_t i = 0; i < TEST_IDLE_CYCLES; ++i)
+                CHIPPY_RunCycles(stepped, 1, NULL);
+        }
+        stepped->movie = NULL;
+
+#if CHIPPY_IDLE_SKIP
+        TEST_CHECK(idleCycles > 0, "%s, dispatch %d: no idle loop was skipped", name, dispatch);
+#else
+        (void)idleCycles;
+#endif
+        TEST_CHECK(SameState(skipped, stepped), "%s, dispatch %d: skipping idle loops changed the run", name, dispatch);
+
+        if (CHIPPY_MoviePlay(movie, replayed) == 0)
+        {
+            CHIPPY_RunCycles(replayed, TEST_IDLE_CYCLES * 3, NULL);
+            TEST_CHECK(SameState(replayed, stepped), "%s, dispatch %d: skipping idle loops changed the replay", name, dispatch);
+            replayed->movie = NULL;
+        }
+        else
+        {
+            TEST_CHECK(false, "%s, dispatch %d: couldn't play movie", name, dispatch);
+        }
+
+    cleanup:
+        CHIPPY_DestroyMovie(movie);
+        CHIPPY_DestroyMachine(skipped);
+        CHIPPY_DestroyMachine(stepped);
+        CHIPPY_DestroyMachine(replayed);
+    }
+}
+
+static void TestIdleSkip()
+{
+    // Polls the delay timer both ways, waits on a key and then counts, so leaving any of them late or early shows
+    const uint8_t waits[] =
+    {
+        0x60, 0x50, // V0 = 0x50
+        0xF0, 0x15, // DT = V0
+        0xF1, 0x07, // 0x204: V1 = DT
+        0x31, 0x00, // Loop back while V1 != 0
+        0x12, 0x04,
+        0x60, 0x20, // V0 = 0x20
+        0xF0, 0x15, // DT = V0
+        0xF2, 0x07, // 0x20E: V2 = DT
+        0x42, 0x20, // Loop back while V2 == 0x20
+        0x12, 0x0E,
+        0xF3, 0x0A, // Wait for a key
+        0xF3, 0x18, // ST = V3
+        0x76, 0x01, // 0x218: V6 += 1
+        0x12, 0x18,
+    };
+    CheckIdleSkip("waits", waits, sizeof(waits));
+
+    // A delay poll reached by a jump, that doesn't start on an even frame
+    const uint8_t unaligned[] =
+    {
+        0x64, 0xFF, // V4 = 0xFF
+        0xF4, 0x15, // DT = V4
+        0x12, 0x07, // Jump to the odd address 0x207
+        0x00,
+        0xF5, 0x07, // 0x207: V5 = DT
+        0x35, 0x00, // Loop back while V5 != 0
+        0x12, 0x07,
+        0x76, 0x01, // 0x20D: V6 += 1
+        0x12, 0x0D,
+    };
+    CheckIdleSkip("unaligned", unaligned, sizeof(unaligned));
+
+    const uint8_t spin[] =
+    {
+        0x60, 0x30, // V0 = 0x30
+        0xF0, 0x18, // ST = V0
+        0x12, 0x04, // 0x204: Loop here
+    };
+    CheckIdleSkip("spin", spin, sizeof(spin));
+}
+
+/** Save States **/
+static void TestSaveState(const char* romDir)
+{
+    static uint8_t state[CHIPPY_STATE_MAX_SIZE];
+    uint8_t* other = NULL;
+    size_t otherSize = 0;
+
+    for (size_t i = 0; i < SDL_arraysize(g_TestRoms); ++i)
+    {
+        size_t size = 0;
+        uint8_t* data = LoadTestRom(romDir, g_TestRoms[i], &size);
+        if (!data)
+            continue;
+
+        // Save part way through, then check a fresh machine restored from it carries on exactly like the original
+        ChippyMachine* original = RunRom(data, size, CHIPPY_DISPATCH_JIT, TEST_STATE_CYCLES);
+        ChippyMachine* restored = RunRom(data, size, CHIPPY_DISPATCH_CALL, 0);
+        if (!original || !restored)
+        {
+            TEST_CHECK(false, "%s: couldn't run", g_TestRoms[i]);
+        }
+        else
+        {
+            const size_t stateSize = CHIPPY_SaveState(original, state, sizeof(state));
+            TEST_CHECK(stateSize > 0, "%s: couldn't save state", g_TestRoms[i]);
+            TEST_CHECK(CHIPPY_LoadState(restored, state, stateSize - 1) != 0, "%s: loaded a truncated state", g_TestRoms[i]);
+            TEST_CHECK(CHIPPY_LoadState(restored, state, stateSize) == 0, "%s: couldn't load state", g_TestRoms[i]);
+            TEST_CHECK(CHIPPY_SaveState(original, state, stateSize - 1) == 0, "%s: saved into a buffer too small", g_TestRoms[i]);
+
+            CHIPPY_RunCycles(original, TEST_STATE_CYCLES, NULL);
+            CHIPPY_RunCycles(restored, TEST_STATE_CYCLES, NULL);
+            TEST_CHECK(SameState(original, restored), "%s: restored machine ran differently", g_TestRoms[i]);
+
+            // A state from the previous rom has to be turned away
+            if (other)
+            {
+                ChippyMachine* previous = RunRom(other, otherSize, CHIPPY_DISPATCH_CALL, TEST_STATE_CYCLES);
+                const size_t previousSize = previous ? CHIPPY_SaveState(previous, state, sizeof(state)) : 0;
+                TEST_CHECK(previousSize && CHIPPY_LoadState(restored, state, previousSize) != 0, "%s: loaded another rom's state", g_TestRoms[i]);
+                CHIPPY_DestroyMachine(previous);
+            }
+        }
+
+        CHIPPY_DestroyMachine(original);
+        CHIPPY_DestroyMachine(restored);
+        SDL_free(other);
+        other = data;
+        otherSize = size;
+    }
+
+    SDL_free(other);
+}
+
+/** Rewind **/
+static void TestRewind(const char* romDir)
+{
+    static uint8_t* states[TEST_REWIND_FRAMES];
+    static size_t stateSizes[TEST_REWIND_FRAMES];
+    static uint8_t state[CHIPPY_STATE_MAX_SIZE];
+
+    size_t size = 0;
+    uint8_t* data = LoadTestRom(romDir, "3-corax+.ch8", &size);
+    ChippyMachine* machine = data ? RunRom(data, size, CHIPPY_DISPATCH_CALL, 0) : NULL;
+    ChippyRewind* rewind = CHIPPY_CreateRewind(TEST_REWIND_BUFFER_SIZE, 1);
+    if (!machine || !rewind)
+    {
+        TEST_CHECK(false, "Couldn't set up rewind test");
+        goto cleanup;
+    }
+
+    // Keep a save state of every snapshot, then check each step back lands on the matching one
+    const uint64_t cyclesPerFrame = (uint64_t)(CHIPPY_CYCLES_PER_SEC / CHIPPY_TIMER_HZ) + 1;
+    for (int frame = 0; frame < TEST_REWIND_FRAMES; ++frame)
+    {
+        CHIPPY_RunCycles(machine, cyclesPerFrame, NULL);
+        CHIPPY_RewindRecord(rewind, machine);
+        stateSizes[frame] = CHIPPY_SaveState(machine, state, sizeof(state));
+        states[frame] = SDL_malloc(stateSizes[frame]);
+        if (states[frame])
+            SDL_memcpy(states[frame], state, stateSizes[frame]);
+    }
+
+    int frame = TEST_REWIND_FRAMES - 1;
+    while (CHIPPY_RewindStep(rewind, machine))
+    {
+        --frame;
+        const size_t stateSize = CHIPPY_SaveState(machine, state, sizeof(state));
+        if (frame < 0 || !states[frame] || stateSize != stateSizes[frame] || SDL_memcmp(state, states[frame], stateSize) != 0)
+        {
+            TEST_CHECK(false, "Rewinding to frame %d didn't match the recorded state", frame);
+            break;
+        }
+    }
+    TEST_CHECK(frame > 0, "Ring buffer didn't drop old history");
+    TEST_CHECK(frame < TEST_REWIND_FRAMES / 2, "Ring buffer kept too little history");
+
+cleanup:
+    for (int i = 0; i < TEST_REWIND_FRAMES; ++i)
+        SDL_free(states[i]);
+    CHIPPY_DestroyRewind(rewind);
+    CHIPPY_DestroyMachine(machine);
+    SDL_free(data);
+}
+
+/** Movies **/
+// Records a run mashing keys, then checks the movie replays it. Every so often the recording rewinds and records over
+// what was rewound, which the movie has to drop.
+static void CheckMovie(const char* name, const uint8_t* data, size_t size)
+{
+    ChippyMachine* recorded = RunRom(data, size, CHIPPY_DISPATCH_CALL, 0);
+    ChippyMachine* replayed = RunRom(data, size, CHIPPY_DISPATCH_JIT, 0);
+    ChippyMovie* movie = CHIPPY_CreateMovie();
+    ChippyMovie* loaded = NULL;
+    ChippyRewind* rewind = CHIPPY_CreateRewind(0, 1);
+    if (!recorded || !replayed || !movie || !rewind)
+    {
+        TEST_CHECK(false, "Couldn't set up movie test: %s", name);
+        goto cleanup;
+    }
+
+    // Runs of uneven length, like host frames, so key events land mid emulated frame
+    CHIPPY_MovieRecord(movie, recorded, TEST_SEED + 1);
+    uint32_t random = 1;
+    uint64_t nextRewind = TEST_MOVIE_REWIND_CYCLES;
+    while (recorded->cycles < TEST_MOVIE_CYCLES)
+    {
+        random = random * 1103515245 + 12345;
+        CHIPPY_InputEvent(recorded, g_InputHexTable[(random >> 16) & 0xF], (random >> 24) & 1);
+        CHIPPY_RunCycles(recorded, SDL_min((random >> 8) % 40, TEST_MOVIE_CYCLES - recorded->cycles), NULL);
+        CHIPPY_RewindRecord(rewind, recorded);
+
+        if (recorded->cycles >= nextRewind)
+        {
+            for (int step = 0; step < TEST_MOVIE_REWIND_STEPS; ++step)
+                TEST_CHECK(CHIPPY_RewindStep(rewind, recorded), "%s: ran out of history rewinding the recording", name);
+            nextRewind += TEST_MOVIE_REWIND_CYCLES;
+        }
+    }
+    recorded->movie = NULL;
+
+    TEST_CHECK(CHIPPY_SaveMovie(movie, TEST_MOVIE_PATH) == 0, "%s: couldn't save movie", name);
+    loaded = CHIPPY_LoadMovie(TEST_MOVIE_PATH);
+    SDL_RemovePath(TEST_MOVIE_PATH);
+    TEST_CHECK(loaded && loaded->frameCount == movie->frameCount && loaded->runCount == movie->runCount, "%s: movie didn't survive a save and load", name);
+    TEST_CHECK(movie->runCount > 1, "%s: movie recorded no key presses", name);
+
+    if (loaded && CHIPPY_MoviePlay(loaded, replayed) == 0)
+    {
+        CHIPPY_RunCycles(replayed, TEST_MOVIE_CYCLES, NULL);
+        TEST_CHECK(SameState(recorded, replayed), "%s: replaying the movie didn't match the recorded run", name);
+    }
+    else
+    {
+        TEST_CHECK(false, "%s: couldn't play movie", name);
+    }
+
+cleanup:
+    if (replayed)
+        replayed->movie = NULL;
+    CHIPPY_DestroyRewind(rewind);
+    CHIPPY_DestroyMovie(loaded);
+    CHIPPY_DestroyMovie(movie);
+    CHIPPY_DestroyMachine(recorded);
+    CHIPPY_DestroyMachine(replayed);
+}
+
+static void TestMovie(const char* romDir)
+{
+    // Each key held on its own, and as the last key pressed, has to come back from a frame's input as it went in
+    for (int key = 0; key < 16; ++key)
+    {
+        uint64_t held = 0;
+        SET_INPUT(held, g_InputHexTable[key], 1);
+        uint64_t inputBitMap = 0;
+        uint8_t lastInput = 0;
+        CHIPPY_UnpackInput(CHIPPY_PackInput(held, g_InputHexTable[key]), &inputBitMap, &lastInput);
+        TEST_CHECK(inputBitMap == held && lastInput == g_InputHexTable[key], "Key %X didn't survive packing into a frame's input", key);
+    }
+
+    // Reads a key every few instructions, so any instruction run with the wrong keys held shows
+    const uint8_t poll[] =
+    {
+        0xE0, 0xA1, // 0x200: Skip if key V0 isn't held
+        0x76, 0x01, // V6 += 1
+        0x70, 0x01, // V0 += 1
+        0x40, 0x10, // Wrap V0 back to 0 after key F
+        0x60, 0x00,
+        0x12, 0x00,
+    };
+    CheckMovie("poll", poll, sizeof(poll));
+
+    size_t size = 0;
+    uint8_t* data = LoadTestRom(romDir, "6-keypad.ch8", &size);
+    if (data)
+        CheckMovie("6-keypad.ch8", data, size);
+    SDL_free(data);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* romDir = argc > 1 ? argv[1] : TEST_DEFAULT_ROM_DIR;
+
+    TestDecode();
+    TestLoadRom();
+    TestDispatchAgrees(romDir);
+    TestRunner();
+    TestFork(romDir);
+    TestLockstep(romDir);
+    TestQuirks();
+    TestTimers();
+    TestIdleSkip();
+    TestSaveState(romDir);
+    TestRewind(romDir);
+    TestMovie(romDir);
+
+    if (g_Failures)
+        SDL_Log("%d check(s) failed", g_Failures);
+    else
+        SDL_Log("All tests passed");
+    return g_Failures ? 1 : 0;
+}